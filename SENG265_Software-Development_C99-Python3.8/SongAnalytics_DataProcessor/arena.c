@@ -0,0 +1,147 @@
+/** @file arena.c
+ *  @brief Implementation of the bump-allocated string arena.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "arena.h"
+
+#define ARENA_ALIGN 8
+
+/**
+ * Function: arena_new
+ * -------------------
+ * @brief  Creates an empty arena. The first chunk is allocated on first use.
+ *
+ * @return arena_t* The new arena.
+ *
+ */
+arena_t *arena_new(void)
+{
+    arena_t *arena = emalloc(sizeof(arena_t));
+    arena->chunks = NULL;
+    return arena;
+}
+
+/**
+ * Function: arena_alloc
+ * ---------------------
+ * @brief  Allocates memory that lives until the arena is reset or freed.
+ *
+ * @param arena The arena.
+ * @param size The number of bytes wanted.
+ *
+ * @return void* The memory, aligned to ARENA_ALIGN bytes.
+ *
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk = arena->chunks;
+    size_t start = chunk != NULL ? (chunk->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1) : 0;
+
+    if (chunk == NULL || start + size > chunk->size) {
+        /*--Oversized requests get a chunk of their own--*/
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = emalloc(sizeof(arena_chunk_t) + chunk_size);
+        chunk->size = chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        start = 0;
+    }
+    chunk->used = start + size;
+    return chunk->data + start;
+}
+
+/**
+ * Function: arena_strdup
+ * ----------------------
+ * @brief  Copies a string into the arena.
+ *
+ * @param arena The arena.
+ * @param s The string to copy.
+ *
+ * @return char* The copy.
+ *
+ */
+char *arena_strdup(arena_t *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = arena_alloc(arena, len);
+    memcpy(copy, s, len);
+    return copy;
+}
+
+/**
+ * Function: arena_mark
+ * --------------------
+ * @brief  Returns the current position of an arena.
+ *
+ * @param arena The arena.
+ *
+ * @return arena_mark_t The position, for arena_release.
+ *
+ */
+arena_mark_t arena_mark(arena_t *arena)
+{
+    arena_mark_t mark = {arena->chunks, arena->chunks != NULL ? arena->chunks->used : 0};
+    return mark;
+}
+
+/**
+ * Function: arena_release
+ * -----------------------
+ * @brief  Gives back everything allocated since a mark was taken.
+ *
+ * @param arena The arena.
+ * @param mark A mark of this arena, taken after any later reset.
+ *
+ */
+void arena_release(arena_t *arena, arena_mark_t mark)
+{
+    while (arena->chunks != mark.chunk) {
+        arena_chunk_t *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+    if (mark.chunk != NULL)
+        mark.chunk->used = mark.used;
+}
+
+/**
+ * Function: arena_reset
+ * ---------------------
+ * @brief  Frees everything allocated from the arena, keeping one chunk for reuse.
+ *
+ * @param arena The arena.
+ *
+ */
+void arena_reset(arena_t *arena)
+{
+    arena_chunk_t *chunk = arena->chunks;
+    if (chunk == NULL)
+        return;
+    while (chunk->next != NULL) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    chunk->used = 0;
+    arena->chunks = chunk;
+}
+
+/**
+ * Function: arena_free
+ * --------------------
+ * @brief  Frees an arena and everything allocated from it.
+ *
+ * @param arena The arena, or NULL.
+ *
+ */
+void arena_free(arena_t *arena)
+{
+    if (arena == NULL)
+        return;
+    arena_reset(arena);
+    free(arena->chunks);
+    free(arena);
+}
@@ -0,0 +1,55 @@
+/** @file arena.h
+ *  @brief Function prototypes for the bump-allocated string arena.
+ *
+ * An arena hands out memory from large chunks and frees it all at once, so
+ * the strings of many records cost no per-string malloc and sit packed
+ * together, away from the list nodes that are walked while sorting. An
+ * arena is not thread safe; each owner uses its own.
+ */
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/**
+ * @brief A chunk of arena memory. Chunks are chained newest first.
+ */
+typedef struct arena_chunk_t
+{
+    struct arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_chunk_t;
+
+/**
+ * @brief An arena.
+ */
+typedef struct arena_t
+{
+    arena_chunk_t *chunks;
+} arena_t;
+
+/**
+ * @brief A position in an arena, to give back everything allocated after it.
+ */
+typedef struct arena_mark_t
+{
+    arena_chunk_t *chunk;
+    size_t used;
+} arena_mark_t;
+
+/**
+ * Function protypes associated with the arena.
+ */
+arena_t *arena_new(void);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *s);
+arena_mark_t arena_mark(arena_t *arena);
+void arena_release(arena_t *arena, arena_mark_t mark);
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,1225 @@
+/** @file binfmt.c
+ *  @brief Implementation of the columnar binary cache.
+ *
+ * Layout of a cache file (host byte order, checked through the endian mark):
+ *
+ *   bin_header_t
+ *   block 0 .. block N-1      (bin_block_t followed by its columns)
+ *   artist dictionary         (u32 count, u32 offsets[count + 1], bytes)
+ *   name indexes              (trigram index of the artists, then of the track names)
+ *   prefix indexes            (prefix index of the track names, then of the artists)
+ *   block index               (u64 offset of each block)
+ *   zone table                (bin_zone_t per block and column, block major)
+ *
+ * Inside a block, track names are sorted and front coded with a restart
+ * point every BIN_RESTART_INTERVAL entries; name_rank maps a row to its
+ * position in the sorted run. Numeric columns (including artist ids and
+ * packed dates) are stored as bit-packed deltas from the block minimum; the
+ * per-column min/max doubles as a zone map. A Bloom filter over the single
+ * artists of the block (see next_artist_token) lets artist-equality queries
+ * skip blocks without decoding them. Every section is padded to 8 bytes so
+ * the columns can be read in place from the mapping.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "bitpack.h"
+#include "binfmt.h"
+
+#define NAME_CAP 200
+
+/**
+ * @brief The node fields each packed column is decoded into; the artist id
+ * column is what artist filters read.
+ */
+static const unsigned int column_fields[BIN_NUM_COLUMNS] = {
+    FIELD_ARTIST, FIELD_DATE, FIELD_ARTIST_COUNT, FIELD_SPOTIFY, FIELD_STREAMS, FIELD_APPLE
+};
+
+/**
+ * @brief A growable byte buffer used to assemble a block before writing it.
+ */
+typedef struct buf_t
+{
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+/**
+ * @brief Open-addressing hash table that interns artist strings to ids.
+ */
+typedef struct dict_t
+{
+    const char **strings;
+    uint32_t count;
+    uint32_t *slots;
+    size_t num_slots;
+} dict_t;
+
+/**
+ * @brief A track name paired with the row it came from, used for sorting.
+ */
+typedef struct name_entry_t
+{
+    const char *name;
+    uint32_t row;
+} name_entry_t;
+
+static void buf_reserve(buf_t *buf, size_t extra)
+{
+    if (buf->len + extra <= buf->cap)
+        return;
+    while (buf->len + extra > buf->cap)
+        buf->cap = buf->cap == 0 ? 4096 : buf->cap * 2;
+    buf->data = realloc(buf->data, buf->cap);
+    assert(buf->data != NULL && "buf->data == NULL");
+}
+
+static void buf_put(buf_t *buf, const void *src, size_t n)
+{
+    buf_reserve(buf, n);
+    memcpy(buf->data + buf->len, src, n);
+    buf->len += n;
+}
+
+static void buf_align(buf_t *buf)
+{
+    static const unsigned char zeros[8] = {0};
+    buf_put(buf, zeros, (8 - buf->len % 8) % 8);
+}
+
+static void buf_put_varint(buf_t *buf, uint32_t value)
+{
+    unsigned char byte;
+    do {
+        byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        buf_put(buf, &byte, 1);
+    } while (value != 0);
+}
+
+static uint32_t get_varint(const unsigned char **p)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = *(*p)++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+static uint64_t hash_string(const char *s)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (; *s != '\0'; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+static void dict_init(dict_t *dict, size_t expected)
+{
+    dict->num_slots = 16;
+    while (dict->num_slots < expected * 2)
+        dict->num_slots *= 2;
+    dict->slots = emalloc(dict->num_slots * sizeof(uint32_t));
+    memset(dict->slots, 0xff, dict->num_slots * sizeof(uint32_t));
+    dict->strings = emalloc((expected + 1) * sizeof(const char *));
+    dict->count = 0;
+}
+
+static uint32_t dict_intern(dict_t *dict, const char *s)
+{
+    size_t slot = hash_string(s) & (dict->num_slots - 1);
+    while (dict->slots[slot] != UINT32_MAX) {
+        if (strcmp(dict->strings[dict->slots[slot]], s) == 0)
+            return dict->slots[slot];
+        slot = (slot + 1) & (dict->num_slots - 1);
+    }
+    dict->slots[slot] = dict->count;
+    dict->strings[dict->count] = s;
+    return dict->count++;
+}
+
+static void dict_free(dict_t *dict)
+{
+    free(dict->slots);
+    free(dict->strings);
+}
+
+static int compare_name_entry(const void *a, const void *b)
+{
+    const name_entry_t *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    return c != 0 ? c : (x->row > y->row) - (x->row < y->row);
+}
+
+/**
+ * @brief Front codes the sorted track names of a block into buf.
+ */
+static void write_names(buf_t *buf, node_t **rows, uint32_t n, uint16_t *name_rank)
+{
+    name_entry_t *entries = emalloc(n * sizeof(name_entry_t));
+    uint32_t num_restarts = (n + BIN_RESTART_INTERVAL - 1) / BIN_RESTART_INTERVAL;
+    size_t restarts_at = buf->len;
+    const char *prev = "";
+
+    for (uint32_t i = 0; i < n; i++) {
+        entries[i].name = node_track_name(rows[i]);
+        entries[i].row = i;
+    }
+    qsort(entries, n, sizeof(name_entry_t), compare_name_entry);
+
+    buf_reserve(buf, num_restarts * sizeof(uint32_t));
+    buf->len += num_restarts * sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const char *name = entries[i].name;
+        size_t len = strnlen(name, NAME_CAP - 1);
+        uint32_t shared = 0;
+
+        if (i % BIN_RESTART_INTERVAL == 0) {
+            uint32_t at = (uint32_t)(buf->len - restarts_at);
+            memcpy(buf->data + restarts_at + (i / BIN_RESTART_INTERVAL) * sizeof(uint32_t), &at, sizeof(at));
+        } else {
+            while (shared < len && prev[shared] == name[shared])
+                shared++;
+        }
+        buf_put_varint(buf, shared);
+        buf_put_varint(buf, (uint32_t)(len - shared));
+        buf_put(buf, name + shared, len - shared);
+        name_rank[entries[i].row] = (uint16_t)i;
+        prev = name;
+    }
+    free(entries);
+}
+
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ull;
+    return h;
+}
+
+/**
+ * @brief Sets or tests the BIN_BLOOM_HASHES bits of a key (double hashing).
+ *
+ * @return bool When testing, true if every bit was set.
+ */
+static bool bloom_probe(unsigned char *set, const unsigned char *test, uint32_t bits, const char *key, size_t len)
+{
+    uint64_t h = hash_bytes(key, len);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+
+    for (uint32_t i = 0; i < BIN_BLOOM_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) & (bits - 1);
+        if (set != NULL)
+            set[bit / 8] |= (unsigned char)(1u << (bit % 8));
+        else if (!(test[bit / 8] & (1u << (bit % 8))))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends the Bloom filter of the single artists in a block.
+ */
+static void write_bloom(buf_t *buf, bin_block_t *block, node_t **rows, uint32_t n)
+{
+    size_t num_keys = 0;
+    size_t len;
+
+    for (uint32_t i = 0; i < n; i++)
+        for (const char *t = next_artist_token(node_artist(rows[i]), &len); t != NULL; t = next_artist_token(t + len, &len))
+            num_keys++;
+
+    uint32_t bits = 512;
+    while (bits < num_keys * BIN_BLOOM_BITS_PER_KEY && bits < (1u << 20))
+        bits *= 2;
+
+    block->bloom_offset = (uint32_t)buf->len;
+    block->bloom_bits = bits;
+    buf_reserve(buf, bits / 8);
+    unsigned char *filter = buf->data + buf->len;
+    memset(filter, 0, bits / 8);
+    buf->len += bits / 8;
+
+    for (uint32_t i = 0; i < n; i++)
+        for (const char *t = next_artist_token(node_artist(rows[i]), &len); t != NULL; t = next_artist_token(t + len, &len))
+            bloom_probe(filter, NULL, bits, t, len);
+    buf_align(buf);
+}
+
+/**
+ * @brief Appends one frame-of-reference packed column to a block.
+ */
+static void write_column(buf_t *buf, bin_block_t *block, int col, const uint64_t *values, uint32_t n)
+{
+    bin_column_t *column = &block->columns[col];
+
+    column->min = column->max = values[0];
+    for (uint32_t i = 1; i < n; i++) {
+        if (values[i] < column->min)
+            column->min = values[i];
+        if (values[i] > column->max)
+            column->max = values[i];
+    }
+    column->bits = bitpack_width(column->max - column->min);
+    column->offset = (uint32_t)buf->len;
+
+    size_t size = bitpack_size(n, column->bits);
+    buf_reserve(buf, size);
+    bitpack_pack(values, n, column->min, column->bits, buf->data + buf->len);
+    buf->len += size;
+    buf_align(buf);
+}
+
+/**
+ * @brief Encodes one block of rows and appends it to the output file.
+ */
+static void write_block(FILE *out, node_t **rows, uint32_t *artist_ids, uint32_t n, bin_zone_t *zones)
+{
+    buf_t buf = {0};
+    bin_block_t block = {0};
+    uint16_t *name_rank = emalloc(n * sizeof(uint16_t));
+    uint64_t *values = emalloc(n * sizeof(uint64_t));
+
+    block.num_rows = n;
+    buf_reserve(&buf, sizeof(block));
+    buf.len = sizeof(block);
+    buf_align(&buf);
+
+    block.names_offset = (uint32_t)buf.len;
+    write_names(&buf, rows, n, name_rank);
+    buf_align(&buf);
+
+    block.name_rank_offset = (uint32_t)buf.len;
+    buf_put(&buf, name_rank, n * sizeof(uint16_t));
+    buf_align(&buf);
+
+    write_bloom(&buf, &block, rows, n);
+
+    for (uint32_t i = 0; i < n; i++)
+        values[i] = artist_ids[i];
+    write_column(&buf, &block, BIN_COL_ARTIST_ID, values, n);
+    for (uint32_t i = 0; i < n; i++)
+        values[i] = rows[i]->date;
+    write_column(&buf, &block, BIN_COL_DATE, values, n);
+    for (uint32_t i = 0; i < n; i++)
+        values[i] = rows[i]->artist_count;
+    write_column(&buf, &block, BIN_COL_ARTIST_COUNT, values, n);
+    for (uint32_t i = 0; i < n; i++)
+        values[i] = rows[i]->in_spotify_playlists;
+    write_column(&buf, &block, BIN_COL_SPOTIFY, values, n);
+    for (uint32_t i = 0; i < n; i++)
+        values[i] = rows[i]->streams;
+    write_column(&buf, &block, BIN_COL_STREAMS, values, n);
+    for (uint32_t i = 0; i < n; i++)
+        values[i] = rows[i]->in_apple_playlists;
+    write_column(&buf, &block, BIN_COL_APPLE, values, n);
+
+    for (int col = 0; col < BIN_NUM_COLUMNS; col++) {
+        zones[col].min = block.columns[col].min;
+        zones[col].max = block.columns[col].max;
+    }
+
+    block.size = (uint32_t)buf.len;
+    memcpy(buf.data, &block, sizeof(block));
+    fwrite(buf.data, 1, buf.len, out);
+
+    free(values);
+    free(name_rank);
+    free(buf.data);
+}
+
+static void write_padding(FILE *out)
+{
+    static const unsigned char zeros[8] = {0};
+    long pos = ftell(out);
+    fwrite(zeros, 1, (8 - pos % 8) % 8, out);
+}
+
+/**
+ * @brief Writes the artist dictionary section.
+ */
+static void write_dict(FILE *out, dict_t *dict)
+{
+    uint32_t offset = 0;
+
+    fwrite(&dict->count, sizeof(uint32_t), 1, out);
+    for (uint32_t i = 0; i < dict->count; i++) {
+        fwrite(&offset, sizeof(uint32_t), 1, out);
+        offset += (uint32_t)strlen(dict->strings[i]) + 1;
+    }
+    fwrite(&offset, sizeof(uint32_t), 1, out);
+    for (uint32_t i = 0; i < dict->count; i++)
+        fwrite(dict->strings[i], 1, strlen(dict->strings[i]) + 1, out);
+}
+
+/**
+ * Function: bin_write
+ * -------------------
+ * @brief  Writes every record of a list to a binary cache file.
+ *
+ * @param path The file to create.
+ * @param list The records to store, in list order.
+ * @param indexes The BIN_INDEX_* bits of the optional indexes to write.
+ *
+ * @return int 0 on success, -1 if the file could not be written.
+ *
+ */
+int bin_write(const char *path, node_t *list, unsigned int indexes)
+{
+    bin_header_t header = {{0}};
+    dict_t dict;
+    size_t n = 0;
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL)
+        return -1;
+
+    for (node_t *curr = list; curr != NULL; curr = curr->next)
+        n++;
+
+    node_t **rows = emalloc((n + 1) * sizeof(node_t *));
+    uint32_t *artist_ids = emalloc((n + 1) * sizeof(uint32_t));
+    dict_init(&dict, n);
+    n = 0;
+    for (node_t *curr = list; curr != NULL; curr = curr->next) {
+        rows[n] = curr;
+        artist_ids[n] = dict_intern(&dict, node_artist(curr));
+        n++;
+    }
+
+    memcpy(header.magic, BIN_MAGIC, 4);
+    header.version = BIN_VERSION;
+    header.endian_mark = BIN_ENDIAN_MARK;
+    header.block_rows = BIN_BLOCK_ROWS;
+    header.num_rows = n;
+    header.num_blocks = (n + BIN_BLOCK_ROWS - 1) / BIN_BLOCK_ROWS;
+    fwrite(&header, sizeof(header), 1, out);
+    write_padding(out);
+
+    uint64_t *index = emalloc((header.num_blocks + 1) * sizeof(uint64_t));
+    bin_zone_t *zones = emalloc((header.num_blocks + 1) * BIN_NUM_COLUMNS * sizeof(bin_zone_t));
+    for (uint64_t b = 0; b < header.num_blocks; b++) {
+        size_t start = b * BIN_BLOCK_ROWS;
+        uint32_t count = (uint32_t)(n - start < BIN_BLOCK_ROWS ? n - start : BIN_BLOCK_ROWS);
+        index[b] = (uint64_t)ftell(out);
+        write_block(out, rows + start, artist_ids + start, count, zones + b * BIN_NUM_COLUMNS);
+        write_padding(out);
+    }
+
+    header.dict_offset = (uint64_t)ftell(out);
+    write_dict(out, &dict);
+    write_padding(out);
+
+    /*--Fuzzy filters search these instead of the rows--*/
+    if (indexes & BIN_INDEX_FUZZY) {
+        trigram_index_t *artist_names = trigram_new();
+        trigram_index_t *track_names = trigram_new();
+        for (size_t i = 0; i < n; i++) {
+            trigram_add_row(artist_names, node_artist(rows[i]));
+            trigram_add_row(track_names, node_track_name(rows[i]));
+        }
+        header.names_offset = (uint64_t)ftell(out);
+        trigram_write(artist_names, out);
+        trigram_write(track_names, out);
+        trigram_free(track_names);
+        trigram_free(artist_names);
+    }
+
+    /*--Autocomplete ranks rows by streams; a ref is a row number--*/
+    if (indexes & BIN_INDEX_PREFIX) {
+        const char **names = emalloc((n + 1) * sizeof(char *));
+        uint64_t *streams = emalloc((n + 1) * sizeof(uint64_t));
+        for (size_t i = 0; i < n; i++) {
+            names[i] = node_track_name(rows[i]);
+            streams[i] = rows[i]->streams;
+        }
+        header.prefix_offset = (uint64_t)ftell(out);
+        prefix_index_t *prefix = prefix_build(names, streams, (uint32_t)n);
+        prefix_write(prefix, out);
+        prefix_free(prefix);
+        for (size_t i = 0; i < n; i++)
+            names[i] = node_artist(rows[i]);
+        prefix = prefix_build(names, streams, (uint32_t)n);
+        prefix_write(prefix, out);
+        prefix_free(prefix);
+        free(streams);
+        free(names);
+    }
+
+    header.index_offset = (uint64_t)ftell(out);
+    fwrite(index, sizeof(uint64_t), header.num_blocks, out);
+
+    header.zones_offset = (uint64_t)ftell(out);
+    fwrite(zones, sizeof(bin_zone_t), header.num_blocks * BIN_NUM_COLUMNS, out);
+
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+    int status = ferror(out) ? -1 : 0;
+    if (fclose(out) != 0)
+        status = -1;
+
+    dict_free(&dict);
+    free(zones);
+    free(index);
+    free(artist_ids);
+    free(rows);
+    return status;
+}
+
+/**
+ * @brief Applies an madvise policy to a byte range of the mapping, widened to whole pages.
+ */
+static void advise(bin_t *bin, uint64_t offset, uint64_t len, int advice)
+{
+    if (offset >= bin->size || len == 0)
+        return;
+    if (len > bin->size - offset)
+        len = bin->size - offset;
+    uint64_t start = offset - offset % bin->page_size;
+    madvise((void *)(bin->base + start), len + (offset - start), advice);
+}
+
+/**
+ * Function: bin_open
+ * ------------------
+ * @brief  Maps a binary cache file and validates its header.
+ *
+ * Nothing but the header, block index and zone table is read here. The
+ * mapping is marked for random access, so the first touch of a column does
+ * not read the neighbouring blocks along with it; scans and planned reads
+ * ask for more (see bin_load and bin_top).
+ *
+ * @param path The cache file to open.
+ *
+ * @return bin_t* The opened cache, or NULL if the file is missing, truncated,
+ *         from another version, or written with a different byte order.
+ *
+ */
+bin_t *bin_open(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(bin_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    bin_t *bin = emalloc(sizeof(bin_t));
+    memset(bin, 0, sizeof(bin_t));
+    bin->base = base;
+    bin->size = (size_t)st.st_size;
+    bin->header = base;
+
+    const bin_header_t *h = bin->header;
+    if (memcmp(h->magic, BIN_MAGIC, 4) != 0 || h->version != BIN_VERSION
+        || h->endian_mark != BIN_ENDIAN_MARK || h->block_rows != BIN_BLOCK_ROWS
+        || h->index_offset + h->num_blocks * sizeof(uint64_t) > bin->size
+        || h->zones_offset + h->num_blocks * BIN_NUM_COLUMNS * sizeof(bin_zone_t) > bin->size
+        || h->dict_offset + sizeof(uint32_t) > bin->size || h->names_offset > bin->size
+        || h->prefix_offset > bin->size) {
+        bin_close(bin);
+        return NULL;
+    }
+
+    bin->block_index = (const uint64_t *)(bin->base + h->index_offset);
+    bin->zones = (const bin_zone_t *)(bin->base + h->zones_offset);
+    bin->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    madvise((void *)bin->base, bin->size, MADV_RANDOM);
+    advise(bin, h->index_offset, bin->size - h->index_offset, MADV_WILLNEED);
+    memcpy(&bin->num_artists, bin->base + h->dict_offset, sizeof(uint32_t));
+    bin->artist_offsets = (const uint32_t *)(bin->base + h->dict_offset + sizeof(uint32_t));
+    bin->artist_bytes = (const char *)(bin->artist_offsets + bin->num_artists + 1);
+    if ((const unsigned char *)bin->artist_bytes > bin->base + bin->size
+        || (const unsigned char *)bin->artist_bytes + bin->artist_offsets[bin->num_artists] > bin->base + bin->size) {
+        bin_close(bin);
+        return NULL;
+    }
+
+    size_t used = 0;
+    if (h->names_offset != 0) {
+        bin->artist_names = trigram_map(bin->base + h->names_offset, bin->size - h->names_offset, &used);
+        if (bin->artist_names != NULL)
+            bin->track_names = trigram_map(bin->base + h->names_offset + used, bin->size - h->names_offset - used, &used);
+        if (bin->track_names == NULL || bin->artist_names->num_rows != h->num_rows
+            || bin->track_names->num_rows != h->num_rows) {
+            bin_close(bin);
+            return NULL;
+        }
+    }
+
+    if (h->prefix_offset != 0) {
+        bin->track_prefix = prefix_map(bin->base + h->prefix_offset, bin->size - h->prefix_offset, &used);
+        if (bin->track_prefix != NULL)
+            bin->artist_prefix = prefix_map(bin->base + h->prefix_offset + used, bin->size - h->prefix_offset - used, &used);
+        if (bin->artist_prefix == NULL || bin->track_prefix->num_entries != h->num_rows
+            || bin->artist_prefix->num_entries != h->num_rows) {
+            bin_close(bin);
+            return NULL;
+        }
+    }
+    return bin;
+}
+
+/**
+ * Function: bin_close
+ * -------------------
+ * @brief  Unmaps a cache opened with bin_open.
+ *
+ * @param bin The cache to close.
+ *
+ */
+void bin_close(bin_t *bin)
+{
+    if (bin == NULL)
+        return;
+    trigram_free(bin->artist_names);
+    trigram_free(bin->track_names);
+    prefix_free(bin->track_prefix);
+    prefix_free(bin->artist_prefix);
+    munmap((void *)bin->base, bin->size);
+    free(bin);
+}
+
+/**
+ * Function: bin_artist
+ * --------------------
+ * @brief  Looks up an artist string in the dictionary.
+ *
+ * @param bin The cache.
+ * @param artist_id The dictionary id.
+ *
+ * @return const char* The NUL-terminated artist string.
+ *
+ */
+const char *bin_artist(bin_t *bin, uint32_t artist_id)
+{
+    return bin->artist_bytes + bin->artist_offsets[artist_id];
+}
+
+static const bin_block_t *get_block(bin_t *bin, uint64_t b)
+{
+    return (const bin_block_t *)(bin->base + bin->block_index[b]);
+}
+
+static const unsigned char *column_data(const bin_block_t *block, int col)
+{
+    return (const unsigned char *)block + block->columns[col].offset;
+}
+
+static uint64_t column_value(const bin_block_t *block, int col, uint32_t row)
+{
+    const bin_column_t *column = &block->columns[col];
+    return column->min + bitpack_get(column_data(block, col), column->bits, row);
+}
+
+/**
+ * @brief Reads a column for the selected rows of a block into out.
+ *
+ * Dense selections unpack the whole column with the vector kernel; sparse
+ * ones read only the selected values.
+ */
+static void gather_column(const bin_block_t *block, int col, const uint32_t *sel, uint32_t count,
+                          uint64_t *scratch, uint64_t *out)
+{
+    const bin_column_t *column = &block->columns[col];
+    const unsigned char *src = column_data(block, col);
+
+    if (count * 4 >= block->num_rows) {
+        bitpack_unpack(src, column->bits, block->num_rows, column->min, scratch);
+        for (uint32_t k = 0; k < count; k++)
+            out[k] = scratch[sel[k]];
+    } else {
+        for (uint32_t k = 0; k < count; k++)
+            out[k] = column->min + bitpack_get(src, column->bits, sel[k]);
+    }
+}
+
+/**
+ * @brief Decodes the track name of one row from its block's front-coded run.
+ */
+static void decode_name(const bin_block_t *block, uint32_t row, char *out)
+{
+    const unsigned char *base = (const unsigned char *)block;
+    const uint16_t *name_rank = (const uint16_t *)(base + block->name_rank_offset);
+    const uint32_t *restarts = (const uint32_t *)(base + block->names_offset);
+    uint32_t rank = name_rank[row];
+    uint32_t group = rank / BIN_RESTART_INTERVAL;
+    const unsigned char *p = base + block->names_offset + restarts[group];
+    uint32_t len = 0;
+
+    for (uint32_t i = group * BIN_RESTART_INTERVAL; i <= rank; i++) {
+        uint32_t shared = get_varint(&p);
+        uint32_t suffix = get_varint(&p);
+        uint32_t copy;
+
+        if (shared > len)
+            shared = len;
+        copy = shared + suffix < NAME_CAP ? suffix : NAME_CAP - 1 - shared;
+        memcpy(out + shared, p, copy);
+        p += suffix;
+        len = shared + copy;
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief Selects the rows of a block that pass the filter.
+ *
+ * The YEAR filter first checks the date zone map, then compares packed
+ * deltas directly against the year's date range.
+ */
+static uint32_t select_rows(const bin_block_t *block, const bool *artist_match, bool by_year,
+                            uint32_t year, uint32_t *sel, uint64_t *scratch)
+{
+    uint32_t n = block->num_rows;
+    uint32_t count = 0;
+
+    if (by_year) {
+        const bin_column_t *date = &block->columns[BIN_COL_DATE];
+        uint64_t lo = (uint64_t)year << 9;
+        uint64_t hi = (uint64_t)(year + 1) << 9;
+        if (hi <= date->min || lo > date->max)
+            return 0;
+        lo = lo > date->min ? lo - date->min : 0;
+        return bitpack_select_range(column_data(block, BIN_COL_DATE), date->bits, n, lo, hi - date->min, sel);
+    }
+
+    if (artist_match != NULL) {
+        const bin_column_t *ids = &block->columns[BIN_COL_ARTIST_ID];
+        bitpack_unpack(column_data(block, BIN_COL_ARTIST_ID), ids->bits, n, ids->min, scratch);
+        for (uint32_t r = 0; r < n; r++)
+            if (artist_match[scratch[r]])
+                sel[count++] = r;
+        return count;
+    }
+
+    for (uint32_t r = 0; r < n; r++)
+        sel[r] = r;
+    return n;
+}
+
+/**
+ * @brief A filter prepared for scanning blocks.
+ */
+typedef struct bin_filter_t
+{
+    bool *artist_match;
+    const char *exact;
+    bool by_year;
+    uint32_t year;
+} bin_filter_t;
+
+/**
+ * @brief Prepares a filter, resolving artist filters against the dictionary.
+ *
+ * Returns false, with nothing to free, when no row can match: an unknown
+ * filter, or an artist filter no dictionary entry passes.
+ */
+static bool prepare_filter(bin_t *bin, char *filter, char *filter_value, bin_filter_t *f)
+{
+    memset(f, 0, sizeof(*f));
+    if (filter == NULL)
+        return true;
+
+    if (strcmp(filter, "YEAR") == 0) {
+        f->by_year = true;
+        f->year = (uint32_t)atoi(filter_value);
+        return true;
+    }
+
+    bool is_exact = strcmp(filter, "ARTIST_IS") == 0;
+    if (!is_exact && strcmp(filter, "ARTIST") != 0)
+        return false;
+    bool any = false;
+    f->exact = is_exact ? filter_value : NULL;
+    f->artist_match = emalloc((bin->num_artists + 1) * sizeof(bool));
+    for (uint32_t i = 0; i < bin->num_artists; i++) {
+        const char *artist = bin_artist(bin, i);
+        f->artist_match[i] = is_exact ? artist_has_token(artist, filter_value) : strstr(artist, filter_value) != NULL;
+        any = any || f->artist_match[i];
+    }
+    if (!any) {
+        free(f->artist_match);
+        f->artist_match = NULL;
+    }
+    return any;
+}
+
+/**
+ * @brief Returns true if a block's Bloom filter rules out the exact artist.
+ */
+static bool bloom_rejects(const bin_filter_t *f, const bin_block_t *block)
+{
+    return f->exact != NULL && !bloom_probe(NULL, (const unsigned char *)block + block->bloom_offset,
+                                            block->bloom_bits, f->exact, strlen(f->exact));
+}
+
+/**
+ * @brief Scratch space for decoding blocks.
+ */
+typedef struct bin_scan_t
+{
+    uint32_t *sel;
+    uint64_t *scratch;
+    uint64_t *values[BIN_NUM_COLUMNS];
+} bin_scan_t;
+
+static void scan_init(bin_scan_t *scan)
+{
+    scan->sel = emalloc(BIN_BLOCK_ROWS * sizeof(uint32_t));
+    scan->scratch = emalloc((BIN_NUM_COLUMNS + 1) * BIN_BLOCK_ROWS * sizeof(uint64_t));
+    for (int col = 0; col < BIN_NUM_COLUMNS; col++)
+        scan->values[col] = scan->scratch + (size_t)(col + 1) * BIN_BLOCK_ROWS;
+}
+
+static void scan_free(bin_scan_t *scan)
+{
+    free(scan->scratch);
+    free(scan->sel);
+}
+
+/**
+ * @brief Appends a node for each of the first count rows in scan->sel of a block.
+ *
+ * Only the columns in fields are decoded, so the others are never faulted
+ * in; their node fields stay zero.
+ */
+static void emit_rows(bin_t *bin, uint64_t b, uint32_t count, unsigned int fields,
+                      bin_scan_t *scan, node_t **list, node_t **tail)
+{
+    const bin_block_t *block = get_block(bin, b);
+    for (int col = BIN_COL_ARTIST_ID; col < BIN_NUM_COLUMNS; col++) {
+        if (fields & column_fields[col])
+            gather_column(block, col, scan->sel, count, scan->scratch, scan->values[col]);
+        else
+            memset(scan->values[col], 0, count * sizeof(uint64_t));
+    }
+
+    for (uint32_t k = 0; k < count; k++) {
+        node_t *node = new_node();
+        node->artist_count = (unsigned int)scan->values[BIN_COL_ARTIST_COUNT][k];
+        node->date = (unsigned int)scan->values[BIN_COL_DATE][k];
+        node->in_spotify_playlists = (unsigned int)scan->values[BIN_COL_SPOTIFY][k];
+        node->streams = scan->values[BIN_COL_STREAMS][k];
+        node->in_apple_playlists = (unsigned int)scan->values[BIN_COL_APPLE][k];
+        node->row_id = (unsigned int)(b * BIN_BLOCK_ROWS + scan->sel[k]);
+        node->artist_id = (unsigned int)scan->values[BIN_COL_ARTIST_ID][k];
+
+        if (*tail == NULL)
+            *list = node;
+        else
+            (*tail)->next = node;
+        *tail = node;
+    }
+}
+
+/**
+ * @brief Appends a node for every row of a block that passes the filter.
+ */
+static uint32_t load_block(bin_t *bin, uint64_t b, const bin_filter_t *f, unsigned int fields,
+                           bin_scan_t *scan, node_t **list, node_t **tail)
+{
+    const bin_block_t *block = get_block(bin, b);
+    if (bloom_rejects(f, block))
+        return 0;
+
+    uint32_t count = select_rows(block, f->artist_match, f->by_year, f->year, scan->sel, scan->scratch);
+    if (count > 0)
+        emit_rows(bin, b, count, fields, scan, list, tail);
+    return count;
+}
+
+/**
+ * Function: bin_load
+ * ------------------
+ * @brief  Builds a list of the records matching a filter.
+ *
+ * Only the numeric fields in fields are decoded; track_name and artist are
+ * left empty until bin_fill_strings is called for the rows that get output.
+ * The ARTIST and ARTIST_IS filters are evaluated once per dictionary entry
+ * rather than once per row, and ARTIST_IS skips every block whose Bloom
+ * filter rules the artist out. An artist that appears nowhere returns
+ * without touching a block. The blocks are read ahead while they are
+ * scanned.
+ *
+ * @param bin The cache.
+ * @param filter "ARTIST", "ARTIST_IS", "YEAR", or NULL for every record.
+ * @param filter_value The value to filter by.
+ * @param fields The FIELD_* bits of the fields to decode.
+ *
+ * @return node_t* The matching records, in file order.
+ *
+ */
+node_t *bin_load(bin_t *bin, char *filter, char *filter_value, unsigned int fields)
+{
+    node_t *list = NULL;
+    node_t *tail = NULL;
+    bin_filter_t f;
+    bin_scan_t scan;
+
+    if (!prepare_filter(bin, filter, filter_value, &f) || bin->header->num_blocks == 0)
+        return NULL;
+
+    /*--A scan reads the blocks front to back: read ahead, then go back to random access--*/
+    uint64_t blocks = bin->block_index[0];
+    advise(bin, blocks, bin->header->dict_offset - blocks, MADV_SEQUENTIAL);
+    scan_init(&scan);
+    for (uint64_t b = 0; b < bin->header->num_blocks; b++)
+        load_block(bin, b, &f, fields, &scan, &list, &tail);
+    advise(bin, blocks, bin->header->dict_offset - blocks, MADV_RANDOM);
+
+    scan_free(&scan);
+    free(f.artist_match);
+    return list;
+}
+
+/**
+ * Function: bin_fuzzy
+ * -------------------
+ * @brief  Builds a list of the records whose artist or track name fuzzily contains a value.
+ *
+ * The value is searched in the name index written with the cache, which
+ * also gives the name of every row, so only the blocks holding a match are
+ * touched and no string is decoded.
+ *
+ * @param bin The cache.
+ * @param by_track Match track names instead of artists.
+ * @param value The text to look for (case-insensitive).
+ * @param max_edits The largest edit distance accepted.
+ * @param fields The FIELD_* bits of the fields to decode.
+ *
+ * @return node_t* The matching records, in file order.
+ *
+ */
+node_t *bin_fuzzy(bin_t *bin, bool by_track, const char *value, int max_edits, unsigned int fields)
+{
+    trigram_index_t *names = by_track ? bin->track_names : bin->artist_names;
+    bool *matched = trigram_match(names, value, max_edits);
+    uint32_t *ids = emalloc(BIN_BLOCK_ROWS * sizeof(uint32_t));
+    node_t *list = NULL;
+    node_t *tail = NULL;
+    bin_scan_t scan;
+
+    scan_init(&scan);
+    for (uint64_t b = 0; b < bin->header->num_blocks; b++) {
+        uint64_t first = b * BIN_BLOCK_ROWS;
+        uint32_t n = (uint32_t)(bin->header->num_rows - first < BIN_BLOCK_ROWS ? bin->header->num_rows - first
+                                                                                  : BIN_BLOCK_ROWS);
+        uint32_t count = 0;
+        trigram_rows(names, first, n, ids);
+        for (uint32_t r = 0; r < n; r++)
+            if (matched[ids[r]])
+                scan.sel[count++] = r;
+        if (count > 0)
+            emit_rows(bin, b, count, fields, &scan, &list, &tail);
+    }
+    scan_free(&scan);
+    free(ids);
+    free(matched);
+    return list;
+}
+
+/**
+ * Function: bin_prefix
+ * --------------------
+ * @brief  Builds a list of the k records with the most streams whose track
+ *         name (or artist) starts with a prefix.
+ *
+ * The prefix index written with the cache gives the rows, so only their
+ * blocks are touched.
+ *
+ * @param bin The cache.
+ * @param on_artist Search artists instead of track names.
+ * @param prefix The typed text (case-insensitive).
+ * @param k The number of records wanted.
+ * @param fields The FIELD_* bits of the fields to decode.
+ *
+ * @return node_t* The records, most streams first; equal streams in file order.
+ *
+ */
+node_t *bin_prefix(bin_t *bin, bool on_artist, const char *prefix, uint32_t k, unsigned int fields)
+{
+    if (k > bin->header->num_rows)
+        k = (uint32_t)bin->header->num_rows;
+    uint32_t *refs = emalloc((k + 1) * sizeof(uint32_t));
+    uint32_t num_refs = prefix_top_k(on_artist ? bin->artist_prefix : bin->track_prefix, prefix, k, refs);
+    node_t *list = NULL;
+    node_t *tail = NULL;
+    bin_scan_t scan;
+
+    scan_init(&scan);
+    for (uint32_t i = 0; i < num_refs; i++) {
+        scan.sel[0] = refs[i] % BIN_BLOCK_ROWS;
+        emit_rows(bin, refs[i] / BIN_BLOCK_ROWS, 1, fields, &scan, &list, &tail);
+    }
+    scan_free(&scan);
+    free(refs);
+    return list;
+}
+
+/**
+ * @brief A block and the best value its zone allows, for ranking blocks.
+ */
+typedef struct bin_rank_t
+{
+    uint64_t bound;
+    uint64_t block;
+} bin_rank_t;
+
+static int compare_rank(const void *a, const void *b)
+{
+    const bin_rank_t *x = a;
+    const bin_rank_t *y = b;
+    if (x->bound != y->bound)
+        return x->bound > y->bound ? -1 : 1;
+    return x->block < y->block ? -1 : x->block > y->block;
+}
+
+static int compare_row_id(const void *a, const void *b)
+{
+    unsigned int x = (*(node_t *const *)a)->row_id;
+    unsigned int y = (*(node_t *const *)b)->row_id;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Asks the kernel to read the columns in fields of a block ahead of use.
+ *
+ * Finding the columns reads the block header, which should have been
+ * requested a step earlier.
+ */
+static void prefetch_columns(bin_t *bin, uint64_t b, unsigned int fields)
+{
+    const bin_block_t *block = get_block(bin, b);
+    for (int col = 0; col < BIN_NUM_COLUMNS; col++) {
+        const bin_column_t *column = &block->columns[col];
+        if (fields & column_fields[col])
+            advise(bin, bin->block_index[b] + column->offset, bitpack_size(block->num_rows, column->bits),
+                   MADV_WILLNEED);
+    }
+}
+
+/**
+ * @brief Adds a value to a min-heap holding the k largest values seen.
+ */
+static void heap_offer(uint64_t *heap, size_t *size, size_t k, uint64_t value)
+{
+    size_t i;
+    if (*size < k) {
+        for (i = (*size)++; i > 0 && heap[(i - 1) / 2] > value; i = (i - 1) / 2)
+            heap[i] = heap[(i - 1) / 2];
+        heap[i] = value;
+        return;
+    }
+    if (value <= heap[0])
+        return;
+    for (i = 0; 2 * i + 1 < k;) {
+        size_t c = 2 * i + 1;
+        if (c + 1 < k && heap[c + 1] < heap[c])
+            c++;
+        if (heap[c] >= value)
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = value;
+}
+
+/**
+ * Function: bin_top
+ * -----------------
+ * @brief  Loads the records that can be among the k best by one column.
+ *
+ * Blocks are visited best zone first, and the visit stops once k matching
+ * records are loaded and no block left can hold a record as good as the
+ * k-th best. The result contains every record of the k best, ties
+ * included, in file order, so selecting the top k from it gives the same
+ * answer as selecting it from bin_load. While a block is decoded, the
+ * columns of the next one are read ahead and the header of the one after.
+ *
+ * @param bin The cache.
+ * @param filter "ARTIST", "ARTIST_IS", "YEAR", or NULL for every record.
+ * @param filter_value The value to filter by.
+ * @param fields The FIELD_* bits of the fields to decode.
+ * @param col The bin_column_id to rank by.
+ * @param descending True for the largest values, false for the smallest.
+ * @param k The number of records wanted, at least 1.
+ *
+ * @return node_t* The candidate records, in file order.
+ *
+ */
+node_t *bin_top(bin_t *bin, char *filter, char *filter_value, unsigned int fields, int col, bool descending, size_t k)
+{
+    node_t *list = NULL;
+    node_t *tail = NULL;
+    bin_filter_t f;
+    bin_scan_t scan;
+    uint64_t n = bin->header->num_blocks;
+
+    if (!prepare_filter(bin, filter, filter_value, &f) || n == 0)
+        return NULL;
+    fields |= column_fields[col];
+
+    /*--Rank the blocks from the zone table alone; values are flipped so larger is always better--*/
+    bin_rank_t *ranks = emalloc(n * sizeof(bin_rank_t));
+    for (uint64_t b = 0; b < n; b++) {
+        const bin_zone_t *zone = &bin->zones[b * BIN_NUM_COLUMNS + col];
+        ranks[b].bound = descending ? zone->max : UINT64_MAX - zone->min;
+        ranks[b].block = b;
+    }
+    qsort(ranks, n, sizeof(bin_rank_t), compare_rank);
+
+    if (k > bin->header->num_rows)
+        k = bin->header->num_rows;
+    uint64_t *heap = emalloc(k * sizeof(uint64_t));
+    size_t size = 0;
+    size_t loaded = 0;
+    scan_init(&scan);
+    for (uint64_t i = 0; i < n && !(size == k && ranks[i].bound < heap[0]); i++) {
+        if (i + 2 < n)
+            advise(bin, bin->block_index[ranks[i + 2].block], sizeof(bin_block_t), MADV_WILLNEED);
+        if (i + 1 < n)
+            prefetch_columns(bin, ranks[i + 1].block, fields);
+
+        node_t *last = tail;
+        loaded += load_block(bin, ranks[i].block, &f, fields, &scan, &list, &tail);
+        for (node_t *node = last != NULL ? last->next : list; node != NULL; node = node->next) {
+            uint64_t value = col == BIN_COL_STREAMS ? node->streams
+                             : col == BIN_COL_SPOTIFY ? node->in_spotify_playlists
+                             : col == BIN_COL_APPLE ? node->in_apple_playlists : node->date;
+            heap_offer(heap, &size, k, descending ? value : UINT64_MAX - value);
+        }
+    }
+    scan_free(&scan);
+    free(heap);
+    free(ranks);
+    free(f.artist_match);
+
+    /*--Blocks were visited out of order; put the records back in file order--*/
+    node_t **rows = emalloc((loaded + 1) * sizeof(node_t *));
+    size_t count = 0;
+    for (node_t *node = list; node != NULL; node = node->next)
+        rows[count++] = node;
+    qsort(rows, count, sizeof(node_t *), compare_row_id);
+    list = NULL;
+    for (size_t i = count; i > 0; i--) {
+        rows[i - 1]->next = list;
+        list = rows[i - 1];
+    }
+    free(rows);
+    return list;
+}
+
+/**
+ * Function: bin_count
+ * -------------------
+ * @brief  Counts the records matching a filter without building any nodes.
+ *
+ * No filter is answered from the header. A YEAR filter decides from the
+ * zone table alone whether a block lies inside the year (counted whole) or
+ * outside it (skipped), and only scans the packed dates of blocks
+ * straddling it. Artist filters are resolved against the dictionary first,
+ * as in bin_load.
+ *
+ * @param bin The cache.
+ * @param filter "ARTIST", "ARTIST_IS", "YEAR", or NULL for every record.
+ * @param filter_value The value to filter by.
+ * @param stop_at Stop once this many matches are found, or 0 to count them all.
+ *
+ * @return uint64_t The number of matches, at most stop_at when it is given.
+ *
+ */
+uint64_t bin_count(bin_t *bin, char *filter, char *filter_value, uint64_t stop_at)
+{
+    uint64_t count = 0;
+    bin_filter_t f;
+
+    if (!prepare_filter(bin, filter, filter_value, &f))
+        return 0;
+    if (filter == NULL || bin->header->num_blocks == 0) {
+        count = filter == NULL ? bin->header->num_rows : 0;
+        free(f.artist_match);
+        return stop_at != 0 && count > stop_at ? stop_at : count;
+    }
+
+    uint32_t *sel = emalloc(BIN_BLOCK_ROWS * sizeof(uint32_t));
+    uint64_t *scratch = emalloc(BIN_BLOCK_ROWS * sizeof(uint64_t));
+    uint64_t lo = (uint64_t)f.year << 9;
+    uint64_t hi = (uint64_t)(f.year + 1) << 9;
+
+    /*--A count reads the blocks front to back like a scan: read ahead, then go back to random access--*/
+    uint64_t blocks = bin->block_index[0];
+    advise(bin, blocks, bin->header->dict_offset - blocks, MADV_SEQUENTIAL);
+    for (uint64_t b = 0; b < bin->header->num_blocks && (stop_at == 0 || count < stop_at); b++) {
+        if (f.by_year) {
+            const bin_zone_t *date = &bin->zones[b * BIN_NUM_COLUMNS + BIN_COL_DATE];
+            if (date->max < lo || date->min >= hi)
+                continue;
+            if (date->min >= lo && date->max < hi) {
+                uint64_t first = b * BIN_BLOCK_ROWS;
+                count += bin->header->num_rows - first < BIN_BLOCK_ROWS ? bin->header->num_rows - first : BIN_BLOCK_ROWS;
+                continue;
+            }
+        }
+        const bin_block_t *block = get_block(bin, b);
+        if (bloom_rejects(&f, block))
+            continue;
+        count += select_rows(block, f.artist_match, f.by_year, f.year, sel, scratch);
+    }
+    advise(bin, blocks, bin->header->dict_offset - blocks, MADV_RANDOM);
+
+    free(scratch);
+    free(sel);
+    free(f.artist_match);
+    return stop_at != 0 && count > stop_at ? stop_at : count;
+}
+
+/**
+ * Function: bin_fill_strings
+ * --------------------------
+ * @brief  Decodes the track name and artist of a node loaded by bin_load.
+ *
+ * The track name is decoded into the arena; the artist points straight
+ * into the mapped dictionary, so the cache must stay open while it is used.
+ *
+ * @param bin The cache the node was loaded from.
+ * @param node The node to fill, identified by its row_id.
+ * @param arena The arena to decode into.
+ *
+ */
+void bin_fill_strings(bin_t *bin, node_t *node, arena_t *arena)
+{
+    uint64_t b = node->row_id / BIN_BLOCK_ROWS;
+    uint32_t r = node->row_id % BIN_BLOCK_ROWS;
+    const bin_block_t *block = get_block(bin, b);
+    uint32_t artist_id = (uint32_t)column_value(block, BIN_COL_ARTIST_ID, r);
+    char name[NAME_CAP];
+
+    decode_name(block, r, name);
+    node_set_strings(node, arena, arena_strdup(arena, name), bin_artist(bin, artist_id));
+}
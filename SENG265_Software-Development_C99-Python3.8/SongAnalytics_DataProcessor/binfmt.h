@@ -0,0 +1,147 @@
+/** @file binfmt.h
+ *  @brief Function prototypes for the columnar binary cache.
+ *
+ * The cache stores song records in blocks of BIN_BLOCK_ROWS rows. Artist
+ * strings are dictionary encoded across the whole file, and track names are
+ * sorted and front coded inside each block, so strings are only decoded for
+ * the rows that actually get written out. Numeric columns are bit packed
+ * against a per-block frame of reference (the block minimum), and every
+ * block carries a Bloom filter of the single artists it contains.
+ *
+ * When asked for with BIN_INDEX_FUZZY, the artists and track names also get
+ * a trigram index each (see trigram.h), built when the cache is written, so
+ * fuzzy filters find their rows without decoding a single string. With
+ * BIN_INDEX_PREFIX, a prefix index of each (see prefix.h) answers
+ * autocomplete queries the same way. The indexes are optional because
+ * together they are larger than the blocks.
+ *
+ * Opening a cache only maps it: the header, block index and zone table are
+ * read on open, and a block's columns are faulted in when a query first
+ * touches them. Only the columns a query needs are decoded.
+ */
+#ifndef _BINFMT_H_
+#define _BINFMT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "list.h"
+#include "prefix.h"
+#include "trigram.h"
+
+#define BIN_MAGIC "SABF"
+#define BIN_VERSION 7
+#define BIN_ENDIAN_MARK 0x01020304u
+#define BIN_BLOCK_ROWS 4096
+#define BIN_RESTART_INTERVAL 16
+#define BIN_BLOOM_HASHES 7
+#define BIN_BLOOM_BITS_PER_KEY 10
+
+/* Optional indexes written by bin_write; the offset of one left out is 0 */
+#define BIN_INDEX_FUZZY 1u
+#define BIN_INDEX_PREFIX 2u
+
+/**
+ * @brief File header, stored at offset 0 of the cache.
+ */
+typedef struct bin_header_t
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t endian_mark;
+    uint32_t block_rows;
+    uint64_t num_rows;
+    uint64_t num_blocks;
+    uint64_t dict_offset;
+    uint64_t names_offset;
+    uint64_t prefix_offset;
+    uint64_t index_offset;
+    uint64_t zones_offset;
+} bin_header_t;
+
+/**
+ * @brief Packed numeric columns of a block, indexes into bin_block_t.columns.
+ */
+enum bin_column_id
+{
+    BIN_COL_ARTIST_ID,
+    BIN_COL_DATE,
+    BIN_COL_ARTIST_COUNT,
+    BIN_COL_SPOTIFY,
+    BIN_COL_STREAMS,
+    BIN_COL_APPLE,
+    BIN_NUM_COLUMNS
+};
+
+/**
+ * @brief A frame-of-reference packed column. min doubles as the base.
+ */
+typedef struct bin_column_t
+{
+    uint64_t min;
+    uint64_t max;
+    uint32_t offset;
+    uint32_t bits;
+} bin_column_t;
+
+/**
+ * @brief The range of a column in a block.
+ *
+ * The zone table repeats these for every block and column, next to the
+ * block index, so blocks can be ranked and skipped without touching them.
+ */
+typedef struct bin_zone_t
+{
+    uint64_t min;
+    uint64_t max;
+} bin_zone_t;
+
+/**
+ * @brief Per-block header. Offsets are relative to the block start.
+ */
+typedef struct bin_block_t
+{
+    uint32_t num_rows;
+    uint32_t name_rank_offset;
+    uint32_t names_offset;
+    uint32_t size;
+    uint32_t bloom_offset;
+    uint32_t bloom_bits;
+    bin_column_t columns[BIN_NUM_COLUMNS];
+} bin_block_t;
+
+/**
+ * @brief An opened (memory-mapped) cache file.
+ */
+typedef struct bin_t
+{
+    const unsigned char *base;
+    size_t size;
+    const bin_header_t *header;
+    const uint64_t *block_index;
+    const bin_zone_t *zones;
+    size_t page_size;
+    uint32_t num_artists;
+    const uint32_t *artist_offsets;
+    const char *artist_bytes;
+    trigram_index_t *artist_names;
+    trigram_index_t *track_names;
+    prefix_index_t *track_prefix;
+    prefix_index_t *artist_prefix;
+} bin_t;
+
+/**
+ * Function protypes associated with the binary cache.
+ */
+int bin_write(const char *path, node_t *list, unsigned int indexes);
+bin_t *bin_open(const char *path);
+void bin_close(bin_t *bin);
+node_t *bin_load(bin_t *bin, char *filter, char *filter_value, unsigned int fields);
+node_t *bin_top(bin_t *bin, char *filter, char *filter_value, unsigned int fields, int col, bool descending, size_t k);
+node_t *bin_fuzzy(bin_t *bin, bool by_track, const char *value, int max_edits, unsigned int fields);
+node_t *bin_prefix(bin_t *bin, bool on_artist, const char *prefix, uint32_t k, unsigned int fields);
+uint64_t bin_count(bin_t *bin, char *filter, char *filter_value, uint64_t stop_at);
+void bin_fill_strings(bin_t *bin, node_t *node, arena_t *arena);
+const char *bin_artist(bin_t *bin, uint32_t artist_id);
+
+#endif
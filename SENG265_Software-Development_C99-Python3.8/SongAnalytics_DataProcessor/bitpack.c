@@ -0,0 +1,285 @@
+/** @file bitpack.c
+ *  @brief Implementation of frame-of-reference bit packing.
+ *
+ * Values are written LSB first into a little-endian bit stream, so value i
+ * starts at bit i * bits. The scalar kernels read one unaligned 64-bit word
+ * per value; on x86-64 the unpack and range-select kernels switch to AVX2
+ * gathers at run time when the CPU supports them and the width fits a
+ * 32-bit (or 64-bit) lane.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "bitpack.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BITPACK_HAVE_AVX2 1
+#endif
+
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void store64(unsigned char *p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint64_t width_mask(uint32_t bits)
+{
+    return bits >= 64 ? ~0ull : (1ull << bits) - 1;
+}
+
+/**
+ * Function: bitpack_width
+ * -----------------------
+ * @brief  Returns the number of bits needed to store values in [0, range].
+ *
+ * @param range The largest delta to be stored.
+ *
+ * @return uint32_t The bit width, 0 when every value equals the base.
+ *
+ */
+uint32_t bitpack_width(uint64_t range)
+{
+    return range == 0 ? 0 : 64 - (uint32_t)__builtin_clzll(range);
+}
+
+/**
+ * Function: bitpack_size
+ * ----------------------
+ * @brief  Returns the size of a packed buffer, including padding.
+ *
+ * @param n The number of values.
+ * @param bits The bit width.
+ *
+ * @return size_t Bytes needed by bitpack_pack.
+ *
+ */
+size_t bitpack_size(uint32_t n, uint32_t bits)
+{
+    return ((size_t)n * bits + 7) / 8 + BITPACK_PADDING;
+}
+
+/**
+ * Function: bitpack_pack
+ * ----------------------
+ * @brief  Packs (values[i] - base) into dst using bits per value.
+ *
+ * @param values The values to pack, each at least base.
+ * @param n The number of values.
+ * @param base The frame of reference.
+ * @param bits The bit width, as returned by bitpack_width.
+ * @param dst The output buffer, bitpack_size(n, bits) bytes.
+ *
+ */
+void bitpack_pack(const uint64_t *values, uint32_t n, uint64_t base, uint32_t bits, unsigned char *dst)
+{
+    memset(dst, 0, bitpack_size(n, bits));
+    if (bits == 0)
+        return;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t delta = values[i] - base;
+        size_t pos = (size_t)i * bits;
+        unsigned char *p = dst + pos / 8;
+        uint32_t shift = pos % 8;
+
+        store64(p, load64(p) | delta << shift);
+        if (shift + bits > 64)
+            p[8] |= (unsigned char)(delta >> (64 - shift));
+    }
+}
+
+/**
+ * Function: bitpack_get
+ * ---------------------
+ * @brief  Reads a single packed delta.
+ *
+ * @param src The packed buffer.
+ * @param bits The bit width.
+ * @param i The value index.
+ *
+ * @return uint64_t The delta (without the base added).
+ *
+ */
+uint64_t bitpack_get(const unsigned char *src, uint32_t bits, uint32_t i)
+{
+    if (bits == 0)
+        return 0;
+
+    size_t pos = (size_t)i * bits;
+    const unsigned char *p = src + pos / 8;
+    uint32_t shift = pos % 8;
+    uint64_t v = load64(p) >> shift;
+
+    if (shift + bits > 64)
+        v |= (uint64_t)p[8] << (64 - shift);
+    return v & width_mask(bits);
+}
+
+#ifdef BITPACK_HAVE_AVX2
+static bool cpu_has_avx2(void)
+{
+    /* Safe to call from several threads: racing initialisers store the same value */
+    static int has_avx2 = -1;
+    int cached = __atomic_load_n(&has_avx2, __ATOMIC_RELAXED);
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&has_avx2, cached, __ATOMIC_RELAXED);
+    }
+    return cached == 1;
+}
+
+/**
+ * @brief Gathers and shifts 8 values of at most 25 bits into 32-bit lanes.
+ */
+__attribute__((target("avx2")))
+static inline __m256i unpack8_narrow(const unsigned char *src, uint32_t bits, uint32_t i, __m256i mask)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i pos = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32((int)i), lane),
+                                     _mm256_set1_epi32((int)bits));
+    __m256i bytes = _mm256_srli_epi32(pos, 3);
+    __m256i shift = _mm256_and_si256(pos, _mm256_set1_epi32(7));
+    __m256i words = _mm256_i32gather_epi32((const int *)src, bytes, 1);
+    return _mm256_and_si256(_mm256_srlv_epi32(words, shift), mask);
+}
+
+/**
+ * @brief Gathers and shifts 4 values of at most 56 bits into 64-bit lanes.
+ */
+__attribute__((target("avx2")))
+static inline __m256i unpack4_wide(const unsigned char *src, uint32_t bits, uint32_t i, __m256i mask)
+{
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    __m256i pos = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm_add_epi32(_mm_set1_epi32((int)i), lane)),
+                                   _mm256_set1_epi64x(bits));
+    __m256i bytes = _mm256_srli_epi64(pos, 3);
+    __m256i shift = _mm256_and_si256(pos, _mm256_set1_epi64x(7));
+    __m256i words = _mm256_i64gather_epi64((const long long *)src, bytes, 1);
+    return _mm256_and_si256(_mm256_srlv_epi64(words, shift), mask);
+}
+
+__attribute__((target("avx2")))
+static uint32_t unpack_avx2(const unsigned char *src, uint32_t bits, uint32_t n, uint64_t base, uint64_t *out)
+{
+    uint32_t i = 0;
+    __m256i vbase = _mm256_set1_epi64x((long long)base);
+
+    if (bits <= 25) {
+        __m256i mask = _mm256_set1_epi32((int)width_mask(bits));
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = unpack8_narrow(src, bits, i, mask);
+            __m256i lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v));
+            __m256i hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1));
+            _mm256_storeu_si256((__m256i *)(out + i), _mm256_add_epi64(lo, vbase));
+            _mm256_storeu_si256((__m256i *)(out + i + 4), _mm256_add_epi64(hi, vbase));
+        }
+    } else if (bits <= 56) {
+        __m256i mask = _mm256_set1_epi64x((long long)width_mask(bits));
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = unpack4_wide(src, bits, i, mask);
+            _mm256_storeu_si256((__m256i *)(out + i), _mm256_add_epi64(v, vbase));
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t select_avx2(const unsigned char *src, uint32_t bits, uint32_t n,
+                            uint64_t lo, uint64_t hi, uint32_t *sel, uint32_t *count)
+{
+    uint32_t i = 0;
+    uint32_t k = 0;
+
+    if (bits > 25 || hi > INT32_MAX)
+        return 0;
+
+    __m256i mask = _mm256_set1_epi32((int)width_mask(bits));
+    __m256i vlo = _mm256_set1_epi32((int)lo - 1);
+    __m256i vhi = _mm256_set1_epi32((int)hi);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = unpack8_narrow(src, bits, i, mask);
+        __m256i in_range = _mm256_and_si256(_mm256_cmpgt_epi32(v, vlo), _mm256_cmpgt_epi32(vhi, v));
+        unsigned int bitmask = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(in_range));
+        while (bitmask != 0) {
+            sel[k++] = i + (uint32_t)__builtin_ctz(bitmask);
+            bitmask &= bitmask - 1;
+        }
+    }
+    *count = k;
+    return i;
+}
+#endif
+
+/**
+ * Function: bitpack_unpack
+ * ------------------------
+ * @brief  Unpacks n values and adds the frame of reference back.
+ *
+ * @param src The packed buffer.
+ * @param bits The bit width.
+ * @param n The number of values.
+ * @param base The frame of reference.
+ * @param out The output array of n values.
+ *
+ */
+void bitpack_unpack(const unsigned char *src, uint32_t bits, uint32_t n, uint64_t base, uint64_t *out)
+{
+    uint32_t i = 0;
+
+    if (bits == 0) {
+        for (; i < n; i++)
+            out[i] = base;
+        return;
+    }
+#ifdef BITPACK_HAVE_AVX2
+    if (cpu_has_avx2())
+        i = unpack_avx2(src, bits, n, base, out);
+#endif
+    for (; i < n; i++)
+        out[i] = base + bitpack_get(src, bits, i);
+}
+
+/**
+ * Function: bitpack_select_range
+ * ------------------------------
+ * @brief  Selects the rows whose packed delta lies in [lo, hi).
+ *
+ * The bounds are deltas, i.e. already reduced by the column base, so the
+ * comparison runs on packed values without adding the base back.
+ *
+ * @param src The packed buffer.
+ * @param bits The bit width.
+ * @param n The number of values.
+ * @param lo The inclusive lower bound.
+ * @param hi The exclusive upper bound.
+ * @param sel Output array receiving the indices of matching rows.
+ *
+ * @return uint32_t The number of indices written to sel.
+ *
+ */
+uint32_t bitpack_select_range(const unsigned char *src, uint32_t bits, uint32_t n,
+                              uint64_t lo, uint64_t hi, uint32_t *sel)
+{
+    uint32_t i = 0;
+    uint32_t k = 0;
+
+    if (lo >= hi)
+        return 0;
+#ifdef BITPACK_HAVE_AVX2
+    if (bits > 0 && cpu_has_avx2())
+        i = select_avx2(src, bits, n, lo, hi, sel, &k);
+#endif
+    for (; i < n; i++) {
+        uint64_t v = bitpack_get(src, bits, i);
+        if (v >= lo && v < hi)
+            sel[k++] = i;
+    }
+    return k;
+}
@@ -0,0 +1,28 @@
+/** @file bitpack.h
+ *  @brief Function prototypes for frame-of-reference bit packing.
+ *
+ * A packed column stores (value - base) for every row using a fixed number
+ * of bits, least significant bit first. Packed buffers carry
+ * BITPACK_PADDING trailing bytes so kernels may load whole words past the
+ * last value.
+ */
+#ifndef _BITPACK_H_
+#define _BITPACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITPACK_PADDING 16
+
+/**
+ * Function protypes associated with bit packing.
+ */
+uint32_t bitpack_width(uint64_t range);
+size_t bitpack_size(uint32_t n, uint32_t bits);
+void bitpack_pack(const uint64_t *values, uint32_t n, uint64_t base, uint32_t bits, unsigned char *dst);
+uint64_t bitpack_get(const unsigned char *src, uint32_t bits, uint32_t i);
+void bitpack_unpack(const unsigned char *src, uint32_t bits, uint32_t n, uint64_t base, uint64_t *out);
+uint32_t bitpack_select_range(const unsigned char *src, uint32_t bits, uint32_t n,
+                              uint64_t lo, uint64_t hi, uint32_t *sel);
+
+#endif
@@ -0,0 +1,94 @@
+/** @file cancel.c
+ *  @brief Implementation of query cancellation tokens.
+ */
+#include "cancel.h"
+
+/*--Called on every check of a token; see cancel_set_hook--*/
+static void (*check_hook)(void) = NULL;
+
+/**
+ * Function: cancel_init
+ * ---------------------
+ * @brief  Initialises a token that is not cancelled.
+ *
+ * @param cancel The token.
+ * @param timeout_ms Cancel the token this many milliseconds from now, or 0 for no deadline.
+ *
+ */
+void cancel_init(cancel_t *cancel, long timeout_ms)
+{
+    cancel->cancelled = 0;
+    cancel->has_deadline = timeout_ms > 0;
+    if (cancel->has_deadline) {
+        clock_gettime(CLOCK_MONOTONIC, &cancel->deadline);
+        cancel->deadline.tv_sec += timeout_ms / 1000;
+        cancel->deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+        if (cancel->deadline.tv_nsec >= 1000000000) {
+            cancel->deadline.tv_sec++;
+            cancel->deadline.tv_nsec -= 1000000000;
+        }
+    }
+}
+
+/**
+ * Function: cancel_request
+ * ------------------------
+ * @brief  Cancels a token. Safe to call from any thread.
+ *
+ * @param cancel The token.
+ *
+ */
+void cancel_request(cancel_t *cancel)
+{
+    __atomic_store_n(&cancel->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function: cancel_check
+ * ----------------------
+ * @brief  Tells whether the work guarded by a token should stop.
+ *
+ * @param cancel The token, or NULL for work that cannot be cancelled; such
+ *               work never runs the hook either.
+ *
+ * @return bool True once the token was cancelled or its deadline passed.
+ *
+ */
+bool cancel_check(cancel_t *cancel)
+{
+    if (cancel == NULL)
+        return false;
+    void (*hook)(void) = __atomic_load_n(&check_hook, __ATOMIC_RELAXED);
+    if (hook != NULL)
+        hook();
+    if (__atomic_load_n(&cancel->cancelled, __ATOMIC_RELAXED))
+        return true;
+    if (!cancel->has_deadline)
+        return false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > cancel->deadline.tv_sec
+        || (now.tv_sec == cancel->deadline.tv_sec && now.tv_nsec >= cancel->deadline.tv_nsec)) {
+        cancel_request(cancel);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Function: cancel_set_hook
+ * -------------------------
+ * @brief  Installs a function to run at every check of a token.
+ *
+ * The hook runs on the checking thread before the token is tested, so time
+ * spent in it counts towards the deadline. Callers of cancel_check must
+ * not hold locks the hook's other work could need.
+ *
+ * @param hook The function, or NULL for none.
+ *
+ */
+void cancel_set_hook(void (*hook)(void))
+{
+    __atomic_store_n(&check_hook, hook, __ATOMIC_RELAXED);
+}
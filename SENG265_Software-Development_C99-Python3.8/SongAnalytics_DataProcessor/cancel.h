@@ -0,0 +1,37 @@
+/** @file cancel.h
+ *  @brief Function prototypes for query cancellation tokens.
+ *
+ * Long loops call cancel_check every CANCEL_BATCH iterations (or every
+ * iteration when an iteration is itself expensive) and stop when it returns
+ * true. A token is cancelled explicitly with cancel_request, possibly from
+ * another thread, or implicitly once its deadline has passed. Each check is
+ * also a point where a cooperative scheduler installed with cancel_set_hook
+ * may run other work before the loop continues.
+ */
+#ifndef _CANCEL_H_
+#define _CANCEL_H_
+
+#include <stdbool.h>
+#include <time.h>
+
+#define CANCEL_BATCH 1024
+
+/**
+ * @brief A cancellation flag with an optional deadline.
+ */
+typedef struct cancel_t
+{
+    int cancelled;
+    bool has_deadline;
+    struct timespec deadline;
+} cancel_t;
+
+/**
+ * Function protypes associated with cancellation.
+ */
+void cancel_init(cancel_t *cancel, long timeout_ms);
+void cancel_request(cancel_t *cancel);
+bool cancel_check(cancel_t *cancel);
+void cancel_set_hook(void (*hook)(void));
+
+#endif
@@ -0,0 +1,117 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+"""
+Checks that every --limit path orders ties like the full sort (order_list): the fused kernels and
+top_k over --data, the cache and the rows file, and pages fetched with --after.
+Sample input: python3 check.py ./song_analyzer check.csv
+"""
+import os
+import re
+import subprocess
+import sys
+import tempfile
+from typing import List
+
+LIMIT = 25
+PAGE = 7
+
+# The --filter/--value, --order_by and --order of each shape; the first ones have fused kernels
+SHAPES = [
+    ([], 'STREAMS', 'DES'),
+    ([], 'STREAMS', 'ASC'),
+    (['--filter=ARTIST', '--value=Drake'], 'STREAMS', 'DES'),
+    (['--filter=YEAR', '--value=2020'], 'STREAMS', 'DES'),
+    (['--filter=YEAR', '--value=2020'], 'NO_SPOTIFY_PLAYLISTS', 'ASC'),
+    (['--filter=YEAR', '--value=2020'], 'NO_APPLE_PLAYLISTS', 'DES'),
+    (['--filter=YEAR', '--value=2020'], 'NO_APPLE_PLAYLISTS', 'ASC'),
+    (['--filter=ARTIST', '--value=Taylor Swift'], 'NO_SPOTIFY_PLAYLISTS', 'ASC'),
+    (['--filter=ARTIST_IS', '--value=SZA'], 'NO_APPLE_PLAYLISTS', 'DES'),
+    ([], 'NO_SPOTIFY_PLAYLISTS', 'DES'),
+    ([], 'TRACK_NAME', 'ASC'),
+    ([], 'ARTIST', 'DES'),
+]
+
+
+def query(binary: str, args: List[str]) -> List[str]:
+    """
+    Runs one query in the current directory and returns the lines of its output file.
+
+    Parameters
+    ----------
+    binary : str
+        The song_analyzer binary.
+    args : list
+        The arguments.
+
+    Returns
+    -------
+    list
+        The lines of output.csv, header included, followed by the next page hint if one was printed.
+    """
+    result = subprocess.run([binary] + args, stdout=subprocess.PIPE, universal_newlines=True, check=True)
+    with open('output.csv', encoding='utf-8') as outfile:
+        lines = outfile.read().splitlines()
+    return lines + re.findall(r'--after=\S+', result.stdout)
+
+
+def check(binary: str, data: str) -> int:
+    """
+    Compares the first LIMIT rows of every shape and source with the full sort of the data file.
+
+    Parameters
+    ----------
+    binary : str
+        The song_analyzer binary.
+    data : str
+        The data file.
+
+    Returns
+    -------
+    int
+        0 if every path agrees, 1 otherwise.
+    """
+    binary = os.path.abspath(binary)
+    data = os.path.abspath(data)
+    failures = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        os.chdir(tmp)
+        subprocess.run([binary, '--data=' + data, '--save_cache=check.sabf', '--save_rows=check.sarw'],
+                       stdout=subprocess.DEVNULL, check=True)
+        for filters, order_by, order in SHAPES:
+            shape = filters + ['--order_by=' + order_by, '--order=' + order]
+            expected = query(binary, ['--data=' + data] + shape)[:LIMIT + 1]
+            for source in ('--data=' + data, '--cache=check.sabf', '--rows=check.sarw'):
+                got = query(binary, [source] + shape + ['--limit=%d' % LIMIT])[:LIMIT + 1]
+                if got != expected:
+                    print('%s %s: differs from the full sort' % (source, ' '.join(shape)), file=sys.stderr)
+                    failures += 1
+            if order_by in ('TRACK_NAME', 'ARTIST'):
+                continue
+            pages = ['']
+            after: List[str] = []
+            while len(pages) < LIMIT + 1:
+                lines = query(binary, ['--data=' + data] + shape + ['--limit=%d' % PAGE] + after)
+                rows = [line for line in lines[1:] if not line.startswith('--after=')]
+                pages += rows
+                after = [line for line in lines if line.startswith('--after=')]
+                if not rows or not after:
+                    break
+            if pages[1:LIMIT + 1] != expected[1:]:
+                print('--after %s: pages differ from the full sort' % ' '.join(shape), file=sys.stderr)
+                failures += 1
+    print('%d shapes checked, %d differences' % (len(SHAPES), failures))
+    return 1 if failures else 0
+
+
+def main() -> int:
+    """
+    Checks the binary and data file given on the command line.
+    """
+    if len(sys.argv) != 3:
+        print('Usage: check.py BINARY DATAFILE', file=sys.stderr)
+        return 1
+    return check(sys.argv[1], sys.argv[2])
+
+
+if __name__ == '__main__':
+    sys.exit(main())
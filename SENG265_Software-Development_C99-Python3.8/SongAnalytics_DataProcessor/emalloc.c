@@ -0,0 +1,68 @@
+/** @file emalloc.c
+ *  @brief Implementation of the checked allocator.
+ *
+ * Based on the implementation approach described in "The Practice
+ * of Programming" by Kernighan and Pike (Addison-Wesley, 1999).
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+
+/**
+ * Function: emalloc
+ * -----------------
+ * @brief  Allocates memory, exiting the program if it cannot.
+ *
+ * @param n The number of bytes.
+ *
+ * @return void* The allocated memory, never NULL.
+ *
+ */
+void *emalloc(size_t n)
+{
+    void *p = malloc(n);
+    if (p == NULL) {
+        fprintf(stderr, "malloc of %zu bytes failed\n", n);
+        exit(1);
+    }
+    return p;
+}
+
+/**
+ * Function: erealloc
+ * ------------------
+ * @brief  Resizes memory, exiting the program if it cannot.
+ *
+ * @param p The memory, or NULL.
+ * @param n The new number of bytes.
+ *
+ * @return void* The resized memory, never NULL.
+ *
+ */
+void *erealloc(void *p, size_t n)
+{
+    void *q = realloc(p, n);
+    if (q == NULL) {
+        fprintf(stderr, "realloc of %zu bytes failed\n", n);
+        exit(1);
+    }
+    return q;
+}
+
+/**
+ * Function: estrdup
+ * -----------------
+ * @brief  Copies a string, exiting the program if it cannot.
+ *
+ * @param s The string.
+ *
+ * @return char* The copy, never NULL.
+ *
+ */
+char *estrdup(const char *s)
+{
+    size_t n = strlen(s) + 1;
+    return memcpy(emalloc(n), s, n);
+}
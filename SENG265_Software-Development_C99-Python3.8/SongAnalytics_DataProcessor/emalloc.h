@@ -0,0 +1,13 @@
+/** @file emalloc.h
+ *  @brief Function prototypes for the checked allocator.
+ */
+#ifndef _EMALLOC_H_
+#define _EMALLOC_H_
+
+#include <stddef.h>
+
+void *emalloc(size_t n);
+void *erealloc(void *p, size_t n);
+char *estrdup(const char *s);
+
+#endif
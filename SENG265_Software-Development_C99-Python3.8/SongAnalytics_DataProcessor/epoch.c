@@ -0,0 +1,166 @@
+/** @file epoch.c
+ *  @brief Implementation of epoch-based memory reclamation.
+ *
+ * Slot announcements and the scan in epoch_reclaim are sequentially
+ * consistent. A reader whose announcement the scan misses therefore
+ * announced after the scan, and so after the writer unlinked the memory
+ * being freed; it can only load the new pointer.
+ */
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "emalloc.h"
+#include "epoch.h"
+
+/**
+ * Function: epoch_new
+ * -------------------
+ * @brief  Creates an epoch domain with no readers and nothing retired.
+ *
+ * @return epoch_t* The new domain.
+ *
+ */
+epoch_t *epoch_new(void)
+{
+    epoch_t *epoch = emalloc(sizeof(epoch_t));
+    epoch->global = 1;
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+        epoch->slots[i] = EPOCH_IDLE;
+    pthread_mutex_init(&epoch->lock, NULL);
+    epoch->retired = NULL;
+    return epoch;
+}
+
+/**
+ * Function: epoch_enter
+ * ---------------------
+ * @brief  Starts a read-side critical section.
+ *
+ * Pointers loaded from shared structures stay valid until epoch_exit.
+ * Waits (yielding) only when all EPOCH_MAX_READERS slots are taken.
+ *
+ * @param epoch The domain.
+ *
+ * @return int The slot to pass to epoch_exit.
+ *
+ */
+int epoch_enter(epoch_t *epoch)
+{
+    for (;;) {
+        for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+            uint64_t idle = EPOCH_IDLE;
+            uint64_t now = __atomic_load_n(&epoch->global, __ATOMIC_SEQ_CST);
+            if (__atomic_compare_exchange_n(&epoch->slots[i], &idle, now, false,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                return i;
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * Function: epoch_exit
+ * --------------------
+ * @brief  Ends a read-side critical section.
+ *
+ * @param epoch The domain.
+ * @param slot The slot returned by epoch_enter.
+ *
+ */
+void epoch_exit(epoch_t *epoch, int slot)
+{
+    __atomic_store_n(&epoch->slots[slot], EPOCH_IDLE, __ATOMIC_RELEASE);
+}
+
+/**
+ * Function: epoch_retire
+ * ----------------------
+ * @brief  Schedules memory that was just unlinked to be freed.
+ *
+ * The caller must have published the replacement before retiring. Memory
+ * retired earlier that no reader can see any more is freed on the way.
+ *
+ * @param epoch The domain.
+ * @param ptr The unlinked memory.
+ * @param fn The function that frees it.
+ *
+ */
+void epoch_retire(epoch_t *epoch, void *ptr, void (*fn)(void *))
+{
+    epoch_retired_t *item = emalloc(sizeof(epoch_retired_t));
+    item->ptr = ptr;
+    item->fn = fn;
+
+    pthread_mutex_lock(&epoch->lock);
+    item->epoch = __atomic_fetch_add(&epoch->global, 1, __ATOMIC_SEQ_CST);
+    item->next = epoch->retired;
+    epoch->retired = item;
+    pthread_mutex_unlock(&epoch->lock);
+
+    epoch_reclaim(epoch);
+}
+
+/**
+ * Function: epoch_reclaim
+ * -----------------------
+ * @brief  Frees the retired memory that no active reader can still hold.
+ *
+ * @param epoch The domain.
+ *
+ */
+void epoch_reclaim(epoch_t *epoch)
+{
+    epoch_retired_t *done = NULL;
+
+    pthread_mutex_lock(&epoch->lock);
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < EPOCH_MAX_READERS; i++) {
+        uint64_t e = __atomic_load_n(&epoch->slots[i], __ATOMIC_SEQ_CST);
+        if (e != EPOCH_IDLE && e < oldest)
+            oldest = e;
+    }
+
+    epoch_retired_t **p = &epoch->retired;
+    while (*p != NULL) {
+        epoch_retired_t *item = *p;
+        if (item->epoch < oldest) {
+            *p = item->next;
+            item->next = done;
+            done = item;
+        } else {
+            p = &item->next;
+        }
+    }
+    pthread_mutex_unlock(&epoch->lock);
+
+    while (done != NULL) {
+        epoch_retired_t *next = done->next;
+        done->fn(done->ptr);
+        free(done);
+        done = next;
+    }
+}
+
+/**
+ * Function: epoch_free
+ * --------------------
+ * @brief  Frees everything still retired, then the domain itself.
+ *
+ * Only call once no reader can be active.
+ *
+ * @param epoch The domain to free.
+ *
+ */
+void epoch_free(epoch_t *epoch)
+{
+    if (epoch == NULL)
+        return;
+    while (epoch->retired != NULL) {
+        epoch_retired_t *item = epoch->retired;
+        epoch->retired = item->next;
+        item->fn(item->ptr);
+        free(item);
+    }
+    pthread_mutex_destroy(&epoch->lock);
+    free(epoch);
+}
@@ -0,0 +1,51 @@
+/** @file epoch.h
+ *  @brief Function prototypes for epoch-based memory reclamation.
+ *
+ * Readers announce the epoch they entered in a slot and clear it on exit;
+ * they never block. A writer that unlinks memory retires it with the
+ * current epoch and advances the epoch. Retired memory is freed once every
+ * active reader entered in a later epoch, i.e. after the unlink, so no
+ * reader can still hold a pointer to it.
+ */
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define EPOCH_MAX_READERS 64
+#define EPOCH_IDLE 0
+
+/**
+ * @brief A retired allocation, freed by fn once no reader can see it.
+ */
+typedef struct epoch_retired_t
+{
+    void *ptr;
+    void (*fn)(void *);
+    uint64_t epoch;
+    struct epoch_retired_t *next;
+} epoch_retired_t;
+
+/**
+ * @brief Reader slots, the global epoch and the memory waiting to be freed.
+ */
+typedef struct epoch_t
+{
+    uint64_t global;
+    uint64_t slots[EPOCH_MAX_READERS];
+    pthread_mutex_t lock;
+    epoch_retired_t *retired;
+} epoch_t;
+
+/**
+ * Function protypes associated with epoch-based reclamation.
+ */
+epoch_t *epoch_new(void);
+int epoch_enter(epoch_t *epoch);
+void epoch_exit(epoch_t *epoch, int slot);
+void epoch_retire(epoch_t *epoch, void *ptr, void (*fn)(void *));
+void epoch_reclaim(epoch_t *epoch);
+void epoch_free(epoch_t *epoch);
+
+#endif
@@ -0,0 +1,201 @@
+/** @file export.c
+ *  @brief Implementation of writing large results through a mapped file.
+ *
+ * The rows are split into one contiguous range per thread. In the first
+ * pass each thread adds up the lengths of its rows; the range offsets follow
+ * from those sums. The file is then extended to its final size and mapped,
+ * and in the second pass each thread formats its rows at its offset.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "export.h"
+
+/**
+ * @brief One thread's range of rows and where they go.
+ */
+typedef struct export_part_t
+{
+    node_t **rows;
+    size_t lo;
+    size_t hi;
+    export_format_t format;
+    void *ctx;
+    char *dst;
+    size_t bytes;
+} export_part_t;
+
+/**
+ * Function: measure_part
+ * ----------------------
+ * @brief  Adds up the lengths of a range of rows (thread body).
+ *
+ * @param p The export_part_t; bytes is set.
+ *
+ * @return void* NULL.
+ *
+ */
+static void *measure_part(void *p)
+{
+    export_part_t *part = p;
+    size_t bytes = 0;
+    for (size_t i = part->lo; i < part->hi; i++)
+        bytes += part->format(part->rows[i], NULL, part->ctx);
+    part->bytes = bytes;
+    return NULL;
+}
+
+/**
+ * Function: fill_part
+ * -------------------
+ * @brief  Formats a range of rows into its region of the mapping (thread body).
+ *
+ * @param p The export_part_t.
+ *
+ * @return void* NULL.
+ *
+ */
+static void *fill_part(void *p)
+{
+    export_part_t *part = p;
+    char *dst = part->dst;
+    for (size_t i = part->lo; i < part->hi; i++)
+        dst += part->format(part->rows[i], dst, part->ctx);
+    return NULL;
+}
+
+/**
+ * Function: run_parts
+ * -------------------
+ * @brief  Runs a pass over every part, the last one on the calling thread.
+ *
+ * A part whose thread cannot be started is run on the calling thread too.
+ *
+ * @param parts The parts.
+ * @param n The number of parts.
+ * @param body The pass.
+ *
+ */
+static void run_parts(export_part_t *parts, int n, void *(*body)(void *))
+{
+    pthread_t threads[EXPORT_MAX_THREADS];
+    bool started[EXPORT_MAX_THREADS];
+    for (int t = 0; t < n - 1; t++)
+        started[t] = pthread_create(&threads[t], NULL, body, &parts[t]) == 0;
+    body(&parts[n - 1]);
+    for (int t = 0; t < n - 1; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        else
+            body(&parts[t]);
+    }
+}
+
+/**
+ * Function: export_rows
+ * ---------------------
+ * @brief  Writes rows to the end of an output file through a mapping, in parallel.
+ *
+ * Only a regular file is mapped, and only for at least EXPORT_MIN_ROWS rows;
+ * otherwise nothing is written and the caller writes the rows itself. What
+ * was written through out before is kept, and out is left at the new end.
+ *
+ * @param out The output file, opened for reading and writing ("w+").
+ * @param rows The rows, in output order.
+ * @param n The number of rows.
+ * @param format Formats a row.
+ * @param ctx Passed to format.
+ *
+ * @return int 0 if the rows were written, -1 if the caller has to write them.
+ *
+ */
+int export_rows(FILE *out, node_t **rows, size_t n, export_format_t format, void *ctx)
+{
+    struct stat st;
+    if (n < EXPORT_MIN_ROWS || fflush(out) != 0 || fstat(fileno(out), &st) != 0 || !S_ISREG(st.st_mode))
+        return -1;
+    long start = ftell(out);
+    if (start < 0)
+        return -1;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_parts = cpus < 1 ? 1 : cpus > EXPORT_MAX_THREADS ? EXPORT_MAX_THREADS : (int)cpus;
+    if ((size_t)num_parts > n / (EXPORT_MIN_ROWS / 4))
+        num_parts = (int)(n / (EXPORT_MIN_ROWS / 4));
+
+    export_part_t parts[EXPORT_MAX_THREADS];
+    for (int t = 0; t < num_parts; t++)
+        parts[t] = (export_part_t){rows, n * t / num_parts, n * (t + 1) / num_parts, format, ctx, NULL, 0};
+    run_parts(parts, num_parts, measure_part);
+
+    /*--Size the file once, then give each part its region--*/
+    size_t size = (size_t)start;
+    for (int t = 0; t < num_parts; t++)
+        size += parts[t].bytes;
+    int fd = fileno(out);
+    if (ftruncate(fd, (off_t)size) != 0)
+        return -1;
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ftruncate(fd, (off_t)start);
+        return -1;
+    }
+    size_t offset = (size_t)start;
+    for (int t = 0; t < num_parts; t++) {
+        parts[t].dst = base + offset;
+        offset += parts[t].bytes;
+    }
+    run_parts(parts, num_parts, fill_part);
+
+    munmap(base, size);
+    fseek(out, 0, SEEK_END);
+    return 0;
+}
+
+/**
+ * Function: export_uint
+ * ---------------------
+ * @brief  Writes an unsigned integer in decimal.
+ *
+ * @param dst Where to write it, or NULL to only measure it.
+ * @param value The value.
+ *
+ * @return size_t The number of digits.
+ *
+ */
+size_t export_uint(char *dst, uint64_t value)
+{
+    char digits[20];
+    size_t len = 0;
+    do {
+        digits[len++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    if (dst != NULL) {
+        for (size_t i = 0; i < len; i++)
+            dst[i] = digits[len - 1 - i];
+    }
+    return len;
+}
+
+/**
+ * Function: export_string
+ * -----------------------
+ * @brief  Writes a string without its terminating NUL.
+ *
+ * @param dst Where to write it, or NULL to only measure it.
+ * @param s The string.
+ *
+ * @return size_t Its length.
+ *
+ */
+size_t export_string(char *dst, const char *s)
+{
+    size_t len = strlen(s);
+    if (dst != NULL)
+        memcpy(dst, s, len);
+    return len;
+}
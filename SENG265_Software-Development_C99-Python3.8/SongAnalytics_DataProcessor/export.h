@@ -0,0 +1,33 @@
+/** @file export.h
+ *  @brief Function prototypes for writing large results through a mapped file.
+ *
+ * The size of every row is measured first, so the file is extended once to
+ * its final size and each thread formats its share of the rows straight
+ * into its own region of the mapping, with no stdio buffer in between.
+ */
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "list.h"
+
+#define EXPORT_MIN_ROWS 16384
+#define EXPORT_MAX_THREADS 16
+
+/**
+ * @brief Formats one row. With dst NULL it only returns the length.
+ *
+ * It must write exactly the number of bytes it returns for the same row.
+ */
+typedef size_t (*export_format_t)(node_t *node, char *dst, void *ctx);
+
+/**
+ * Function protypes associated with mapped export.
+ */
+int export_rows(FILE *out, node_t **rows, size_t n, export_format_t format, void *ctx);
+size_t export_uint(char *dst, uint64_t value);
+size_t export_string(char *dst, const char *s);
+
+#endif
@@ -0,0 +1,78 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+"""
+Writes a synthetic data file in the format of the Spotify 2023 dataset, for benchmarks and
+profile-guided builds.
+Sample input: python3 gen_data.py 200000 synthetic.csv
+"""
+import random
+import sys
+from typing import List, TextIO
+
+HEADER = ('track_name,artist(s)_name,artist_count,released_year,released_month,released_day,'
+          'in_spotify_playlists,streams,in_apple_playlists')
+
+ARTISTS = ['Taylor Swift', 'Bad Bunny', 'The Weeknd', 'Dua Lipa', 'Drake', 'Harry Styles',
+           'Olivia Rodrigo', 'SZA', 'Doja Cat', 'Ed Sheeran', 'Billie Eilish', 'Karol G',
+           'Peso Pluma', 'Post Malone', 'Arctic Monkeys', 'Rosalía', 'Beyoncé', 'BTS',
+           'Måneskin', 'Stray Kids', 'Ozuna', 'Shakira', 'Feid', 'Rauw Alejandro']
+
+WORDS = ['Love', 'Night', 'Dance', 'Blue', 'Heart', 'Fire', 'Summer', 'Dream', 'Star', 'Rain',
+         'Gold', 'Ocean', 'Time', 'Lights', 'Home', 'Corazón', 'Niña', 'Café', 'Été', 'Señorita']
+
+
+def pick_artists(rng: random.Random) -> List[str]:
+    """
+    Picks the artists of a track: mostly one, with a few popular artists on most tracks.
+
+    Parameters
+    ----------
+    rng : random.Random
+        The random number generator.
+
+    Returns
+    -------
+    list
+        The artist names.
+    """
+    count = rng.choice([1, 1, 1, 1, 2, 2, 3])
+    return rng.sample(ARTISTS[:8] if rng.random() < 0.5 else ARTISTS, count)
+
+
+def write_rows(num_rows: int, out: TextIO, seed: int) -> None:
+    """
+    Writes the header and num_rows records with skewed stream counts.
+
+    Parameters
+    ----------
+    num_rows : int
+        The number of records.
+    out : TextIO
+        Where to write them.
+    seed : int
+        The seed; the same seed always gives the same file.
+    """
+    rng = random.Random(seed)
+    out.write(HEADER + '\n')
+    for _ in range(num_rows):
+        artists = pick_artists(rng)
+        title = ' '.join(rng.sample(WORDS, rng.randint(1, 4)))
+        if rng.random() < 0.05:
+            title += ' (feat. ' + rng.choice(ARTISTS) + ')'
+        streams = int(rng.paretovariate(1.2) * 1000000)
+        out.write(f'{title},{" & ".join(artists)},{len(artists)},{rng.randint(1950, 2023)},'
+                  f'{rng.randint(1, 12)},{rng.randint(1, 28)},{rng.randint(0, 60000)},'
+                  f'{min(streams, 4000000000)},{rng.randint(0, 700)}\n')
+
+
+def main():
+    """Parses the arguments and writes the file."""
+    if len(sys.argv) not in (3, 4):
+        sys.exit('Usage: gen_data.py ROWS OUTFILE [SEED]')
+    seed = int(sys.argv[3]) if len(sys.argv) == 4 else 265
+    with open(sys.argv[2], 'w', encoding='utf-8', newline='\n') as out:
+        write_rows(int(sys.argv[1]), out, seed)
+
+
+if __name__ == '__main__':
+    main()
@@ -18,6 +18,7 @@
  * @brief Creates a new node.
  *
  * This function allocates memory for a new node of type node_t and returns a pointer to the newly created node. It uses the emalloc function to allocate memory and asserts that the allocation was successful.
+ * The node is zeroed, so it starts without strings.
  *
  * @return node_t* Returns a pointer to the newly created node.
  */
@@ -26,14 +27,94 @@ node_t *new_node()
     // Allocate space for new node
     node_t *node = (node_t *)emalloc(sizeof(node_t));
     assert(node != NULL && "node == NULL");
+    memset(node, 0, sizeof(node_t));
 
     return node;
 }
 
+/**
+ * Function:  node_track_name
+ * --------------------------
+ * @brief  Returns the track name of a record.
+ *
+ * @param node The record.
+ *
+ * @return const char* The track name, or "" if it was not loaded.
+ *
+ */
+const char *node_track_name(const node_t *node)
+{
+    return node->strings != NULL && node->strings->track_name != NULL ? node->strings->track_name : "";
+}
+
+/**
+ * Function:  node_artist
+ * ----------------------
+ * @brief  Returns the artist(s) of a record.
+ *
+ * @param node The record.
+ *
+ * @return const char* The artist(s), or "" if they were not loaded.
+ *
+ */
+const char *node_artist(const node_t *node)
+{
+    return node->strings != NULL && node->strings->artist != NULL ? node->strings->artist : "";
+}
+
+/**
+ * Function:  string_key
+ * ---------------------
+ * @brief  Returns the first 8 bytes of a string as a big-endian integer.
+ *
+ * Shorter strings are padded with zero bytes, so comparing two keys as
+ * unsigned integers orders the strings like strcmp does on their first
+ * 8 bytes.
+ *
+ * @param s The string, or NULL for "".
+ *
+ * @return uint64_t The prefix key.
+ *
+ */
+uint64_t string_key(const char *s)
+{
+    uint64_t key = 0;
+    bool ended = s == NULL;
+    for (int i = 0; i < 8; i++) {
+        ended = ended || s[i] == '\0';
+        key = key << 8 | (ended ? 0 : (unsigned char)s[i]);
+    }
+    return key;
+}
+
+/**
+ * Function:  node_set_strings
+ * ---------------------------
+ * @brief  Points a record at its strings.
+ *
+ * The strings are not copied; they must outlive the record. Only the small
+ * node_strings_t is allocated, from the arena.
+ *
+ * @param node The record.
+ * @param arena The arena to allocate from.
+ * @param track_name The track name.
+ * @param artist The artist(s).
+ *
+ */
+void node_set_strings(node_t *node, arena_t *arena, const char *track_name, const char *artist)
+{
+    node->strings = arena_alloc(arena, sizeof(node_strings_t));
+    node->strings->track_name = track_name;
+    node->strings->artist = artist;
+    node->strings->track_key = string_key(track_name);
+    node->strings->artist_key = string_key(artist);
+}
+
 /** [1]
  * @brief Fills a node with data from a token.
  *
  * This function takes a node, a token, and a count as input. It fills the fields of the node based on the count. The token is expected to be a string representation of the data to be filled in the node.
+ * Strings are copied into an arena that lives as long as the program.
  *
  * @param record The node to be filled with data.
  * @param token The string representation of the data to be filled in the node.
@@ -41,37 +122,170 @@ node_t *new_node()
  */
 void fill_node(node_t *record, char *token, unsigned int count)
 {
-    
+    static arena_t *strings = NULL;
+    if (strings == NULL)
+        strings = arena_new();
+    fill_node_fields(record, token, count, FIELD_ALL, strings);
+}
+
+/**
+ * Function:  fill_node_fields
+ * ---------------------------
+ * @brief  Fills a node from a token only if its field is wanted.
+ *
+ * Unwanted fields are cleared instead of converted, so strings that are not
+ * needed are never copied and numbers never parsed. Wanted strings are
+ * copied into the arena.
+ *
+ * @param record The node to fill.
+ * @param token The token read from the data file.
+ * @param count The index of the token in its line.
+ * @param fields The FIELD_* bits of the fields to fill.
+ * @param arena The arena to copy strings into.
+ *
+ */
+void fill_node_fields(node_t *record, char *token, unsigned int count, unsigned int fields, arena_t *arena)
+{
+    if (count < 9 && (fields & (1u << count)) == 0) {
+        switch (count) {
+            case 2: record->artist_count = 0; break;
+            case 3: record->date &= 0x1ffu; break;
+            case 4: record->date &= ~0x1e0u; break;
+            case 5: record->date &= ~0x1fu; break;
+            case 6: record->in_spotify_playlists = 0; break;
+            case 7: record->streams = 0; break;
+            case 8: record->in_apple_playlists = 0; break;
+        }
+        return;
+    }
+
     // If token has newline character on end, remove it
     size_t len = strlen(token);
     char temp[200];
 
+    if (count < 2 && record->strings == NULL)
+        node_set_strings(record, arena, NULL, NULL);
+
     switch (count) {
         case 0:
-            strcpy(record->track_name, token); break;
+            record->strings->track_name = arena_strdup(arena, token);
+            record->strings->track_key = string_key(token); break;
         case 1:
-            strcpy(record->artist, token); break;
+            record->strings->artist = arena_strdup(arena, token);
+            record->strings->artist_key = string_key(token); break;
         case 2:
             record->artist_count = atoi(token); break;
         case 3:
-            record->date_.tm_year = atoi(token) - 1900; break;
+            record->date = (record->date & 0x1ffu) | (unsigned int)atoi(token) << 9; break;
         case 4:
-            record->date_.tm_mon = atoi(token) - 1; break;
+            record->date = (record->date & ~0x1e0u) | ((unsigned int)atoi(token) & 0xfu) << 5; break;
         case 5:
-            record->date_.tm_mday = atoi(token); break;
+            record->date = (record->date & ~0x1fu) | ((unsigned int)atoi(token) & 0x1fu); break;
         case 6:
             record->in_spotify_playlists = strtoul(token, NULL, 10); break;
         case 7:
             record->streams = strtoul(token, NULL, 10); break;
         case 8:
-            strcpy(temp, token);
-            if (len > 0 && token[len-1]=='\n') {
+            strncpy(temp, token, sizeof(temp) - 1);
+            temp[sizeof(temp) - 1] = '\0';
+            if (len > 0 && len < sizeof(temp) && token[len-1]=='\n') {
                 temp[len - 1] = '\0';  // Remove the newline character
             }
             record->in_apple_playlists = strtoul(temp, NULL, 10); break;
         default:
             printf("Token Fetch Failed, count: %d\n", count);
-    }   
+    }
+}
+
+/**
+ * Function:  pack_date
+ * --------------------
+ * @brief  Packs a release date into a single integer (year << 9 | month << 5 | day).
+ *
+ * Packed dates compare in the same order as the dates they encode.
+ *
+ * @param date The date to pack.
+ *
+ * @return unsigned int The packed date.
+ *
+ */
+unsigned int pack_date(const struct tm *date)
+{
+    return (unsigned int)(date->tm_year + 1900) << 9 | (unsigned int)(date->tm_mon + 1) << 5 | (unsigned int)date->tm_mday;
+}
+
+/**
+ * Function:  unpack_date
+ * ----------------------
+ * @brief  Expands a date packed by pack_date.
+ *
+ * @param packed The packed date.
+ * @param date The struct tm to fill; fields other than the date are zeroed.
+ *
+ */
+void unpack_date(unsigned int packed, struct tm *date)
+{
+    memset(date, 0, sizeof(*date));
+    date->tm_year = (int)(packed >> 9) - 1900;
+    date->tm_mon = (int)((packed >> 5) & 0xf) - 1;
+    date->tm_mday = (int)(packed & 0x1f);
+}
+
+/**
+ * Function:  next_artist_token
+ * ----------------------------
+ * @brief  Finds the next single artist in an artist(s) field.
+ *
+ * Artists are separated by ',', ';' or '&'; surrounding spaces are skipped.
+ *
+ * @param s Where to start looking.
+ * @param len Receives the length of the token.
+ *
+ * @return const char* The start of the token, or NULL if there are no more.
+ *
+ */
+const char *next_artist_token(const char *s, size_t *len)
+{
+    for (;;)
+    {
+        while (*s == ' ' || *s == ',' || *s == ';' || *s == '&')
+            s++;
+        if (*s == '\0')
+            return NULL;
+
+        size_t n = strcspn(s, ",;&");
+        size_t end = n;
+        while (end > 0 && s[end - 1] == ' ')
+            end--;
+        if (end > 0)
+        {
+            *len = end;
+            return s;
+        }
+        s += n;
+    }
+}
+
+/**
+ * Function:  artist_has_token
+ * ---------------------------
+ * @brief  Checks whether one of the artists in an artist(s) field is exactly name.
+ *
+ * @param artist The artist(s) field.
+ * @param name The artist to look for.
+ *
+ * @return int 1 if found, 0 otherwise.
+ *
+ */
+int artist_has_token(const char *artist, const char *name)
+{
+    size_t name_len = strlen(name);
+    size_t len;
+
+    for (const char *t = next_artist_token(artist, &len); t != NULL; t = next_artist_token(t + len, &len))
+        if (len == name_len && strncmp(t, name, len) == 0)
+            return 1;
+    return 0;
 }
 
 /**
@@ -173,6 +387,69 @@ int compare_by_spotify_playlists(node_t *a, node_t *b, int order) {
     }
 }
 
+/**
+ * Function:  compare_strings
+ * --------------------------
+ * @brief  Compares two strings through their prefix keys.
+ *
+ * The strings are only read when the keys tie and neither string ended
+ * within its first 8 bytes (a key whose last byte is zero).
+ *
+ * @param a The first string.
+ * @param a_key The prefix key of a.
+ * @param b The second string.
+ * @param b_key The prefix key of b.
+ *
+ * @return int Negative, zero or positive, like strcmp.
+ *
+ */
+static int compare_strings(const char *a, uint64_t a_key, const char *b, uint64_t b_key)
+{
+    if (a_key != b_key)
+        return a_key < b_key ? -1 : 1;
+    if ((a_key & 0xff) == 0)
+        return 0;
+    return strcmp(a + 8, b + 8);
+}
+
+/**
+ * Function:  compare_by_track_name
+ * --------------------------------
+ * @brief  Compares two nodes by track name, in byte order.
+ *
+ * @param a The first node to compare.
+ * @param b The second node to compare.
+ * @param order The order in which to sort (see add_inorder).
+ *
+ * @return int Positive if a sorts after b, negative if before, 0 if equal.
+ *
+ */
+int compare_by_track_name(node_t *a, node_t *b, int order)
+{
+    int c = compare_strings(node_track_name(a), a->strings != NULL ? a->strings->track_key : 0,
+                            node_track_name(b), b->strings != NULL ? b->strings->track_key : 0);
+    return order > 0 ? c : -c;
+}
+
+/**
+ * Function:  compare_by_artist
+ * ----------------------------
+ * @brief  Compares two nodes by artist(s), in byte order.
+ *
+ * @param a The first node to compare.
+ * @param b The second node to compare.
+ * @param order The order in which to sort (see add_inorder).
+ *
+ * @return int Positive if a sorts after b, negative if before, 0 if equal.
+ *
+ */
+int compare_by_artist(node_t *a, node_t *b, int order)
+{
+    int c = compare_strings(node_artist(a), a->strings != NULL ? a->strings->artist_key : 0,
+                            node_artist(b), b->strings != NULL ? b->strings->artist_key : 0);
+    return order > 0 ? c : -c;
+}
+
 /**
  * @brief Inserts a new node into a sorted linked list in the correct order.
  *
@@ -206,6 +483,134 @@ node_t *add_inorder(node_t *list, node_t *new, int (*compare)(node_t *, node_t *
 }
 
 
+/**
+ * Function:  comes_after
+ * ----------------------
+ * @brief  Total order used by top_k: the sort key first, then row_id
+ *         descending, so later rows come first among ties as they do with
+ *         add_inorder.
+ *
+ * @param a The first node.
+ * @param b The second node.
+ * @param compare The comparison function for the sort key.
+ * @param order The order in which to sort (see add_inorder).
+ *
+ * @return int 1 if a is output after b, 0 otherwise.
+ *
+ */
+int comes_after(node_t *a, node_t *b, int (*compare)(node_t *, node_t *, int), int order)
+{
+    int c = compare(a, b, order);
+    return c > 0 || (c == 0 && a->row_id < b->row_id);
+}
+
+/**
+ * Function:  top_k
+ * ----------------
+ * @brief  Detaches the first k nodes of a list in sorted order.
+ *
+ * Keeps a bounded max-heap of the k best nodes seen so far, so selecting
+ * costs O(n log k) instead of sorting the whole list. Ties are broken by
+ * row_id (see comes_after) so that the order is total, matches a full
+ * sort, and pages never overlap.
+ *
+ * @param list Pointer to the list head; on return it holds the nodes that
+ *             were not selected.
+ * @param compare The comparison function for the sort key.
+ * @param order The order in which to sort (see add_inorder).
+ * @param k The number of nodes to select.
+ *
+ * @return node_t* The selected nodes, in sorted order.
+ *
+ */
+node_t *top_k(node_t **list, int (*compare)(node_t *, node_t *, int), int order, size_t k)
+{
+    node_t **heap = NULL;
+    size_t size = 0;
+    size_t cap = 0;
+    node_t *rest = NULL;
+    node_t *node = *list;
+
+    while (node != NULL)
+    {
+        node_t *next = node->next;
+        node_t *evicted = node;
+
+        if (size < k)
+        {
+            if (size == cap)
+            {
+                cap = cap == 0 ? 64 : cap * 2;
+                heap = realloc(heap, cap * sizeof(node_t *));
+                assert(heap != NULL && "heap == NULL");
+            }
+            size_t i = size++;
+            while (i > 0 && comes_after(node, heap[(i - 1) / 2], compare, order))
+            {
+                heap[i] = heap[(i - 1) / 2];
+                i = (i - 1) / 2;
+            }
+            heap[i] = node;
+            evicted = NULL;
+        }
+        else if (size > 0 && comes_after(heap[0], node, compare, order))
+        {
+            /* node beats the worst kept node: replace the root and sift down */
+            evicted = heap[0];
+            size_t i = 0;
+            for (;;)
+            {
+                size_t c = 2 * i + 1;
+                if (c >= size)
+                    break;
+                if (c + 1 < size && comes_after(heap[c + 1], heap[c], compare, order))
+                    c++;
+                if (!comes_after(heap[c], node, compare, order))
+                    break;
+                heap[i] = heap[c];
+                i = c;
+            }
+            heap[i] = node;
+        }
+
+        if (evicted != NULL)
+        {
+            evicted->next = rest;
+            rest = evicted;
+        }
+        node = next;
+    }
+
+    /* Pop the worst node repeatedly, building the result from the back */
+    node_t *selected = NULL;
+    while (size > 0)
+    {
+        node_t *worst = heap[0];
+        node_t *last = heap[--size];
+        size_t i = 0;
+        for (;;)
+        {
+            size_t c = 2 * i + 1;
+            if (c >= size)
+                break;
+            if (c + 1 < size && comes_after(heap[c + 1], heap[c], compare, order))
+                c++;
+            if (!comes_after(heap[c], last, compare, order))
+                break;
+            heap[i] = heap[c];
+            i = c;
+        }
+        if (size > 0)
+            heap[i] = last;
+        worst->next = selected;
+        selected = worst;
+    }
+
+    free(heap);
+    *list = rest;
+    return selected;
+}
+
 /**
  * Function:  peek_front
  * ---------------------
@@ -4,21 +4,59 @@
 #ifndef _LINKEDLIST_H_
 #define _LINKEDLIST_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include "arena.h"
 #define MAX_WORD_LEN 50
 
+/**
+ * @brief Fields of a data file line, one bit per token in column order.
+ */
+#define FIELD_TRACK_NAME (1u << 0)
+#define FIELD_ARTIST (1u << 1)
+#define FIELD_ARTIST_COUNT (1u << 2)
+#define FIELD_DATE (7u << 3)
+#define FIELD_SPOTIFY (1u << 6)
+#define FIELD_STREAMS (1u << 7)
+#define FIELD_APPLE (1u << 8)
+#define FIELD_ALL 0x1ffu
+
+/**
+ * @brief The cold part of a record: its strings, kept out of the list node.
+ *
+ * Each string has a cached prefix key (see string_key), so ordering by a
+ * string column compares integers and only reads the strings on a tie.
+ */
+typedef struct node_strings_t
+{
+    const char *track_name;
+    const char *artist;
+    uint64_t track_key;
+    uint64_t artist_key;
+} node_strings_t;
+
 /**
  * @brief An struct that represents a song record node in the linked list.
+ *
+ * Only the fields that are compared and filtered on live in the node, which
+ * is 48 bytes, so walking a list touches about one cache line per node. The
+ * release date is packed by pack_date. The strings live elsewhere (a string
+ * arena, or the cache, row file or store the record came from) and are read
+ * through node_track_name and node_artist. Records from a cache or the store
+ * also carry the artist's id in that source's artist dictionary, so a filter
+ * on the artist is decided once per distinct artist.
  */
 typedef struct node_t
 {
-    char track_name[200];
-    char artist[200];
-    unsigned int artist_count;
-    struct tm date_;
-    unsigned long in_spotify_playlists;
     unsigned long streams;
-    unsigned long in_apple_playlists;
+    unsigned int in_spotify_playlists;
+    unsigned int in_apple_playlists;
+    unsigned int date;
+    unsigned int artist_count;
+    unsigned int row_id;
+    unsigned int artist_id;
+    node_strings_t *strings;
     struct node_t *next;
 } node_t;
 
@@ -27,13 +65,26 @@ typedef struct node_t
  * Function protypes associated with a linked list.
  */
 node_t *new_node();
+unsigned int pack_date(const struct tm *date);
+const char *next_artist_token(const char *s, size_t *len);
+int artist_has_token(const char *artist, const char *name);
+void unpack_date(unsigned int packed, struct tm *date);
+const char *node_track_name(const node_t *node);
+const char *node_artist(const node_t *node);
+uint64_t string_key(const char *s);
+void node_set_strings(node_t *node, arena_t *arena, const char *track_name, const char *artist);
 void fill_node(node_t *, char*, unsigned int);
+void fill_node_fields(node_t *record, char *token, unsigned int count, unsigned int fields, arena_t *arena);
 node_t *add_front(node_t *, node_t *);
 node_t *add_end(node_t *, node_t *);
 int compare_by_streams(node_t *a, node_t *b, int order);
 int compare_by_apple_playlists(node_t *a, node_t *b, int order);
 int compare_by_spotify_playlists(node_t *a, node_t *b, int order);
+int compare_by_track_name(node_t *a, node_t *b, int order);
+int compare_by_artist(node_t *a, node_t *b, int order);
 node_t *add_inorder(node_t *list, node_t *new, int (*compare)(node_t *, node_t *, int), int order);
+int comes_after(node_t *a, node_t *b, int (*compare)(node_t *, node_t *, int), int order);
+node_t *top_k(node_t **list, int (*compare)(node_t *, node_t *, int), int order, size_t k);
 node_t *peek_front(node_t *);
 node_t *remove_front(node_t *);
 void apply(node_t *, void (*fn)(node_t *, void *), void *arg);
@@ -0,0 +1,143 @@
+/** @file merge.c
+ *  @brief Implementation of the k-way merge of sorted record streams.
+ *
+ * The tree is stored in an array of 2k slots: tree[0] is the overall
+ * winner, tree[1..k-1] the losers of the internal matches, and run i sits
+ * at leaf k + i, whose parent is (k + i) / 2.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include "emalloc.h"
+#include "merge.h"
+
+/**
+ * Function: beats
+ * ---------------
+ * @brief  Decides a match between the current records of two runs.
+ *
+ * A finished run loses to any other; equal records go to the lower run,
+ * so records that tie come out in the order of their runs.
+ *
+ * @param merge The merge.
+ * @param a The first run.
+ * @param b The second run.
+ *
+ * @return bool True if run a's record is output before run b's.
+ *
+ */
+static bool beats(merge_t *merge, int a, int b)
+{
+    node_t *x = merge->heads[a];
+    node_t *y = merge->heads[b];
+    if (x == NULL || y == NULL)
+        return y == NULL && (x != NULL || a < b);
+    int c = merge->compare(x, y, merge->order);
+    return c < 0 || (c == 0 && a < b);
+}
+
+/**
+ * Function: replay
+ * ----------------
+ * @brief  Replays the matches on the path from a run's leaf to the root.
+ *
+ * @param merge The merge.
+ * @param run The run whose record changed.
+ *
+ */
+static void replay(merge_t *merge, int run)
+{
+    int winner = run;
+    for (int p = (merge->k + run) / 2; p >= 1; p /= 2) {
+        if (beats(merge, merge->tree[p], winner)) {
+            int loser = winner;
+            winner = merge->tree[p];
+            merge->tree[p] = loser;
+        }
+    }
+    merge->tree[0] = winner;
+}
+
+/**
+ * Function: merge_new
+ * -------------------
+ * @brief  Starts merging sorted runs, reading the first record of each.
+ *
+ * @param runs The runs, passed to next.
+ * @param k The number of runs, at least 1.
+ * @param next Reads the next record of a run.
+ * @param compare The comparison function the runs are sorted by.
+ * @param order The order the runs are sorted in (see add_inorder).
+ *
+ * @return merge_t* The merge.
+ *
+ */
+merge_t *merge_new(void **runs, int k, merge_next_t next, int (*compare)(node_t *, node_t *, int), int order)
+{
+    merge_t *merge = emalloc(sizeof(merge_t));
+    merge->k = k;
+    merge->runs = runs;
+    merge->next = next;
+    merge->compare = compare;
+    merge->order = order;
+    merge->heads = emalloc(k * sizeof(node_t *));
+    merge->tree = emalloc(k * sizeof(int));
+    merge->last = -1;
+
+    for (int i = 0; i < k; i++)
+        merge->heads[i] = next(runs[i]);
+
+    /*--Play the initial matches bottom up, keeping each winner in a scratch array--*/
+    int *winners = emalloc(2 * k * sizeof(int));
+    for (int i = 0; i < k; i++)
+        winners[k + i] = i;
+    for (int p = k - 1; p >= 1; p--) {
+        int a = winners[2 * p];
+        int b = winners[2 * p + 1];
+        bool a_wins = beats(merge, a, b);
+        winners[p] = a_wins ? a : b;
+        merge->tree[p] = a_wins ? b : a;
+    }
+    merge->tree[0] = k > 1 ? winners[1] : 0;
+    free(winners);
+    return merge;
+}
+
+/**
+ * Function: merge_next
+ * --------------------
+ * @brief  Returns the next record of the merged output.
+ *
+ * The run of the previous record is only advanced now, so that record
+ * stays valid until this call; records are owned by their runs.
+ *
+ * @param merge The merge.
+ *
+ * @return node_t* The next record, or NULL when every run is done.
+ *
+ */
+node_t *merge_next(merge_t *merge)
+{
+    if (merge->last >= 0) {
+        merge->heads[merge->last] = merge->next(merge->runs[merge->last]);
+        replay(merge, merge->last);
+    }
+    merge->last = merge->tree[0];
+    return merge->heads[merge->last];
+}
+
+/**
+ * Function: merge_free
+ * --------------------
+ * @brief  Frees a merge. The runs are not freed.
+ *
+ * @param merge The merge, or NULL.
+ *
+ */
+void merge_free(merge_t *merge)
+{
+    if (merge == NULL)
+        return;
+    free(merge->heads);
+    free(merge->tree);
+    free(merge);
+}
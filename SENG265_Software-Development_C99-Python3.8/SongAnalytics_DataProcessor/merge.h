@@ -0,0 +1,42 @@
+/** @file merge.h
+ *  @brief Function prototypes for the k-way merge of sorted record streams.
+ *
+ * The merge is a loser tree: every internal node remembers the run that
+ * lost the match played there, so replacing the winner's record costs one
+ * comparison per level (about log2 k) and never compares siblings twice.
+ * Runs are pulled lazily, one record at a time, so a merge that stops early
+ * reads only what it output.
+ */
+#ifndef _MERGE_H_
+#define _MERGE_H_
+
+#include "list.h"
+
+/**
+ * @brief Returns the next record of a run, or NULL when the run is done.
+ */
+typedef node_t *(*merge_next_t)(void *run);
+
+/**
+ * @brief A loser tree over k sorted runs.
+ */
+typedef struct merge_t
+{
+    int k;
+    void **runs;
+    merge_next_t next;
+    int (*compare)(node_t *, node_t *, int);
+    int order;
+    node_t **heads;
+    int *tree;
+    int last;
+} merge_t;
+
+/**
+ * Function protypes associated with the merge.
+ */
+merge_t *merge_new(void **runs, int k, merge_next_t next, int (*compare)(node_t *, node_t *, int), int order);
+node_t *merge_next(merge_t *merge);
+void merge_free(merge_t *merge);
+
+#endif
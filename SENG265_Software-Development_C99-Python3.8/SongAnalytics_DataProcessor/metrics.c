@@ -0,0 +1,295 @@
+/** @file metrics.c
+ *  @brief Implementation of the server's query metrics.
+ *
+ * metrics_write produces the Prometheus text exposition format. Each shape
+ * with recorded queries gets a histogram with fixed `le` boundaries (a
+ * bucket is counted under the first boundary it lies entirely below) and
+ * its p50/p90/p99/p99.9, read from the full-resolution histogram.
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "metrics.h"
+
+static const char *filter_names[METRICS_FILTERS] = {
+    "NONE", "ARTIST", "ARTIST_IS", "YEAR", "FUZZY_ARTIST", "FUZZY_TRACK", "PREFIX", "OTHER"
+};
+static const char *order_names[METRICS_ORDERS] = {
+    "NONE", "STREAMS", "NO_SPOTIFY_PLAYLISTS", "NO_APPLE_PLAYLISTS", "TRACK_NAME", "ARTIST",
+    "STATS", "COUNT"
+};
+static const char *limit_names[METRICS_LIMITS] = {
+    "none", "1-10", "11-100", "101+"
+};
+static const double le_seconds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static int lookup(const char *name, const char **names, int n, int fallback)
+{
+    if (name == NULL)
+        return 0;
+    for (int i = 1; i < n; i++)
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    return fallback;
+}
+
+/**
+ * @brief Returns the bucket of a value.
+ */
+static int bucket_of(uint64_t v)
+{
+    if (v < METRICS_LINEAR)
+        return (int)v;
+    int shift = 63 - __builtin_clzll(v) - 4;
+    if (shift > METRICS_MAX_SHIFT)
+        return METRICS_BUCKETS - 1;
+    return METRICS_LINEAR + (shift - 1) * METRICS_SUB_BUCKETS + (int)((v >> shift) - METRICS_SUB_BUCKETS);
+}
+
+/**
+ * @brief Returns the largest value that falls into a bucket.
+ */
+static uint64_t bucket_high(int b)
+{
+    if (b < METRICS_LINEAR)
+        return (uint64_t)b;
+    int k = b - METRICS_LINEAR;
+    int shift = k / METRICS_SUB_BUCKETS + 1;
+    uint64_t sub = (uint64_t)(k % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS);
+    return ((sub + 1) << shift) - 1;
+}
+
+/**
+ * Function: metrics_new
+ * ---------------------
+ * @brief  Creates an empty set of metrics.
+ *
+ * @return metrics_t* The metrics.
+ *
+ */
+metrics_t *metrics_new(void)
+{
+    metrics_t *metrics = emalloc(sizeof(metrics_t));
+    memset(metrics, 0, sizeof(*metrics));
+    return metrics;
+}
+
+/**
+ * Function: metrics_shape
+ * -----------------------
+ * @brief  Returns the shape of a query, used to pick its histogram.
+ *
+ * @param filter The filter label: a --filter value, "PREFIX", or NULL for none.
+ * @param order_by The order label: an --order_by value, "STATS", "COUNT", or NULL for none.
+ * @param limit The --limit value, or NULL.
+ *
+ * @return int The shape index.
+ *
+ */
+int metrics_shape(const char *filter, const char *order_by, const char *limit)
+{
+    int f = lookup(filter, filter_names, METRICS_FILTERS, METRICS_FILTERS - 1);
+    int o = lookup(order_by, order_names, METRICS_ORDERS, 0);
+    int l = 0;
+    if (limit != NULL) {
+        long n = atol(limit);
+        l = n <= 10 ? 1 : n <= 100 ? 2 : 3;
+    }
+    return (f * METRICS_ORDERS + o) * METRICS_LIMITS + l;
+}
+
+/**
+ * Function: metrics_record
+ * ------------------------
+ * @brief  Records the latency of a query.
+ *
+ * @param metrics The metrics.
+ * @param shape The shape returned by metrics_shape.
+ * @param micros The latency in microseconds.
+ *
+ */
+void metrics_record(metrics_t *metrics, int shape, uint64_t micros)
+{
+    metrics_hist_t *hist = __atomic_load_n(&metrics->shapes[shape], __ATOMIC_ACQUIRE);
+    if (hist == NULL) {
+        /*--First query of this shape: install a histogram, or use the one another thread won with--*/
+        metrics_hist_t *fresh = emalloc(sizeof(metrics_hist_t));
+        memset(fresh, 0, sizeof(*fresh));
+        if (__atomic_compare_exchange_n(&metrics->shapes[shape], &hist, fresh, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            hist = fresh;
+        else
+            free(fresh);
+    }
+    __atomic_fetch_add(&hist->counts[bucket_of(micros)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, micros, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function: metrics_queue
+ * -----------------------
+ * @brief  Counts a query starting (delta 1) or finishing (delta -1).
+ *
+ * @param metrics The metrics.
+ * @param delta The change in the number of queries in flight.
+ *
+ */
+void metrics_queue(metrics_t *metrics, int delta)
+{
+    __atomic_fetch_add(&metrics->in_flight, delta, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function: metrics_error
+ * -----------------------
+ * @brief  Counts a rejected request.
+ *
+ * @param metrics The metrics.
+ *
+ */
+void metrics_error(metrics_t *metrics)
+{
+    __atomic_fetch_add(&metrics->errors, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function: metrics_cancelled
+ * ---------------------------
+ * @brief  Counts a query stopped by CANCEL or its timeout.
+ *
+ * @param metrics The metrics.
+ *
+ */
+void metrics_cancelled(metrics_t *metrics)
+{
+    __atomic_fetch_add(&metrics->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function: metrics_scanned
+ * -------------------------
+ * @brief  Counts the rows and bytes a query read from the store.
+ *
+ * @param metrics The metrics.
+ * @param rows The rows scanned.
+ * @param bytes The bytes read.
+ *
+ */
+void metrics_scanned(metrics_t *metrics, uint64_t rows, uint64_t bytes)
+{
+    __atomic_fetch_add(&metrics->rows_scanned, rows, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&metrics->bytes_scanned, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function: metrics_write
+ * -----------------------
+ * @brief  Writes every metric in the Prometheus text exposition format.
+ *
+ * Histograms are read without stopping writers, so a query recorded
+ * meanwhile may be counted in some lines and not others.
+ *
+ * @param metrics The metrics.
+ * @param out The stream to write to.
+ *
+ */
+void metrics_write(metrics_t *metrics, FILE *out)
+{
+    size_t num_le = sizeof(le_seconds) / sizeof(le_seconds[0]);
+    size_t num_q = sizeof(quantiles) / sizeof(quantiles[0]);
+
+    fputs("# HELP sa_query_duration_seconds Query latency by shape.\n"
+          "# TYPE sa_query_duration_seconds histogram\n", out);
+    for (int s = 0; s < METRICS_SHAPES; s++) {
+        metrics_hist_t *hist = __atomic_load_n(&metrics->shapes[s], __ATOMIC_ACQUIRE);
+        if (hist == NULL)
+            continue;
+        char labels[128];
+        snprintf(labels, sizeof(labels), "filter=\"%s\",order_by=\"%s\",limit=\"%s\"",
+                 filter_names[s / (METRICS_ORDERS * METRICS_LIMITS)],
+                 order_names[s / METRICS_LIMITS % METRICS_ORDERS], limit_names[s % METRICS_LIMITS]);
+
+        uint64_t cumulative = 0;
+        int b = 0;
+        for (size_t i = 0; i < num_le; i++) {
+            uint64_t le_us = (uint64_t)(le_seconds[i] * 1e6);
+            for (; b < METRICS_BUCKETS && bucket_high(b) <= le_us; b++)
+                cumulative += __atomic_load_n(&hist->counts[b], __ATOMIC_RELAXED);
+            fprintf(out, "sa_query_duration_seconds_bucket{%s,le=\"%g\"} %lu\n", labels, le_seconds[i],
+                    (unsigned long)cumulative);
+        }
+        uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+        fprintf(out, "sa_query_duration_seconds_bucket{%s,le=\"+Inf\"} %lu\n", labels, (unsigned long)count);
+        fprintf(out, "sa_query_duration_seconds_sum{%s} %.6f\n", labels,
+                (double)__atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / 1e6);
+        fprintf(out, "sa_query_duration_seconds_count{%s} %lu\n", labels, (unsigned long)count);
+    }
+
+    fputs("# HELP sa_query_duration_quantile_seconds Query latency quantiles by shape.\n"
+          "# TYPE sa_query_duration_quantile_seconds gauge\n", out);
+    for (int s = 0; s < METRICS_SHAPES; s++) {
+        metrics_hist_t *hist = __atomic_load_n(&metrics->shapes[s], __ATOMIC_ACQUIRE);
+        if (hist == NULL)
+            continue;
+        uint64_t total = 0;
+        for (int b = 0; b < METRICS_BUCKETS; b++)
+            total += __atomic_load_n(&hist->counts[b], __ATOMIC_RELAXED);
+        for (size_t q = 0; q < num_q; q++) {
+            uint64_t rank = (uint64_t)(quantiles[q] * (double)total + 0.5);
+            uint64_t seen = 0;
+            int b = 0;
+            for (; b < METRICS_BUCKETS - 1; b++) {
+                seen += __atomic_load_n(&hist->counts[b], __ATOMIC_RELAXED);
+                if (seen >= rank && seen > 0)
+                    break;
+            }
+            fprintf(out, "sa_query_duration_quantile_seconds{filter=\"%s\",order_by=\"%s\",limit=\"%s\",quantile=\"%g\"} %.6f\n",
+                    filter_names[s / (METRICS_ORDERS * METRICS_LIMITS)],
+                    order_names[s / METRICS_LIMITS % METRICS_ORDERS], limit_names[s % METRICS_LIMITS],
+                    quantiles[q], (double)bucket_high(b) / 1e6);
+        }
+    }
+
+    fprintf(out, "# HELP sa_queries_in_flight Queries received and not yet answered.\n"
+                 "# TYPE sa_queries_in_flight gauge\n"
+                 "sa_queries_in_flight %ld\n",
+            (long)__atomic_load_n(&metrics->in_flight, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP sa_query_errors_total Requests rejected as not valid.\n"
+                 "# TYPE sa_query_errors_total counter\n"
+                 "sa_query_errors_total %lu\n",
+            (unsigned long)__atomic_load_n(&metrics->errors, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP sa_queries_cancelled_total Queries stopped by CANCEL or their timeout.\n"
+                 "# TYPE sa_queries_cancelled_total counter\n"
+                 "sa_queries_cancelled_total %lu\n",
+            (unsigned long)__atomic_load_n(&metrics->cancelled, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP sa_rows_scanned_total Store rows read by queries.\n"
+                 "# TYPE sa_rows_scanned_total counter\n"
+                 "sa_rows_scanned_total %lu\n",
+            (unsigned long)__atomic_load_n(&metrics->rows_scanned, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP sa_bytes_scanned_total Store bytes read by queries.\n"
+                 "# TYPE sa_bytes_scanned_total counter\n"
+                 "sa_bytes_scanned_total %lu\n",
+            (unsigned long)__atomic_load_n(&metrics->bytes_scanned, __ATOMIC_RELAXED));
+}
+
+/**
+ * Function: metrics_free
+ * ----------------------
+ * @brief  Frees the metrics.
+ *
+ * @param metrics The metrics to free.
+ *
+ */
+void metrics_free(metrics_t *metrics)
+{
+    if (metrics == NULL)
+        return;
+    for (int s = 0; s < METRICS_SHAPES; s++)
+        free(metrics->shapes[s]);
+    free(metrics);
+}
@@ -0,0 +1,62 @@
+/** @file metrics.h
+ *  @brief Function prototypes for the server's query metrics.
+ *
+ * Query latencies are recorded in microseconds into log-linear histograms
+ * in the style of HdrHistogram: values below METRICS_LINEAR have their own
+ * bucket, larger ones fall into one of 16 sub-buckets per power of two, so
+ * any recorded value is known to within about 6%. One histogram is kept per
+ * query shape (filter, order key, limit bucket). Recording is a few relaxed
+ * atomic adds, so query threads never wait on each other.
+ */
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define METRICS_LINEAR 32
+#define METRICS_SUB_BUCKETS 16
+#define METRICS_MAX_SHIFT 36
+#define METRICS_BUCKETS (METRICS_LINEAR + METRICS_MAX_SHIFT * METRICS_SUB_BUCKETS)
+#define METRICS_FILTERS 8
+#define METRICS_ORDERS 8
+#define METRICS_LIMITS 4
+#define METRICS_SHAPES (METRICS_FILTERS * METRICS_ORDERS * METRICS_LIMITS)
+
+/**
+ * @brief A latency histogram, in microseconds.
+ */
+typedef struct metrics_hist_t
+{
+    uint64_t counts[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+} metrics_hist_t;
+
+/**
+ * @brief All server metrics. Histograms are allocated on first use.
+ */
+typedef struct metrics_t
+{
+    metrics_hist_t *shapes[METRICS_SHAPES];
+    int64_t in_flight;
+    uint64_t errors;
+    uint64_t cancelled;
+    uint64_t rows_scanned;
+    uint64_t bytes_scanned;
+} metrics_t;
+
+/**
+ * Function protypes associated with the server metrics.
+ */
+metrics_t *metrics_new(void);
+int metrics_shape(const char *filter, const char *order_by, const char *limit);
+void metrics_record(metrics_t *metrics, int shape, uint64_t micros);
+void metrics_queue(metrics_t *metrics, int delta);
+void metrics_error(metrics_t *metrics);
+void metrics_cancelled(metrics_t *metrics);
+void metrics_scanned(metrics_t *metrics, uint64_t rows, uint64_t bytes);
+void metrics_write(metrics_t *metrics, FILE *out);
+void metrics_free(metrics_t *metrics);
+
+#endif
@@ -0,0 +1,543 @@
+/** @file prefix.c
+ *  @brief Implementation of the prefix (autocomplete) index.
+ *
+ * Entries (normalized name, streams, ref) are sorted by name. Names are
+ * front coded inside blocks of PREFIX_BLOCK entries, with the first entry of
+ * every block stored whole so blocks can be binary searched. A query finds
+ * the entry range [lo, hi) sharing the prefix, then runs a best-first search
+ * over the max-streams segment tree restricted to that range: tree nodes are
+ * expanded in order of their max, and the search stops once the best
+ * remaining node cannot beat the K-th result found so far.
+ *
+ * Layout of a written index (host byte order, each part padded to 8 bytes):
+ *
+ *   prefix_file_t
+ *   u64 streams[num_entries], u64 tree[2 * tree_leaves]
+ *   u32 refs[num_entries], u32 block_offsets[num_blocks + 1], name bytes
+ */
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "prefix.h"
+
+#define MAX_NAME 256
+
+/**
+ * @brief An entry being sorted during the build.
+ */
+typedef struct prefix_entry_t
+{
+    char *name;
+    uint64_t streams;
+    uint32_t ref;
+} prefix_entry_t;
+
+/**
+ * @brief The header of a written index.
+ */
+typedef struct prefix_file_t
+{
+    uint32_t num_entries;
+    uint32_t num_blocks;
+    uint32_t tree_leaves;
+    uint32_t num_bytes;
+} prefix_file_t;
+
+/**
+ * @brief A candidate result: an entry position and its stream count.
+ */
+typedef struct prefix_hit_t
+{
+    uint64_t streams;
+    uint32_t ref;
+} prefix_hit_t;
+
+static char *normalize(const char *s)
+{
+    size_t len = strnlen(s, MAX_NAME - 1);
+    char *copy = emalloc(len + 1);
+    for (size_t i = 0; i < len; i++)
+        copy[i] = (char)tolower((unsigned char)s[i]);
+    copy[len] = '\0';
+    return copy;
+}
+
+static int compare_entry(const void *a, const void *b)
+{
+    const prefix_entry_t *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    if (c != 0)
+        return c;
+    if (x->streams != y->streams)
+        return x->streams > y->streams ? -1 : 1;
+    return (x->ref > y->ref) - (x->ref < y->ref);
+}
+
+static void put_varint(unsigned char **p, uint32_t value)
+{
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        *(*p)++ = value != 0 ? byte | 0x80 : byte;
+    } while (value != 0);
+}
+
+static uint32_t get_varint(const unsigned char **p)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = *(*p)++;
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+/**
+ * @brief Decodes every name of block b into names, returns how many.
+ */
+static uint32_t decode_block(prefix_index_t *index, uint32_t b, char names[][MAX_NAME])
+{
+    const unsigned char *p = index->names + index->block_offsets[b];
+    uint32_t first = b * PREFIX_BLOCK;
+    uint32_t count = index->num_entries - first < PREFIX_BLOCK ? index->num_entries - first : PREFIX_BLOCK;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t shared = get_varint(&p);
+        uint32_t suffix = get_varint(&p);
+        if (i > 0)
+            memcpy(names[i], names[i - 1], shared);
+        memcpy(names[i] + shared, p, suffix);
+        names[i][shared + suffix] = '\0';
+        p += suffix;
+    }
+    return count;
+}
+
+/**
+ * @brief Compares the first entry of block b against the prefix.
+ */
+static int compare_block_first(prefix_index_t *index, uint32_t b, const char *prefix, size_t len)
+{
+    const unsigned char *p = index->names + index->block_offsets[b];
+    char name[MAX_NAME];
+    get_varint(&p);
+    uint32_t suffix = get_varint(&p);
+    memcpy(name, p, suffix);
+    name[suffix] = '\0';
+    return strncmp(name, prefix, len);
+}
+
+/**
+ * @brief Returns the first entry whose name compares >= target against the
+ *        prefix (target 0: lower bound, 1: end of the prefix range).
+ */
+static uint32_t find_bound(prefix_index_t *index, const char *prefix, size_t len, int target)
+{
+    char names[PREFIX_BLOCK][MAX_NAME];
+    uint32_t lo = 0, hi = index->num_blocks;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = compare_block_first(index, mid, prefix, len);
+        if ((c > 0 ? 1 : c < 0 ? -1 : 0) >= target)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0)
+        return 0;
+
+    uint32_t b = lo - 1;
+    uint32_t count = decode_block(index, b, names);
+    for (uint32_t i = 1; i < count; i++) {
+        int c = strncmp(names[i], prefix, len);
+        if ((c > 0 ? 1 : c < 0 ? -1 : 0) >= target)
+            return b * PREFIX_BLOCK + i;
+    }
+    return b * PREFIX_BLOCK + count;
+}
+
+static int hit_less(prefix_hit_t a, prefix_hit_t b)
+{
+    return a.streams < b.streams || (a.streams == b.streams && a.ref > b.ref);
+}
+
+/**
+ * @brief Offers a hit to the size-k min-heap of results.
+ */
+static void offer_hit(prefix_hit_t *heap, uint32_t *size, uint32_t k, prefix_hit_t hit)
+{
+    uint32_t i;
+
+    if (*size < k) {
+        i = (*size)++;
+        while (i > 0 && hit_less(hit, heap[(i - 1) / 2])) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = hit;
+        return;
+    }
+    if (!hit_less(heap[0], hit))
+        return;
+    i = 0;
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= *size)
+            break;
+        if (c + 1 < *size && hit_less(heap[c + 1], heap[c]))
+            c++;
+        if (!hit_less(heap[c], hit))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = hit;
+}
+
+/**
+ * @brief Pushes a tree node onto the max-heap of nodes ordered by tree max.
+ */
+static void push_node(prefix_index_t *index, uint32_t *heap, uint32_t *size, uint32_t node)
+{
+    uint32_t i = (*size)++;
+    while (i > 0 && index->tree[heap[(i - 1) / 2]] < index->tree[node]) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = node;
+}
+
+static uint32_t pop_node(prefix_index_t *index, uint32_t *heap, uint32_t *size)
+{
+    uint32_t top = heap[0];
+    uint32_t last = heap[--(*size)];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= *size)
+            break;
+        if (c + 1 < *size && index->tree[heap[c + 1]] > index->tree[heap[c]])
+            c++;
+        if (index->tree[heap[c]] <= index->tree[last])
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/**
+ * Function: prefix_build
+ * ----------------------
+ * @brief  Builds an index over n names.
+ *
+ * @param names The names to index (normalized to lower case internally).
+ * @param streams The stream count ranked for each name.
+ * @param n The number of names.
+ *
+ * @return prefix_index_t* The index; entry i is reported back as ref i.
+ *
+ */
+prefix_index_t *prefix_build(const char **names, const uint64_t *streams, uint32_t n)
+{
+    prefix_index_t *index = emalloc(sizeof(prefix_index_t));
+    prefix_entry_t *entries = emalloc((n + 1) * sizeof(prefix_entry_t));
+    size_t bytes = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        entries[i].name = normalize(names[i]);
+        entries[i].streams = streams[i];
+        entries[i].ref = i;
+        bytes += strlen(entries[i].name) + 10;
+    }
+    qsort(entries, n, sizeof(prefix_entry_t), compare_entry);
+
+    index->num_entries = n;
+    index->num_blocks = (n + PREFIX_BLOCK - 1) / PREFIX_BLOCK;
+    index->mapped = false;
+    index->names = emalloc(bytes + 1);
+    index->block_offsets = emalloc((index->num_blocks + 1) * sizeof(uint32_t));
+    index->streams = emalloc((n + 1) * sizeof(uint64_t));
+    index->refs = emalloc((n + 1) * sizeof(uint32_t));
+    index->tree_leaves = 1;
+    while (index->tree_leaves < index->num_blocks)
+        index->tree_leaves *= 2;
+    index->tree = emalloc(2 * index->tree_leaves * sizeof(uint64_t));
+    memset(index->tree, 0, 2 * index->tree_leaves * sizeof(uint64_t));
+
+    unsigned char *p = index->names;
+    for (uint32_t i = 0; i < n; i++) {
+        const char *name = entries[i].name;
+        size_t len = strlen(name);
+        uint32_t shared = 0;
+        uint32_t b = i / PREFIX_BLOCK;
+
+        if (i % PREFIX_BLOCK == 0) {
+            index->block_offsets[b] = (uint32_t)(p - index->names);
+        } else {
+            const char *prev = entries[i - 1].name;
+            while (shared < len && prev[shared] == name[shared])
+                shared++;
+        }
+        put_varint(&p, shared);
+        put_varint(&p, (uint32_t)(len - shared));
+        memcpy(p, name + shared, len - shared);
+        p += len - shared;
+
+        index->streams[i] = entries[i].streams;
+        index->refs[i] = entries[i].ref;
+        if (entries[i].streams > index->tree[index->tree_leaves + b])
+            index->tree[index->tree_leaves + b] = entries[i].streams;
+    }
+    index->block_offsets[index->num_blocks] = (uint32_t)(p - index->names);
+    for (uint32_t node = index->tree_leaves - 1; node > 0; node--)
+        index->tree[node] = index->tree[2 * node] > index->tree[2 * node + 1] ? index->tree[2 * node] : index->tree[2 * node + 1];
+
+    for (uint32_t i = 0; i < n; i++)
+        free(entries[i].name);
+    free(entries);
+    return index;
+}
+
+/**
+ * Function: prefix_top_k
+ * ----------------------
+ * @brief  Finds the k names with the most streams that start with prefix.
+ *
+ * @param index The index.
+ * @param prefix The typed text (matched case-insensitively).
+ * @param k The number of results wanted; out needs room for at most the
+ *          number of names in the index.
+ * @param out Receives up to k refs, most streams first; equal streams are
+ *            ordered by ascending ref.
+ *
+ * @return uint32_t The number of refs written to out.
+ *
+ */
+uint32_t prefix_top_k(prefix_index_t *index, const char *prefix, uint32_t k, uint32_t *out)
+{
+    char *norm = normalize(prefix);
+    size_t len = strlen(norm);
+    uint32_t lo = find_bound(index, norm, len, 0);
+    uint32_t hi = find_bound(index, norm, len, 1);
+    uint32_t num_hits = 0;
+    free(norm);
+
+    if (lo >= hi || k == 0)
+        return 0;
+    if (k > hi - lo)
+        k = hi - lo;
+
+    prefix_hit_t *hits = emalloc(k * sizeof(prefix_hit_t));
+    uint32_t *nodes = emalloc(4 * index->tree_leaves * sizeof(uint32_t));
+    uint32_t num_nodes = 0;
+
+    /* Start from the canonical tree nodes covering the blocks of [lo, hi) */
+    uint32_t l = lo / PREFIX_BLOCK + index->tree_leaves;
+    uint32_t r = (hi - 1) / PREFIX_BLOCK + index->tree_leaves + 1;
+    for (; l < r; l >>= 1, r >>= 1) {
+        if (l & 1)
+            push_node(index, nodes, &num_nodes, l++);
+        if (r & 1)
+            push_node(index, nodes, &num_nodes, --r);
+    }
+
+    while (num_nodes > 0) {
+        uint32_t node = pop_node(index, nodes, &num_nodes);
+        /* A node tying the k-th best may still hold a smaller ref, which wins the tie */
+        if (num_hits == k && index->tree[node] < hits[0].streams)
+            break;
+        if (node < index->tree_leaves) {
+            push_node(index, nodes, &num_nodes, 2 * node);
+            push_node(index, nodes, &num_nodes, 2 * node + 1);
+            continue;
+        }
+
+        uint32_t first = (node - index->tree_leaves) * PREFIX_BLOCK;
+        uint32_t last = first + PREFIX_BLOCK < hi ? first + PREFIX_BLOCK : hi;
+        for (uint32_t e = first > lo ? first : lo; e < last; e++) {
+            prefix_hit_t hit = {index->streams[e], index->refs[e]};
+            offer_hit(hits, &num_hits, k, hit);
+        }
+    }
+
+    /* Pop the min-heap from the back so out is ordered by descending streams */
+    for (uint32_t i = num_hits; i > 0; i--) {
+        uint32_t size = i;
+        out[i - 1] = hits[0].ref;
+        prefix_hit_t last = hits[size - 1];
+        size--;
+        uint32_t j = 0;
+        for (;;) {
+            uint32_t c = 2 * j + 1;
+            if (c >= size)
+                break;
+            if (c + 1 < size && hit_less(hits[c + 1], hits[c]))
+                c++;
+            if (!hit_less(hits[c], last))
+                break;
+            hits[j] = hits[c];
+            j = c;
+        }
+        if (size > 0)
+            hits[j] = last;
+    }
+
+    free(nodes);
+    free(hits);
+    return num_hits;
+}
+
+/**
+ * Function: prefix_matches
+ * ------------------------
+ * @brief  Tells whether a name starts with prefix, the way the index
+ *         compares them.
+ *
+ * @param name The name.
+ * @param prefix The typed text (matched case-insensitively).
+ *
+ * @return bool true if the name would be in the prefix's range.
+ *
+ */
+bool prefix_matches(const char *name, const char *prefix)
+{
+    size_t len = strnlen(prefix, MAX_NAME - 1);
+
+    for (size_t i = 0; i < len; i++)
+        if (name[i] == '\0' || tolower((unsigned char)name[i]) != tolower((unsigned char)prefix[i]))
+            return false;
+    return true;
+}
+
+static size_t padding(size_t len)
+{
+    return (8 - len % 8) % 8;
+}
+
+static void put_padded(FILE *out, const void *data, size_t len)
+{
+    static const unsigned char zeros[8] = {0};
+    if (len > 0)
+        fwrite(data, 1, len, out);
+    fwrite(zeros, 1, padding(len), out);
+}
+
+/**
+ * Function: prefix_write
+ * ----------------------
+ * @brief  Writes an index at the current (8-byte aligned) position of a file.
+ *
+ * @param index The index.
+ * @param out The file.
+ *
+ * @return int 0 on success, -1 if the file could not be written.
+ *
+ */
+int prefix_write(prefix_index_t *index, FILE *out)
+{
+    prefix_file_t header = {index->num_entries, index->num_blocks, index->tree_leaves,
+                            index->block_offsets[index->num_blocks]};
+
+    put_padded(out, &header, sizeof(header));
+    put_padded(out, index->streams, index->num_entries * sizeof(uint64_t));
+    put_padded(out, index->tree, 2 * index->tree_leaves * sizeof(uint64_t));
+    put_padded(out, index->refs, index->num_entries * sizeof(uint32_t));
+    put_padded(out, index->block_offsets, (index->num_blocks + 1) * sizeof(uint32_t));
+    put_padded(out, index->names, header.num_bytes);
+    return ferror(out) ? -1 : 0;
+}
+
+/**
+ * @brief Takes the next len bytes (and their padding) of a written index, or NULL past the end.
+ */
+static void *take(const unsigned char *data, size_t size, size_t *pos, size_t len)
+{
+    if (len > size - *pos)
+        return NULL;
+    const unsigned char *p = data + *pos;
+    len += padding(len);
+    *pos = len > size - *pos ? size : *pos + len;
+    return (void *)p;
+}
+
+/**
+ * Function: prefix_map
+ * --------------------
+ * @brief  Opens an index written by prefix_write in place, read-only.
+ *
+ * The index points into data, which must stay mapped until prefix_free.
+ *
+ * @param data The start of the written index, 8-byte aligned.
+ * @param size The bytes available from data on.
+ * @param used Set to the size of the written index.
+ *
+ * @return prefix_index_t* The index, or NULL if the data is truncated or inconsistent.
+ *
+ */
+prefix_index_t *prefix_map(const unsigned char *data, size_t size, size_t *used)
+{
+    prefix_file_t header;
+    size_t pos = 0;
+    const unsigned char *p = take(data, size, &pos, sizeof(header));
+    if (p == NULL)
+        return NULL;
+    memcpy(&header, p, sizeof(header));
+    if (header.num_blocks != (header.num_entries + PREFIX_BLOCK - 1) / PREFIX_BLOCK
+        || header.tree_leaves == 0 || header.tree_leaves < header.num_blocks
+        || (header.tree_leaves & (header.tree_leaves - 1)) != 0)
+        return NULL;
+
+    prefix_index_t *index = emalloc(sizeof(prefix_index_t));
+    index->mapped = true;
+    index->num_entries = header.num_entries;
+    index->num_blocks = header.num_blocks;
+    index->tree_leaves = header.tree_leaves;
+    index->streams = take(data, size, &pos, (size_t)header.num_entries * sizeof(uint64_t));
+    index->tree = take(data, size, &pos, 2 * (size_t)header.tree_leaves * sizeof(uint64_t));
+    index->refs = take(data, size, &pos, (size_t)header.num_entries * sizeof(uint32_t));
+    index->block_offsets = take(data, size, &pos, ((size_t)header.num_blocks + 1) * sizeof(uint32_t));
+    index->names = take(data, size, &pos, header.num_bytes);
+
+    if (index->streams == NULL || index->tree == NULL || index->refs == NULL || index->block_offsets == NULL
+        || index->names == NULL || index->block_offsets[header.num_blocks] != header.num_bytes) {
+        free(index);
+        return NULL;
+    }
+    *used = pos;
+    return index;
+}
+
+/**
+ * Function: prefix_free
+ * ---------------------
+ * @brief  Frees an index.
+ *
+ * A mapped index leaves the mapping alone.
+ *
+ * @param index The index to free.
+ *
+ */
+void prefix_free(prefix_index_t *index)
+{
+    if (index == NULL)
+        return;
+    if (index->mapped) {
+        free(index);
+        return;
+    }
+    free(index->names);
+    free(index->block_offsets);
+    free(index->streams);
+    free(index->refs);
+    free(index->tree);
+    free(index);
+}
@@ -0,0 +1,48 @@
+/** @file prefix.h
+ *  @brief Function prototypes for the prefix (autocomplete) index.
+ *
+ * The index keeps normalized names sorted and front coded in blocks of
+ * PREFIX_BLOCK entries. Every block is annotated with the largest stream
+ * count it holds, and a max segment tree over the blocks lets a top-K query
+ * visit only the blocks that can still beat the current K-th result.
+ *
+ * An index is either built in memory or mapped read-only from a file
+ * written by prefix_write.
+ */
+#ifndef _PREFIX_H_
+#define _PREFIX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PREFIX_BLOCK 16
+
+/**
+ * @brief A sorted, front-coded name index with per-block max streams.
+ */
+typedef struct prefix_index_t
+{
+    uint32_t num_entries;
+    uint32_t num_blocks;
+    unsigned char *names;
+    uint32_t *block_offsets;
+    uint64_t *streams;
+    uint32_t *refs;
+    uint64_t *tree;
+    uint32_t tree_leaves;
+    bool mapped;
+} prefix_index_t;
+
+/**
+ * Function protypes associated with the prefix index.
+ */
+prefix_index_t *prefix_build(const char **names, const uint64_t *streams, uint32_t n);
+uint32_t prefix_top_k(prefix_index_t *index, const char *prefix, uint32_t k, uint32_t *out);
+bool prefix_matches(const char *name, const char *prefix);
+int prefix_write(prefix_index_t *index, FILE *out);
+prefix_index_t *prefix_map(const unsigned char *data, size_t size, size_t *used);
+void prefix_free(prefix_index_t *index);
+
+#endif
@@ -0,0 +1,235 @@
+/** @file rowfmt.c
+ *  @brief Implementation of the fixed-width row export.
+ *
+ * Layout of a row file (host byte order, checked through the endian mark):
+ *
+ *   row_header_t
+ *   row_record_t records[num_records]   (8-byte aligned)
+ *   string heap                          (NUL-terminated strings)
+ *
+ * Records are read in place from the mapping; nothing is decoded until a
+ * caller asks for a node.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "rowfmt.h"
+
+/**
+ * Function: rows_write
+ * --------------------
+ * @brief  Writes every record of a list to a row file.
+ *
+ * @param path The file to create.
+ * @param list The records to store, in list order.
+ *
+ * @return int 0 on success, -1 if the file could not be written.
+ *
+ */
+int rows_write(const char *path, node_t *list)
+{
+    row_header_t header = {{0}};
+    uint32_t heap_size = 0;
+    FILE *out = fopen(path, "wb");
+
+    if (out == NULL)
+        return -1;
+
+    for (node_t *curr = list; curr != NULL; curr = curr->next)
+        header.num_records++;
+
+    memcpy(header.magic, ROW_MAGIC, 4);
+    header.version = ROW_VERSION;
+    header.endian_mark = ROW_ENDIAN_MARK;
+    header.record_size = sizeof(row_record_t);
+    header.records_offset = (sizeof(row_header_t) + 7) / 8 * 8;
+    header.heap_offset = header.records_offset + header.num_records * sizeof(row_record_t);
+
+    fwrite(&header, sizeof(header), 1, out);
+    fseek(out, (long)header.records_offset, SEEK_SET);
+    for (node_t *curr = list; curr != NULL; curr = curr->next) {
+        row_record_t record = {0};
+        record.streams = curr->streams;
+        record.in_spotify_playlists = curr->in_spotify_playlists;
+        record.in_apple_playlists = curr->in_apple_playlists;
+        record.date = curr->date;
+        record.artist_count = curr->artist_count;
+        record.track_name = heap_size;
+        heap_size += (uint32_t)strlen(node_track_name(curr)) + 1;
+        record.artist = heap_size;
+        heap_size += (uint32_t)strlen(node_artist(curr)) + 1;
+        fwrite(&record, sizeof(record), 1, out);
+    }
+    for (node_t *curr = list; curr != NULL; curr = curr->next) {
+        fwrite(node_track_name(curr), 1, strlen(node_track_name(curr)) + 1, out);
+        fwrite(node_artist(curr), 1, strlen(node_artist(curr)) + 1, out);
+    }
+
+    header.heap_size = heap_size;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+    int status = ferror(out) ? -1 : 0;
+    if (fclose(out) != 0)
+        status = -1;
+    return status;
+}
+
+/**
+ * Function: rows_open
+ * -------------------
+ * @brief  Maps a row file and validates its header and string offsets.
+ *
+ * Section bounds are checked without overflowing, and every string offset
+ * must fall inside the heap, whose last byte must be a NUL, so a corrupt
+ * file cannot make rows_string read past the mapping.
+ *
+ * @param path The row file to open.
+ *
+ * @return rows_t* The opened file, or NULL if it is missing, truncated,
+ *         corrupt, from another version, or written with a different byte
+ *         order or record layout.
+ *
+ */
+rows_t *rows_open(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(row_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    rows_t *rows = emalloc(sizeof(rows_t));
+    rows->base = base;
+    rows->size = (size_t)st.st_size;
+    rows->header = base;
+
+    const row_header_t *h = rows->header;
+    if (memcmp(h->magic, ROW_MAGIC, 4) != 0 || h->version != ROW_VERSION
+        || h->endian_mark != ROW_ENDIAN_MARK || h->record_size != sizeof(row_record_t)
+        || h->records_offset % 8 != 0 || h->heap_offset > rows->size || h->heap_size > rows->size - h->heap_offset
+        || h->records_offset > h->heap_offset
+        || h->num_records > (h->heap_offset - h->records_offset) / sizeof(row_record_t)
+        || (h->num_records > 0 && (h->heap_size == 0 || rows->base[h->heap_offset + h->heap_size - 1] != '\0'))) {
+        rows_close(rows);
+        return NULL;
+    }
+
+    rows->records = (const row_record_t *)(rows->base + h->records_offset);
+    rows->heap = (const char *)(rows->base + h->heap_offset);
+    for (uint64_t i = 0; i < h->num_records; i++) {
+        if (rows->records[i].track_name >= h->heap_size || rows->records[i].artist >= h->heap_size) {
+            rows_close(rows);
+            return NULL;
+        }
+    }
+    return rows;
+}
+
+/**
+ * Function: rows_close
+ * --------------------
+ * @brief  Unmaps a row file opened with rows_open.
+ *
+ * @param rows The row file to close.
+ *
+ */
+void rows_close(rows_t *rows)
+{
+    if (rows == NULL)
+        return;
+    munmap((void *)rows->base, rows->size);
+    free(rows);
+}
+
+/**
+ * Function: rows_string
+ * ---------------------
+ * @brief  Resolves a heap offset stored in a record.
+ *
+ * @param rows The row file.
+ * @param offset The heap offset.
+ *
+ * @return const char* The NUL-terminated string.
+ *
+ */
+const char *rows_string(rows_t *rows, uint32_t offset)
+{
+    return rows->heap + offset;
+}
+
+/**
+ * Function: rows_apply
+ * --------------------
+ * @brief  Applies a function to every record, in file order.
+ *
+ * @param rows The row file.
+ * @param fn The function to apply.
+ * @param arg The argument passed through to fn.
+ *
+ */
+void rows_apply(rows_t *rows, void (*fn)(rows_t *, const row_record_t *, void *), void *arg)
+{
+    const row_record_t *record = rows->records;
+    const row_record_t *end = record + rows->header->num_records;
+
+    for (; record != end; record++)
+        (*fn)(rows, record, arg);
+}
+
+/**
+ * Function: rows_to_node
+ * ----------------------
+ * @brief  Creates a node holding the numeric fields of a record.
+ *
+ * Strings are left empty until rows_fill_strings is called.
+ *
+ * @param rows The row file.
+ * @param record The record to convert.
+ *
+ * @return node_t* The new node, with row_id set to the record index.
+ *
+ */
+node_t *rows_to_node(rows_t *rows, const row_record_t *record)
+{
+    node_t *node = new_node();
+    node->artist_count = record->artist_count;
+    node->date = record->date;
+    node->in_spotify_playlists = (unsigned int)record->in_spotify_playlists;
+    node->streams = record->streams;
+    node->in_apple_playlists = (unsigned int)record->in_apple_playlists;
+    node->row_id = (unsigned int)(record - rows->records);
+    return node;
+}
+
+/**
+ * Function: rows_fill_strings
+ * ---------------------------
+ * @brief  Points a node at the track name and artist of its record.
+ *
+ * The strings are read in place from the mapped heap, so the row file must
+ * stay open while they are used.
+ *
+ * @param rows The row file the node was created from.
+ * @param node The node to fill, identified by its row_id.
+ * @param arena The arena the node's string references are allocated from.
+ *
+ */
+void rows_fill_strings(rows_t *rows, node_t *node, arena_t *arena)
+{
+    const row_record_t *record = &rows->records[node->row_id];
+
+    node_set_strings(node, arena, rows_string(rows, record->track_name), rows_string(rows, record->artist));
+}
@@ -0,0 +1,71 @@
+/** @file rowfmt.h
+ *  @brief Function prototypes for the fixed-width row export.
+ *
+ * A row file is laid out exactly like an in-memory array of row_record_t
+ * followed by a string heap, so mapping it yields a usable record array
+ * without any parsing.
+ */
+#ifndef _ROWFMT_H_
+#define _ROWFMT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "list.h"
+
+#define ROW_MAGIC "SARW"
+#define ROW_VERSION 1
+#define ROW_ENDIAN_MARK 0x01020304u
+
+/**
+ * @brief File header, stored at offset 0 of the row file.
+ */
+typedef struct row_header_t
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t endian_mark;
+    uint32_t record_size;
+    uint64_t num_records;
+    uint64_t records_offset;
+    uint64_t heap_offset;
+    uint64_t heap_size;
+} row_header_t;
+
+/**
+ * @brief A fixed-width song record. Strings are offsets into the heap.
+ */
+typedef struct row_record_t
+{
+    uint64_t streams;
+    uint64_t in_spotify_playlists;
+    uint64_t in_apple_playlists;
+    uint32_t date;
+    uint32_t artist_count;
+    uint32_t track_name;
+    uint32_t artist;
+} row_record_t;
+
+/**
+ * @brief An opened (memory-mapped) row file.
+ */
+typedef struct rows_t
+{
+    const unsigned char *base;
+    size_t size;
+    const row_header_t *header;
+    const row_record_t *records;
+    const char *heap;
+} rows_t;
+
+/**
+ * Function protypes associated with the row export.
+ */
+int rows_write(const char *path, node_t *list);
+rows_t *rows_open(const char *path);
+void rows_close(rows_t *rows);
+const char *rows_string(rows_t *rows, uint32_t offset);
+void rows_apply(rows_t *rows, void (*fn)(rows_t *, const row_record_t *, void *), void *arg);
+node_t *rows_to_node(rows_t *rows, const row_record_t *record);
+void rows_fill_strings(rows_t *rows, node_t *node, arena_t *arena);
+
+#endif
@@ -0,0 +1,714 @@
+/** @file server.c
+ *  @brief Implementation of the Unix socket query server.
+ *
+ * One thread runs an epoll loop over the listening socket and every
+ * connection. It reads request lines, answers the cheap ones itself and
+ * writes the responses back without blocking. Every other request becomes
+ * a task for a small pool of workers.
+ *
+ * A task runs on its own stack (a ucontext). When a long scan reaches a
+ * batch boundary (cancel_check calls server_yield) after using up its time
+ * slice while other work is waiting, its worker switches back to its own
+ * context, picks up that work and resumes the scan later. A task is only
+ * ever resumed by the worker that started it, so thread-local state stays
+ * valid across a switch. Each worker holds at most SERVER_TASKS_PER_WORKER
+ * started tasks; with at most SERVER_MAX_WORKERS workers that keeps the
+ * epoch slots held by suspended scans well below EPOCH_MAX_READERS.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "cancel.h"
+#include "emalloc.h"
+#include "server.h"
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE 4096
+
+/**
+ * @brief A client connection, owned by the event loop.
+ */
+typedef struct connection_t
+{
+    int fd;
+    char *in;
+    size_t in_len;
+    size_t in_cap;
+    char *out;
+    size_t out_len;
+    size_t out_pos;
+    size_t out_cap;
+    uint32_t events;
+    bool busy;
+    bool eof;
+    bool broken;
+    struct connection_t *next;
+} connection_t;
+
+struct worker_t;
+
+/**
+ * @brief A request answered off the event loop, with the stack it runs on.
+ */
+typedef struct task_t
+{
+    connection_t *conn;
+    char *request;
+    char *response;
+    size_t response_len;
+    ucontext_t context;
+    void *stack;
+    bool done;
+    struct timespec slice;
+    struct worker_t *worker;
+    struct task_t *next;
+} task_t;
+
+/**
+ * @brief A worker thread and the tasks it started but has not finished.
+ */
+typedef struct worker_t
+{
+    struct server_t *server;
+    ucontext_t context;
+    task_t *suspended;
+    task_t *suspended_tail;
+    int num_tasks;
+} worker_t;
+
+/**
+ * @brief The event loop's state and the queues shared with the workers.
+ */
+typedef struct server_t
+{
+    server_handler_t handler;
+    server_inline_t is_inline;
+    void *arg;
+    int epfd;
+    int wake;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    task_t *queue;
+    task_t *queue_tail;
+    int queued;
+    task_t *finished;
+    connection_t *closed;
+    worker_t workers[SERVER_MAX_WORKERS];
+} server_t;
+
+/*--The task the calling worker is running, if any--*/
+static __thread task_t *current_task = NULL;
+
+/**
+ * Function: elapsed_us
+ * --------------------
+ * @brief  Returns the microseconds from one time to another.
+ *
+ * @param from The earlier time.
+ * @param to The later time.
+ *
+ * @return long The difference.
+ *
+ */
+static long elapsed_us(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/**
+ * Function: task_main
+ * -------------------
+ * @brief  Answers a task's request into a memory buffer (runs on the task's stack).
+ *
+ * Returning switches back to the worker through uc_link.
+ *
+ */
+static void task_main(void)
+{
+    task_t *task = current_task;
+    server_t *server = task->worker->server;
+    FILE *out = open_memstream(&task->response, &task->response_len);
+    assert(out != NULL && "out == NULL");
+    server->handler(task->request, out, server->arg);
+    fputc('\n', out);
+    fclose(out);
+    task->done = true;
+}
+
+/**
+ * Function: run_task
+ * ------------------
+ * @brief  Starts or resumes a task until it finishes or yields.
+ *
+ * The stack is mapped lazily (MAP_NORESERVE) with a guard page below it.
+ *
+ * @param worker The calling worker.
+ * @param task The task.
+ *
+ */
+static void run_task(worker_t *worker, task_t *task)
+{
+    if (task->stack == NULL) {
+        task->stack = mmap(NULL, SERVER_STACK_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        assert(task->stack != MAP_FAILED && "stack == MAP_FAILED");
+        long page = sysconf(_SC_PAGESIZE);
+        mprotect(task->stack, (size_t)page, PROT_NONE);
+        getcontext(&task->context);
+        task->context.uc_stack.ss_sp = task->stack;
+        task->context.uc_stack.ss_size = SERVER_STACK_SIZE;
+        task->context.uc_link = &worker->context;
+        makecontext(&task->context, task_main, 0);
+    }
+    current_task = task;
+    clock_gettime(CLOCK_MONOTONIC, &task->slice);
+    swapcontext(&worker->context, &task->context);
+    current_task = NULL;
+}
+
+/**
+ * Function: server_yield
+ * ----------------------
+ * @brief  Lets other work run if the calling task has used up its time slice.
+ *
+ * Called at batch boundaries; does nothing outside a task, before the slice
+ * of SERVER_SLICE_US has passed, or when nothing else is waiting. Must not be
+ * called while holding a lock.
+ *
+ */
+void server_yield(void)
+{
+    task_t *task = current_task;
+    if (task == NULL)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_us(&task->slice, &now) < SERVER_SLICE_US)
+        return;
+
+    worker_t *worker = task->worker;
+    bool can_start = worker->num_tasks < SERVER_TASKS_PER_WORKER
+                     && __atomic_load_n(&worker->server->queued, __ATOMIC_RELAXED) > 0;
+    if (worker->suspended == NULL && !can_start) {
+        task->slice = now;
+        return;
+    }
+    swapcontext(&task->context, &worker->context);
+}
+
+/**
+ * Function: worker_main
+ * ---------------------
+ * @brief  Runs tasks until the process ends (thread body).
+ *
+ * New requests are started before suspended scans are resumed, so short
+ * requests overtake long ones; once the worker holds SERVER_TASKS_PER_WORKER
+ * tasks it only resumes, oldest first.
+ *
+ * @param p The worker_t.
+ *
+ * @return void* Does not return.
+ *
+ */
+static void *worker_main(void *p)
+{
+    worker_t *worker = p;
+    server_t *server = worker->server;
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (worker->suspended == NULL && server->queue == NULL)
+            pthread_cond_wait(&server->ready, &server->lock);
+        task_t *task;
+        if (server->queue != NULL && worker->num_tasks < SERVER_TASKS_PER_WORKER) {
+            task = server->queue;
+            server->queue = task->next;
+            if (server->queue == NULL)
+                server->queue_tail = NULL;
+            __atomic_store_n(&server->queued, server->queued - 1, __ATOMIC_RELAXED);
+            task->worker = worker;
+            worker->num_tasks++;
+        } else {
+            task = worker->suspended;
+            worker->suspended = task->next;
+            if (worker->suspended == NULL)
+                worker->suspended_tail = NULL;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        task->next = NULL;
+        run_task(worker, task);
+
+        if (!task->done) {
+            if (worker->suspended_tail != NULL)
+                worker->suspended_tail->next = task;
+            else
+                worker->suspended = task;
+            worker->suspended_tail = task;
+            continue;
+        }
+
+        munmap(task->stack, SERVER_STACK_SIZE);
+        task->stack = NULL;
+        worker->num_tasks--;
+        pthread_mutex_lock(&server->lock);
+        task->next = server->finished;
+        server->finished = task;
+        pthread_mutex_unlock(&server->lock);
+        uint64_t one = 1;
+        while (write(server->wake, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+/**
+ * Function: watch_events
+ * ----------------------
+ * @brief  Registers for the events a connection is waiting on.
+ *
+ * Reading stops once the client finished sending; writing is watched only
+ * while output is pending.
+ *
+ * @param server The server.
+ * @param conn The connection.
+ *
+ */
+static void watch_events(server_t *server, connection_t *conn)
+{
+    uint32_t events = 0;
+    if (!conn->eof)
+        events |= EPOLLIN;
+    if (conn->out_pos < conn->out_len)
+        events |= EPOLLOUT;
+    if (events == conn->events)
+        return;
+    struct epoll_event ev = {.events = events, .data.ptr = conn};
+    epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+}
+
+/**
+ * Function: append_output
+ * -----------------------
+ * @brief  Adds a response to a connection's pending output.
+ *
+ * @param conn The connection.
+ * @param data The response.
+ * @param len Its length.
+ *
+ */
+static void append_output(connection_t *conn, const char *data, size_t len)
+{
+    if (conn->out_pos == conn->out_len)
+        conn->out_pos = conn->out_len = 0;
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap == 0 ? SERVER_READ_SIZE : conn->out_cap;
+        while (cap < conn->out_len + len)
+            cap *= 2;
+        conn->out = erealloc(conn->out, cap);
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+}
+
+/**
+ * Function: flush_output
+ * ----------------------
+ * @brief  Writes as much pending output as the socket takes without blocking.
+ *
+ * @param conn The connection; marked broken if the write fails.
+ *
+ */
+static void flush_output(connection_t *conn)
+{
+    while (conn->out_pos < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->out_pos += (size_t)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                conn->broken = true;
+            return;
+        }
+    }
+}
+
+/**
+ * Function: queue_task
+ * --------------------
+ * @brief  Hands a request to the worker pool.
+ *
+ * @param server The server.
+ * @param conn The connection it came from; busy until the task finishes.
+ * @param request The request line (copied).
+ *
+ */
+static void queue_task(server_t *server, connection_t *conn, const char *request)
+{
+    task_t *task = emalloc(sizeof(task_t));
+    memset(task, 0, sizeof(task_t));
+    task->conn = conn;
+    task->request = estrdup(request);
+    conn->busy = true;
+
+    pthread_mutex_lock(&server->lock);
+    if (server->queue_tail != NULL)
+        server->queue_tail->next = task;
+    else
+        server->queue = task;
+    server->queue_tail = task;
+    __atomic_store_n(&server->queued, server->queued + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+/**
+ * Function: answer_inline
+ * -----------------------
+ * @brief  Answers a request on the event loop and queues the response.
+ *
+ * @param server The server.
+ * @param conn The connection.
+ * @param request The request line.
+ *
+ */
+static void answer_inline(server_t *server, connection_t *conn, char *request)
+{
+    char *response = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&response, &len);
+    assert(out != NULL && "out == NULL");
+    server->handler(request, out, server->arg);
+    fputc('\n', out);
+    fclose(out);
+    append_output(conn, response, len);
+    free(response);
+}
+
+/**
+ * Function: close_connection
+ * --------------------------
+ * @brief  Closes a connection's socket.
+ *
+ * The connection itself is freed after the current batch of events, which
+ * may still refer to it, and only once its task (if any) finished.
+ *
+ * @param server The server.
+ * @param conn The connection.
+ *
+ */
+static void close_connection(server_t *server, connection_t *conn)
+{
+    if (conn->fd >= 0) {
+        epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    if (!conn->busy) {
+        conn->next = server->closed;
+        server->closed = conn;
+    }
+}
+
+/**
+ * Function: process_requests
+ * --------------------------
+ * @brief  Answers the complete request lines received so far, in order.
+ *
+ * Stops at a request handed to the pool; the rest wait until it finished.
+ * Then writes what it can and closes the connection once it is done with.
+ *
+ * @param server The server.
+ * @param conn The connection.
+ *
+ */
+static void process_requests(server_t *server, connection_t *conn)
+{
+    while (!conn->busy && !conn->broken) {
+        char *nl = memchr(conn->in, '\n', conn->in_len);
+        if (nl == NULL)
+            break;
+        size_t used = (size_t)(nl - conn->in) + 1;
+        size_t len = used - 1;
+        while (len > 0 && conn->in[len - 1] == '\r')
+            len--;
+        conn->in[len] = '\0';
+
+        if (len > 0) {
+            if (server->is_inline(conn->in, server->arg))
+                answer_inline(server, conn, conn->in);
+            else
+                queue_task(server, conn, conn->in);
+        }
+        memmove(conn->in, conn->in + used, conn->in_len - used);
+        conn->in_len -= used;
+    }
+
+    flush_output(conn);
+    bool drained = conn->out_pos == conn->out_len && memchr(conn->in, '\n', conn->in_len) == NULL;
+    if (conn->broken || (!conn->busy && conn->eof && drained))
+        close_connection(server, conn);
+    else
+        watch_events(server, conn);
+}
+
+/**
+ * Function: read_requests
+ * -----------------------
+ * @brief  Reads what a client sent without blocking.
+ *
+ * At end of input an unterminated last line is completed, as a request.
+ *
+ * @param conn The connection.
+ *
+ */
+static void read_requests(connection_t *conn)
+{
+    for (;;) {
+        if (conn->in_cap - conn->in_len < SERVER_READ_SIZE) {
+            conn->in_cap = conn->in_cap == 0 ? 2 * SERVER_READ_SIZE : 2 * conn->in_cap;
+            conn->in = erealloc(conn->in, conn->in_cap);
+        }
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len - 1);
+        if (n > 0) {
+            conn->in_len += (size_t)n;
+        } else if (n == 0) {
+            conn->eof = true;
+            if (conn->in_len > 0 && conn->in[conn->in_len - 1] != '\n')
+                conn->in[conn->in_len++] = '\n';
+            return;
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                conn->broken = true;
+            return;
+        }
+    }
+}
+
+/**
+ * Function: finish_tasks
+ * ----------------------
+ * @brief  Sends the responses of the tasks the workers finished.
+ *
+ * @param server The server.
+ *
+ */
+static void finish_tasks(server_t *server)
+{
+    uint64_t count;
+    while (read(server->wake, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+    pthread_mutex_lock(&server->lock);
+    task_t *task = server->finished;
+    server->finished = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (task != NULL) {
+        task_t *next = task->next;
+        connection_t *conn = task->conn;
+        conn->busy = false;
+        if (conn->fd >= 0) {
+            append_output(conn, task->response, task->response_len);
+            process_requests(server, conn);
+        } else {
+            close_connection(server, conn);
+        }
+        free(task->response);
+        free(task->request);
+        free(task);
+        task = next;
+    }
+}
+
+/**
+ * Function: accept_clients
+ * ------------------------
+ * @brief  Accepts every pending connection and watches it for requests.
+ *
+ * @param server The server.
+ * @param fd The listening socket.
+ *
+ */
+static void accept_clients(server_t *server, int fd)
+{
+    for (;;) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+        connection_t *conn = emalloc(sizeof(connection_t));
+        memset(conn, 0, sizeof(connection_t));
+        conn->fd = client;
+        conn->events = EPOLLIN;
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, client, &ev) != 0) {
+            close(client);
+            free(conn);
+        }
+    }
+}
+
+/**
+ * Function: start_workers
+ * -----------------------
+ * @brief  Starts one worker per CPU, at least two and at most SERVER_MAX_WORKERS.
+ *
+ * Two workers at least, so a long scan yielding on one CPU still leaves a
+ * thread for new requests while the other waits on the kernel.
+ *
+ * @param server The server.
+ *
+ * @return int The number of workers started.
+ *
+ */
+static int start_workers(server_t *server)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int wanted = cpus < 2 ? 2 : cpus > SERVER_MAX_WORKERS ? SERVER_MAX_WORKERS : (int)cpus;
+    int started = 0;
+    for (int i = 0; i < wanted; i++) {
+        worker_t *worker = &server->workers[started];
+        worker->server = server;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_main, worker) != 0)
+            continue;
+        pthread_detach(thread);
+        started++;
+    }
+    return started;
+}
+
+static volatile sig_atomic_t stopping;
+static int stop_fd = -1;
+
+/**
+ * @brief Handles SIGINT and SIGTERM: flags the event loop to stop and wakes it.
+ */
+static void request_stop(int sig)
+{
+    uint64_t one = 1;
+    (void)sig;
+    stopping = 1;
+    ssize_t written = write(stop_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * Function: server_run
+ * --------------------
+ * @brief  Listens on a Unix socket and answers requests until SIGINT or SIGTERM.
+ *
+ * An existing file at path is removed first. Requests for which is_inline
+ * returns true are answered on the event loop, so they must be quick; the
+ * rest go to the worker pool, where long ones yield at batch boundaries.
+ * On a stop signal the socket is removed and server_run returns, so the
+ * process can exit normally; requests still running are abandoned.
+ *
+ * @param path The socket path.
+ * @param handler The function answering each request line.
+ * @param is_inline Tells which requests to answer on the event loop.
+ * @param arg Passed to handler and is_inline.
+ *
+ * @return int 0 after a stop signal, -1 if the server could not be set up.
+ *
+ */
+int server_run(const char *path, server_handler_t handler, server_inline_t is_inline, void *arg)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    static server_t server;
+    server.handler = handler;
+    server.is_inline = is_inline;
+    server.arg = arg;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    server.epfd = epoll_create1(EPOLL_CLOEXEC);
+    server.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    struct epoll_event wake = {.events = EPOLLIN, .data.ptr = &server};
+    if (server.epfd < 0 || server.wake < 0 || epoll_ctl(server.epfd, EPOLL_CTL_ADD, fd, &ev) != 0
+        || epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.wake, &wake) != 0 || start_workers(&server) == 0) {
+        close(fd);
+        return -1;
+    }
+
+    /*--A client hanging up mid-response must not kill the server--*/
+    signal(SIGPIPE, SIG_IGN);
+    cancel_set_hook(server_yield);
+
+    /*--A stop signal wakes the loop through the same eventfd the workers use--*/
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = request_stop;
+    sigemptyset(&stop.sa_mask);
+    stop_fd = server.wake;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!stopping) {
+        int n = epoll_wait(server.epfd, events, SERVER_MAX_EVENTS, -1);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_clients(&server, fd);
+            } else if (events[i].data.ptr == &server) {
+                finish_tasks(&server);
+            } else {
+                connection_t *conn = events[i].data.ptr;
+                if (conn->fd < 0)
+                    continue;
+                if (events[i].events & (EPOLLHUP | EPOLLERR))
+                    conn->broken = true;
+                else if (events[i].events & EPOLLIN)
+                    read_requests(conn);
+                process_requests(&server, conn);
+            }
+        }
+        while (server.closed != NULL) {
+            connection_t *conn = server.closed;
+            server.closed = conn->next;
+            free(conn->in);
+            free(conn->out);
+            free(conn);
+        }
+    }
+    close(fd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,36 @@
+/** @file server.h
+ *  @brief Function prototypes for the Unix socket query server.
+ *
+ * Clients send one request per line and receive the response followed by
+ * an empty line, so several requests can share a connection. Requests on
+ * one connection are answered in order, one at a time. SIGINT or SIGTERM
+ * stops the server.
+ */
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define SERVER_MAX_WORKERS 8
+#define SERVER_TASKS_PER_WORKER 4
+#define SERVER_STACK_SIZE (8 * 1024 * 1024)
+#define SERVER_SLICE_US 2000
+
+/**
+ * @brief Answers one request line by writing the response to out.
+ */
+typedef void (*server_handler_t)(char *request, FILE *out, void *arg);
+
+/**
+ * @brief Tells whether a request is cheap enough to answer on the event loop itself.
+ */
+typedef bool (*server_inline_t)(const char *request, void *arg);
+
+/**
+ * Function protypes associated with the query server.
+ */
+int server_run(const char *path, server_handler_t handler, server_inline_t is_inline, void *arg);
+void server_yield(void);
+
+#endif
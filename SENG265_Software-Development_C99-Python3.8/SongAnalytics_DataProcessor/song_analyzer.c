@@ -13,11 +13,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "list.h"
+#include "binfmt.h"
+#include "rowfmt.h"
+#include "trigram.h"
+#include "prefix.h"
+#include "stats.h"
+#include "watch.h"
+#include "epoch.h"
+#include "store.h"
+#include "server.h"
+#include "metrics.h"
+#include "cancel.h"
+#include "merge.h"
+#include "tseries.h"
+#include "utf8.h"
+#include "export.h"
 
 #define MAX_LINE_LEN 80
+#define OUTPUT_FILE "output.csv"
+#define OUTPUT_TMP "output.csv.tmp"
+#define SERVER_MAX_ARGS 32
+#define SERVER_INLINE_ROWS 4096
+#define MAX_OUTPUT_COLUMNS 16
+#define MAX_INPUTS 16
+#define PREFIX_DELTA_ROWS 4096
+
+/**
+ * @brief Columns that can be written to the output, see --columns.
+ */
+enum column_id
+{
+    COL_RELEASED,
+    COL_TRACK_NAME,
+    COL_ARTIST,
+    COL_ARTIST_COUNT,
+    COL_SPOTIFY,
+    COL_STREAMS,
+    COL_APPLE,
+    NUM_COLUMNS
+};
+
+/**
+ * @brief An output column: its header name and the data file fields it is written from.
+ */
+typedef struct column_t
+{
+    const char *name;
+    unsigned int fields;
+} column_t;
+
+static const column_t columns[NUM_COLUMNS] = {
+    {"released", FIELD_DATE},
+    {"track_name", FIELD_TRACK_NAME},
+    {"artist(s)_name", FIELD_ARTIST},
+    {"artist_count", FIELD_ARTIST_COUNT},
+    {"in_spotify_playlists", FIELD_SPOTIFY},
+    {"streams", FIELD_STREAMS},
+    {"in_apple_playlists", FIELD_APPLE},
+};
 
 /**
  * @brief Serves as an incremental counter for navigating the list.
@@ -45,14 +106,16 @@ void print_node(node_t *p, void *arg)
     char *fmt = NULL;
     char *date_fmt = "%Y-%m-%d";
     if(arg == NULL)
-        fmt = "%s,%s,%s,%u,%lu,%lu,%lu\n";
+        fmt = "%s,%s,%s,%u,%u,%lu,%u\n";
     else
         fmt = (char *)arg;
 
     char buffer[MAX_WORD_LEN];
-    strftime(buffer, sizeof(buffer), date_fmt, &p->date_);
+    struct tm date;
+    unpack_date(p->date, &date);
+    strftime(buffer, sizeof(buffer), date_fmt, &date);
 
-    printf(fmt, buffer, p->track_name, p->artist, p->artist_count,  
+    printf(fmt, buffer, node_track_name(p), node_artist(p), p->artist_count,  
            p->in_apple_playlists, p->streams, p->in_spotify_playlists);
 }
 
@@ -72,69 +135,410 @@ void analysis(node_t *l)
     apply(l, print_node, NULL);
 }
 
+/**
+ * @brief Command-line options for a single run.
+ */
+typedef struct options_t
+{
+    FILE *infile;
+    char *data;
+    FILE *inputs[MAX_INPUTS];
+    char *data_files[MAX_INPUTS];
+    int num_inputs;
+    char *presorted;
+    bool watch;
+    char *filter;
+    char *filter_value;
+    char *order_by_value;
+    char *order_by_direction;
+    char *limit;
+    char *cache;
+    char *save_cache;
+    char *cache_index;
+    char *rows;
+    char *save_rows;
+    char *save_history;
+    char *history;
+    char *snapshot;
+    char *track;
+    char *artist;
+    char *growth;
+    char *max_edits;
+    char *prefix;
+    char *prefix_on;
+    char *after;
+    char *stats;
+    char *group_by;
+    char *serve;
+    char *timeout;
+    char *id;
+    bool count;
+    bool exists;
+    char *columns;
+    unsigned int fields;
+    unsigned long invalid_rows;
+} options_t;
+
+/**
+ * @brief Where loaded records came from, for decoding their strings on demand.
+ *
+ * At most one of bin, rows and snap is set. Records parsed from CSV already hold their strings,
+ * copied into the arena; decoded strings and string references are allocated from it too.
+ * filtered is set when a fuzzy filter was already answered from a name index while loading, and
+ * ranked when the records already are the result of the prefix search, in order.
+ */
+typedef struct source_t
+{
+    bin_t *bin;
+    rows_t *rows;
+    const store_snapshot_t *snap;
+    arena_t *arena;
+    bool filtered;
+    bool ranked;
+} source_t;
+
+/**
+ * @brief A running server query that can be cancelled by its --id.
+ */
+typedef struct running_t
+{
+    const char *id;
+    cancel_t *cancel;
+    struct running_t *next;
+} running_t;
+
+/**
+ * @brief The server's name indexes over the rows of store.
+ *
+ * The ingester adds rows to the fuzzy indexes under the write lock before publishing them, so a
+ * snapshot of store never holds a row they do not know. The prefix indexes cover the first
+ * prefix_rows rows only and are rebuilt once enough rows were appended after them; queries scan
+ * the rows past prefix_rows. Queries search under the read lock.
+ */
+typedef struct names_t
+{
+    pthread_rwlock_t lock;
+    const store_t *store;
+    trigram_index_t *artists;
+    trigram_index_t *tracks;
+    prefix_index_t *track_prefix;
+    prefix_index_t *artist_prefix;
+    uint64_t prefix_rows;
+} names_t;
+
+/**
+ * @brief State shared by the server's query workers and its ingester.
+ *
+ * Only the ingester touches the data file fields and writes to the store. A reload replaces the
+ * store, so queries load the pointer atomically inside an epoch.
+ */
+typedef struct server_state_t
+{
+    options_t *opts;
+    epoch_t *epoch;
+    store_t *store;
+    metrics_t *metrics;
+    long consumed;
+    uint64_t fingerprint;
+    char *line;
+    arena_t *arena;
+    pthread_mutex_t running_lock;
+    running_t *running;
+    names_t names;
+} server_state_t;
+
+/**
+ * @brief State threaded through rows_apply while collecting matching records.
+ */
+typedef struct collect_t
+{
+    char *filter;
+    char *filter_value;
+    node_t *head;
+    node_t *tail;
+} collect_t;
+
 /** [1]
  * @brief Parses command-line arguments.
  *
- * This function parses command-line arguments and assigns them to the appropriate variables.
+ * This function parses command-line arguments and assigns them to the appropriate fields of `opts`.
+ *
+ * With `open_inputs` false (server requests), --data is only recorded in `data` and no file is
+ * opened, so a request can be rejected without touching the file system.
  *
  * @param argc The number of command-line arguments.
  * @param argv The array of command-line arguments.
- * @param infile Pointer to the input file pointer.
- * @param filter Pointer to the filter string.
- * @param filter_value Pointer to the filter value string.
- * @param order_by_value Pointer to the order by value string.
- * @param order_by_direction Pointer to the order by direction string.
- * @param limit Pointer to the limit string.
+ * @param opts Pointer to the options to fill.
+ * @param open_inputs Whether to open the --data files.
+ * @return int 0 on success, -1 if an argument is not valid.
  */
-void parse_arguments(int argc, char *argv[], FILE **infile, char **filter, char **filter_value,\
-                char **order_by_value, char **order_by_direction, char **limit)
+int parse_arguments(int argc, char *argv[], options_t *opts, bool open_inputs)
 {
     char *token = NULL;
+    char *save = NULL;
     for(int i = 1; i < argc; i++) 
     {
-        token = strtok(argv[i], "\"= ");
+        token = strtok_r(argv[i], "\"= ", &save);
         // printf("Token: %s\n", token);
+        if (token == NULL)
+        {
+            printf("Error: argument %d is empty.\n", i);
+            return -1;
+        }
     
         if (strcmp(token, "--data") == 0)
         {
-            token = strtok(NULL, "\"");
-            *infile = fopen(token, "r");
-            if (*infile == NULL) {
+            token = strtok_r(NULL, "\"", &save);
+            if (!open_inputs) {
+                opts->data = token != NULL ? token : "";
+                continue;
+            }
+            if (token == NULL) {
+                printf("Error: --data needs a file name.\n");
+                return -1;
+            }
+            if (opts->num_inputs == MAX_INPUTS) {
+                printf("Error: at most %d --data files can be given.\n", MAX_INPUTS);
+                return -1;
+            }
+            FILE *infile = fopen(token, "r");
+            if (infile == NULL) {
                 printf("Error: could not open file '%s'\n", token);
-                exit(1);
+                return -1;
+            }
+            opts->inputs[opts->num_inputs] = infile;
+            opts->data_files[opts->num_inputs++] = token;
+            if (opts->infile == NULL) {
+                opts->infile = infile;
+                opts->data = token;
             }
         }
+        else if (strcmp(token, "--presorted") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->presorted = token;
+        }
+        else if (strcmp(token, "--watch") == 0)
+        {
+            opts->watch = true;
+        }
         else if(strcmp(token, "--filter") == 0) 
         {
-            token = strtok(NULL, "\"");
-            *filter = token;
+            token = strtok_r(NULL, "\"", &save);
+            opts->filter = token;
         }
         else if (strcmp(token, "--value") == 0)
         {
-            token = strtok(NULL, "\"");
-            *filter_value = token;
+            token = strtok_r(NULL, "\"", &save);
+            opts->filter_value = token;
         }
         else if (strcmp(token, "--order_by") == 0)
         {
-            token = strtok(NULL, "\"");
-            *order_by_value = token;
+            token = strtok_r(NULL, "\"", &save);
+            opts->order_by_value = token;
         }
         else if (strcmp(token, "--order") == 0)
         {
-            token = strtok(NULL, "\"");
-            *order_by_direction = token;
+            token = strtok_r(NULL, "\"", &save);
+            opts->order_by_direction = token;
         }
         else if (strcmp(token, "--limit") == 0)
         {
-            token = strtok(NULL, "\"");
-            *limit = token;
+            token = strtok_r(NULL, "\"", &save);
+            opts->limit = token;
+        }
+        else if (strcmp(token, "--cache") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->cache = token;
+        }
+        else if (strcmp(token, "--save_cache") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->save_cache = token;
+        }
+        else if (strcmp(token, "--cache_index") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->cache_index = token;
+        }
+        else if (strcmp(token, "--rows") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->rows = token;
+        }
+        else if (strcmp(token, "--save_rows") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->save_rows = token;
+        }
+        else if (strcmp(token, "--save_history") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->save_history = token;
+        }
+        else if (strcmp(token, "--history") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->history = token;
+        }
+        else if (strcmp(token, "--snapshot") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->snapshot = token;
+        }
+        else if (strcmp(token, "--track") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->track = token;
+        }
+        else if (strcmp(token, "--artist") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->artist = token;
+        }
+        else if (strcmp(token, "--growth") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->growth = token;
+        }
+        else if (strcmp(token, "--max_edits") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->max_edits = token;
+        }
+        else if (strcmp(token, "--prefix") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->prefix = token != NULL ? token : "";
+        }
+        else if (strcmp(token, "--prefix_on") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->prefix_on = token;
+        }
+        else if (strcmp(token, "--after") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->after = token;
+        }
+        else if (strcmp(token, "--stats") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->stats = token;
+        }
+        else if (strcmp(token, "--group_by") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->group_by = token;
+        }
+        else if (strcmp(token, "--serve") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->serve = token;
+        }
+        else if (strcmp(token, "--timeout") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->timeout = token;
+        }
+        else if (strcmp(token, "--id") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->id = token;
+        }
+        else if (strcmp(token, "--columns") == 0)
+        {
+            token = strtok_r(NULL, "\"", &save);
+            opts->columns = token;
+        }
+        else if (strcmp(token, "--count") == 0)
+        {
+            opts->count = true;
+        }
+        else if (strcmp(token, "--exists") == 0)
+        {
+            opts->exists = true;
         }
         else
         {
             printf("Error: argument: '%s' not valid.\n", token);
-	        exit(1);
+            return -1;
         }
     }
+    return 0;
+}
+
+/**
+ * @brief Closes every --data file.
+ *
+ * @param opts The options of the run.
+ */
+void close_inputs(options_t *opts)
+{
+    for(int i = 0; i < opts->num_inputs; i++)
+        fclose(opts->inputs[i]);
+    opts->num_inputs = 0;
+    opts->infile = NULL;
+}
+
+/**
+ * @brief Reads a --cache_index list into the BIN_INDEX_* bits of the indexes to write with the cache.
+ *
+ * @param list The comma-separated index names, modified in place.
+ * @param indexes Set to the bits of the named indexes.
+ * @return int 0 on success, -1 if the list is empty or a name is not valid.
+ */
+int parse_cache_index(char *list, unsigned int *indexes)
+{
+    char *save = NULL;
+    *indexes = 0;
+    for(char *name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if(strcmp(name, "FUZZY")==0)
+            *indexes |= BIN_INDEX_FUZZY;
+        else if(strcmp(name, "PREFIX")==0)
+            *indexes |= BIN_INDEX_PREFIX;
+        else
+            return -1;
+    }
+    return *indexes != 0 ? 0 : -1;
+}
+
+/**
+ * @brief Checks that a --limit value is a whole number from 1 to INT_MAX.
+ *
+ * @param limit The --limit value.
+ * @return bool True if the value is valid.
+ */
+bool valid_limit(const char *limit)
+{
+    char *end;
+    errno = 0;
+    long value = strtol(limit, &end, 10);
+    return end != limit && *end == '\0' && errno == 0 && value > 0 && value <= INT_MAX;
+}
+
+/**
+ * @brief Checks if a run converts the data file: --save_cache, --save_rows or --save_history.
+ *
+ * @param opts The options of the run.
+ * @return bool True if the whole data file is read and saved instead of queried.
+ */
+bool is_conversion(options_t *opts)
+{
+    return opts->save_cache != NULL || opts->save_rows != NULL || opts->save_history != NULL;
+}
+
+/**
+ * @brief Reports the data rows dropped since the last report because they are not valid UTF-8.
+ *
+ * @param opts The options of the run; the count is reset.
+ */
+void report_invalid_rows(options_t *opts)
+{
+    if(opts->invalid_rows > 0)
+        printf("Skipped %lu rows that are not valid UTF-8.\n", opts->invalid_rows);
+    opts->invalid_rows = 0;
 }
 
 /** [1]
@@ -143,28 +547,40 @@ void parse_arguments(int argc, char *argv[], FILE **infile, char **filter, char
  * This function tokenizes a line of input based on commas. It handles cases where a token is split across two lines.
  * It fills the fields of a `node_t` record with the parsed tokens. The specific fields that are filled depend on the value of `order_by_value`.
  * If a token is split across two lines, the function reads the next line from the file to complete the token.
+ * Only the fields in `fields` are converted; the others are cleared.
+ *
+ * Every piece of the line is checked to be valid UTF-8 as it is read. A token longer than the
+ * buffer is cut at a character boundary instead of overflowing it.
  *
  * @param record Pointer to the `node_t` record to be filled.
  * @param line Pointer to the line of input to be parsed.
  * @param file Pointer to the file to read from if a token is split across two lines.
+ * @param fields The FIELD_* bits of the fields the query uses.
+ * @param arena The arena to copy the strings into.
+ * @return bool False if the line is not valid UTF-8; the record should then be dropped.
  */
-void fill_record(node_t *record, char *line, FILE *file)
+bool fill_record(node_t *record, char *line, FILE *file, unsigned int fields, arena_t *arena)
 {
     char buffer[200];
     char *p_buffer = NULL;
     bool is_final_token=false;
+    bool truncated = false;
     unsigned int token_count = 0; 
     char *token=NULL;
     int chars_read=0;
     bool line_starts_with_comma = line[0] == ',';
     bool line_ends_with_comma = line[strlen(line)-1] == ',';
+    utf8_state_t utf8;
+
+    utf8_init(&utf8);
+    utf8_feed(&utf8, line, strlen(line));
 
     if(line_starts_with_comma) 
     {   
         token = ""; // an empty string
         chars_read += 1;
         line = line+1;
-        fill_node(record, token, token_count++);
+        fill_node_fields(record, token, token_count++, fields, arena);
     }
     
     while(!is_final_token && token_count<9) {
@@ -172,7 +588,7 @@ void fill_record(node_t *record, char *line, FILE *file)
         /*----Check For Line Split Leaving Comma at Start----*/
         if(line[0]==',') {
             memmove(&line[0], &line[1], strlen(line)); // remove comma, shift left
-            fill_node(record, p_buffer, token_count++); // fill last complete token from buffer
+            fill_node_fields(record, p_buffer, token_count++, fields, arena); // fill last complete token from buffer
             p_buffer = NULL;
         }
 
@@ -181,7 +597,8 @@ void fill_record(node_t *record, char *line, FILE *file)
             
             char* tokenEnd = strtok(line, ",");
             chars_read = strlen(tokenEnd)+1; // characters read in current fgets call
-            token = strcat(buffer, tokenEnd); // complete the token
+            utf8_append(buffer, sizeof(buffer), tokenEnd, &truncated); // complete the token
+            token = buffer;
             p_buffer = NULL; 
         }else { // Complete Token
             token = strtok(line, ",");
@@ -193,13 +610,16 @@ void fill_record(node_t *record, char *line, FILE *file)
             // first token is good, input into record, increment token_count post call.
             // only output if read tokens up to MAX_LINE_LEN or the last token in line has '\n'
             if(chars_read < MAX_LINE_LEN || token[strlen(token)-1]=='\n') {
-                fill_node(record, token, token_count++);
+                fill_node_fields(record, token, token_count++, fields, arena);
             }
             // Check if outputted the last token in 
             if(token[strlen(token)-1]=='\n') {
                 is_final_token = true;
             }
-            strcpy(buffer, token); // update buffer incase incomplete token
+            if(token != buffer) { // update buffer incase incomplete token
+                strcpy(buffer, token);
+                truncated = false;
+            }
             token = strtok(NULL, ","); // update token
             
             if(token!=NULL) {
@@ -210,9 +630,11 @@ void fill_record(node_t *record, char *line, FILE *file)
         if(!is_final_token && buffer[0]!='\0')  // last token didn't contain newline, and the buffer has contents
         {
             p_buffer = buffer;
-            fgets(line, MAX_LINE_LEN, file); // retrieve next part of the record
+            if(fgets(line, MAX_LINE_LEN, file) != NULL) // retrieve next part of the record
+                utf8_feed(&utf8, line, strlen(line));
         }
     }
+    return utf8_complete(&utf8);
 }
 
 /** 
@@ -241,15 +663,209 @@ void print_variables(char *filter, char *filter_value, char *order_by_value,
 bool is_filter(node_t *record, char *filter, char *filter_value)
 {
     if(strcmp(filter, "ARTIST")==0) 
-        return strstr(record->artist, filter_value)!=NULL? true : false;
+        return strstr(node_artist(record), filter_value)!=NULL? true : false;
+
+    else if(strcmp(filter, "ARTIST_IS")==0)
+        return artist_has_token(node_artist(record), filter_value);
+
+    else if(strcmp(filter, "YEAR")==0)    // the year is stored above the 9 bits of month and day.
+        return atoi(filter_value) == (int)(record->date >> 9);
+
+    else
+        return false;
+}
 
-    else if(strcmp(filter, "YEAR")==0)    // tm_year value is years since 1900.
-        return atoi(filter_value)-1900 == record->date_.tm_year; 
+/**
+ * @brief Decodes the strings of a record loaded from a cache, row file or store.
+ *
+ * @param src Where the record came from.
+ * @param node The record.
+ */
+void fill_strings(source_t *src, node_t *node)
+{
+    if(node->strings != NULL)
+        return;
+    if(src->bin != NULL)
+        bin_fill_strings(src->bin, node, src->arena);
+    else if(src->rows != NULL)
+        rows_fill_strings(src->rows, node, src->arena);
+    else if(src->snap != NULL)
+        store_fill_strings(src->snap, node, src->arena);
+}
 
+/**
+ * @brief Checks if a mapped row record matches a filter.
+ *
+ * Applies the same rules as `is_filter`, reading the record in place. A NULL filter matches every record.
+ *
+ * @param rows The row file being scanned.
+ * @param record The record to check.
+ * @param filter The type of filter, or NULL.
+ * @param filter_value The value to filter by.
+ * @return bool True if the record matches the filter.
+ */
+bool row_matches(rows_t *rows, const row_record_t *record, char *filter, char *filter_value)
+{
+    if(filter == NULL)
+        return true;
+    else if(strcmp(filter, "ARTIST")==0)
+        return strstr(rows_string(rows, record->artist), filter_value)!=NULL;
+    else if(strcmp(filter, "ARTIST_IS")==0)
+        return artist_has_token(rows_string(rows, record->artist), filter_value);
+    else if(strcmp(filter, "YEAR")==0)
+        return (int)(record->date >> 9) == atoi(filter_value);
     else
         return false;
 }
 
+/**
+ * @brief Adds a mapped row record to the collected list if it matches the filter.
+ *
+ * @param rows The row file being scanned.
+ * @param record The record to check.
+ * @param arg Pointer to the `collect_t` state.
+ */
+void collect_row(rows_t *rows, const row_record_t *record, void *arg)
+{
+    collect_t *c = (collect_t *)arg;
+
+    if(!row_matches(rows, record, c->filter, c->filter_value))
+        return;
+
+    node_t *node = rows_to_node(rows, record);
+    if(c->tail == NULL)
+        c->head = node;
+    else
+        c->tail->next = node;
+    c->tail = node;
+}
+
+/**
+ * @brief Keeps the records whose artist or track name fuzzily contains a value.
+ *
+ * Builds a trigram index over the distinct names in the list, then keeps the records whose name
+ * contains `filter_value` within `max_edits` edits (case-insensitive). Strings of records loaded
+ * from a binary cache, row file or store are decoded first. Records that do not match are freed.
+ *
+ * @param list The records to filter.
+ * @param filter "FUZZY_ARTIST" or "FUZZY_TRACK".
+ * @param filter_value The text to look for.
+ * @param max_edits The largest edit distance accepted.
+ * @param src Where the records came from.
+ * @return node_t* The matching records, in their original order.
+ */
+node_t *fuzzy_filter(node_t *list, char *filter, char *filter_value, int max_edits, source_t *src)
+{
+    bool by_track = strcmp(filter, "FUZZY_TRACK")==0;
+    if(!by_track && strcmp(filter, "FUZZY_ARTIST")!=0) {
+        printf("Error: filter '%s' not valid.\n", filter);
+        exit(1);
+    }
+
+    int len = 0;
+    apply(list, inccounter, &len);
+    uint32_t *ids = malloc(sizeof(uint32_t) * (len + 1));
+    trigram_index_t *index = trigram_new();
+    int i = 0;
+    for(node_t *node = list; node != NULL; node = node->next) {
+        fill_strings(src, node);
+        ids[i++] = trigram_add(index, by_track ? node_track_name(node) : node_artist(node));
+    }
+
+    uint32_t *matches = malloc(sizeof(uint32_t) * (index->num_strings + 1));
+    bool *matched = calloc(index->num_strings + 1, sizeof(bool));
+    uint32_t num_matches = trigram_search(index, filter_value, max_edits, matches);
+    for(uint32_t m = 0; m < num_matches; m++)
+        matched[matches[m]] = true;
+
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    i = 0;
+    while(list != NULL) {
+        node_t *next = list->next;
+        if(matched[ids[i++]]) {
+            list->next = NULL;
+            if(tail == NULL)
+                head = list;
+            else
+                tail->next = list;
+            tail = list;
+        } else {
+            free(list);
+        }
+        list = next;
+    }
+
+    free(matched);
+    free(matches);
+    free(ids);
+    trigram_free(index);
+    return head;
+}
+
+/**
+ * @brief Returns the top `k` records by streams whose track name (or artist) starts with `prefix`.
+ *
+ * Builds a sorted, front-coded prefix index over the names in the list and asks it for the
+ * best `k` matches, so only blocks that can still beat the current results are visited.
+ * Records that are not returned are freed.
+ *
+ * @param list The records to search.
+ * @param prefix The typed text (case-insensitive).
+ * @param on_artist Search artist names instead of track names.
+ * @param k The number of results wanted.
+ * @param src Where the records came from.
+ * @return node_t* The matching records, most streams first.
+ */
+node_t *prefix_search(node_t *list, char *prefix, bool on_artist, int k, source_t *src)
+{
+    int len = 0;
+    apply(list, inccounter, &len);
+
+    node_t **nodes = malloc(sizeof(node_t *) * (len + 1));
+    const char **names = malloc(sizeof(char *) * (len + 1));
+    uint64_t *streams = malloc(sizeof(uint64_t) * (len + 1));
+    int i = 0;
+    for(node_t *node = list; node != NULL; node = node->next) {
+        fill_strings(src, node);
+        nodes[i] = node;
+        names[i] = on_artist ? node_artist(node) : node_track_name(node);
+        streams[i] = node->streams;
+        i++;
+    }
+
+    prefix_index_t *index = prefix_build(names, streams, (uint32_t)len);
+    if(k < 0 || k > len)
+        k = k < 0 ? 0 : len;
+    uint32_t *refs = malloc(sizeof(uint32_t) * (k + 1));
+    uint32_t num_refs = prefix_top_k(index, prefix, (uint32_t)k, refs);
+
+    bool *keep = calloc(len + 1, sizeof(bool));
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    for(uint32_t r = 0; r < num_refs; r++) {
+        node_t *node = nodes[refs[r]];
+        keep[refs[r]] = true;
+        node->next = NULL;
+        if(tail == NULL)
+            head = node;
+        else
+            tail->next = node;
+        tail = node;
+    }
+    for(i = 0; i < len; i++)
+        if(!keep[i])
+            free(nodes[i]);
+
+    free(keep);
+    free(refs);
+    prefix_free(index);
+    free(streams);
+    free(names);
+    free(nodes);
+    return head;
+}
+
 /** [1]
  * @brief Returns a comparison function based on order_by_value.
  *
@@ -266,186 +882,2329 @@ int (*get_compare(char *order_by_value))(node_t *, node_t *, int) {
 
     else if (strcmp(order_by_value, "NO_SPOTIFY_PLAYLISTS") == 0) 
         return compare_by_spotify_playlists;
+
+    else if (strcmp(order_by_value, "TRACK_NAME") == 0) 
+        return compare_by_track_name;
+
+    else if (strcmp(order_by_value, "ARTIST") == 0) 
+        return compare_by_artist;
         
     else 
         return NULL;
     
 }
 
+/**
+ * @brief Returns the value a node is sorted by.
+ *
+ * @param node The node.
+ * @param order_by_value The sort column.
+ * @return unsigned long The node's value in that column.
+ */
+unsigned long sort_key(node_t *node, char *order_by_value)
+{
+    if(strcmp(order_by_value, "NO_APPLE_PLAYLISTS")==0)
+        return node->in_apple_playlists;
+    else if(strcmp(order_by_value, "NO_SPOTIFY_PLAYLISTS")==0)
+        return node->in_spotify_playlists;
+    else
+        return node->streams;
+}
+
+/**
+ * @brief Drops the records that sort at or before a keyset cursor.
+ *
+ * The cursor has the form "<sort key>,<row id>" and names the last record of the previous page.
+ * Records are kept if they come strictly after it in the order of comes_after. Dropped records are freed.
+ *
+ * @param list The records to filter.
+ * @param after The cursor string.
+ * @param compare The comparison function for the sort column.
+ * @param order 1 for ascending, -1 for descending.
+ * @return node_t* The records after the cursor, in their original order.
+ */
+node_t *after_cursor(node_t *list, char *after, int (*compare)(node_t *, node_t *, int), int order)
+{
+    char *end = NULL;
+    node_t cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    unsigned long key = strtoul(after, &end, 10);
+    cursor.streams = key;
+    cursor.in_spotify_playlists = cursor.in_apple_playlists = (unsigned int)key;
+    if(end == NULL || *end != ',') {
+        printf("Error: --after expects '<sort key>,<row id>', got '%s'\n", after);
+        exit(1);
+    }
+    cursor.row_id = (unsigned int)strtoul(end + 1, NULL, 10);
+
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    while(list != NULL) {
+        node_t *next = list->next;
+        if(comes_after(list, &cursor, compare, order)) {
+            list->next = NULL;
+            if(tail == NULL)
+                head = list;
+            else
+                tail->next = list;
+            tail = list;
+        } else {
+            free(list);
+        }
+        list = next;
+    }
+    return head;
+}
+
+/** [1]
+ * @brief Frees a singly linked list.
+ *
+ * Iterates over the list, freeing each node. Sets `next` of each node to `NULL` before freeing.
+ *
+ * @param list Pointer to the head of the list.
+ */
+void free_list(node_t *list) {
+    node_t *temp;
+
+    while (list != NULL) {
+        temp = list;
+        list = list->next;
+        free(temp);
+    }
+}
+
 /** [1]
  * @brief Orders a list based on a comparison function.
  *
+ * `add_inorder` inserts a copy of each node, so the nodes of `list` are freed as they are inserted.
+ * Every insertion walks the sorted list, so the cancellation token is checked before each one; when
+ * it fires, everything is freed and NULL is returned.
+ *
  * @param list The list to order.
  * @param order_by_direction The direction to order the list in.
  * @param compare The comparison function to use.
+ * @param cancel The cancellation token, or NULL.
  * @return node_t* Pointer to the head of the ordered list.
  */
-node_t *order_list(node_t *list, char *order_by_direction, int (*compare)(node_t *, node_t *, int))
+node_t *order_list(node_t *list, char *order_by_direction, int (*compare)(node_t *, node_t *, int), cancel_t *cancel)
 {
     int order = strcmp(order_by_direction, "DES") == 0 ? -1 : 1;
     node_t *sorted_list = NULL;
     node_t *node = list;
     while (node != NULL) 
     {
+        if(cancel_check(cancel)) {
+            free_list(node);
+            free_list(sorted_list);
+            return NULL;
+        }
         node_t *next_node = node->next;
         node->next = NULL;  
         sorted_list = add_inorder(sorted_list, node, compare, order);
+        free(node);
         node = next_node;
     }
     return sorted_list;
 }
 
-/** [1]
- * @brief Writes a header to a file based on a given value.
- *
- * Opens a file, writes a specific header line based on `order_by_value`, then reopens the file in append mode.
+/**
+ * @brief Returns the output column an --order_by value sorts on.
  *
- * @param order_by_value Determines the header line to write.
- * @return FILE* Pointer to the opened file.
+ * @param order_by_value The column the output is ordered by.
+ * @return int The column, or -1 if `order_by_value` is not valid.
  */
-FILE *write_header_to_file(char * order_by_value)
+int order_column(char *order_by_value)
 {
-    FILE *outfile = NULL;
-    if(order_by_value!=NULL)
-    {
-        if(strcmp(order_by_value, "STREAMS")==0)
-        {
-            outfile = fopen("output.csv", "w");
-            fputs("released,track_name,artist(s)_name,streams\n",outfile);
-            fclose(outfile);
-        }else if(strcmp(order_by_value,"NO_SPOTIFY_PLAYLISTS")==0){
-            outfile = fopen("output.csv", "w");
-            fputs("released,track_name,artist(s)_name,in_spotify_playlists\n",outfile);
-            fclose(outfile);
-        }else if(strcmp(order_by_value, "NO_APPLE_PLAYLISTS")==0){
-            outfile = fopen("output.csv", "w");
-            fputs("released,track_name,artist(s)_name,in_apple_playlists\n",outfile);
-            fclose(outfile);
-        }else {
-            exit(-1);
-        }
-    }outfile=fopen("output.csv", "a");
-    return outfile;
+    if(strcmp(order_by_value, "STREAMS")==0)
+        return COL_STREAMS;
+    else if(strcmp(order_by_value,"NO_SPOTIFY_PLAYLISTS")==0)
+        return COL_SPOTIFY;
+    else if(strcmp(order_by_value, "NO_APPLE_PLAYLISTS")==0)
+        return COL_APPLE;
+    else if(strcmp(order_by_value, "TRACK_NAME")==0)
+        return COL_TRACK_NAME;
+    else if(strcmp(order_by_value, "ARTIST")==0)
+        return COL_ARTIST;
+    else
+        return -1;
 }
 
-/** [1]
- * @brief Writes node data to a file.
+/**
+ * @brief Checks if an --order_by value sorts on a string column.
  *
- * Writes the date, track name, and artist of the node to the file. Also writes additional data based on `order_by_value`.
+ * String orders have no numeric sort key, so they cannot be paged with --after.
  *
- * @param current_node Pointer to the node to be written to the file.
- * @param outfile Pointer to the file.
- * @param order_by_value String indicating the additional data to write.
+ * @param order_by_value The column the output is ordered by, or NULL.
+ * @return bool True for TRACK_NAME and ARTIST.
  */
-void write_to_file(node_t *current_node, FILE *outfile, char *order_by_value)
+bool text_order(char *order_by_value)
 {
-    char buffer[11];
-    strftime(buffer, 11, "%Y-%-m-%-d", &(current_node->date_));
-    fprintf(outfile, "%s,%s,%s",
-            buffer,
-            current_node->track_name,
-            current_node->artist);
-
-    if(strcmp(order_by_value, "STREAMS")==0) 
-        fprintf(outfile, ",%lu\n", current_node->streams);
-
-    else if(strcmp(order_by_value, "NO_APPLE_PLAYLISTS")==0) 
-        fprintf(outfile, ",%lu\n", current_node->in_apple_playlists); 
-
-    else if(strcmp(order_by_value, "NO_SPOTIFY_PLAYLISTS")==0) 
-        fprintf(outfile, ",%lu\n", current_node->in_spotify_playlists);
-        
-    else
-        printf("Something went wrong?\n");
+    int column = order_by_value != NULL ? order_column(order_by_value) : -1;
+    return column == COL_TRACK_NAME || column == COL_ARTIST;
 }
 
-/** [1]
- * @brief Frees a singly linked list.
+/**
+ * @brief Picks the output columns of a query.
  *
- * Iterates over the list, freeing each node. Sets `next` of each node to `NULL` before freeing.
+ * --columns takes a comma separated list of header names. Without it the output is the release date,
+ * track name, artist and the --order_by column (streams for a --prefix search), unless that column
+ * is already one of the first three.
  *
- * @param list Pointer to the head of the list.
+ * @param opts The options of the query.
+ * @param ids Receives up to MAX_OUTPUT_COLUMNS column ids.
+ * @return int The number of columns, or -1 if a name or the --order_by value is not valid.
  */
-void free_list(node_t *list) {
-    node_t *temp;
+int select_columns(options_t *opts, int *ids)
+{
+    if(opts->columns == NULL) {
+        int order = order_column(opts->order_by_value != NULL ? opts->order_by_value : "STREAMS");
+        if(order < 0)
+            return -1;
+        ids[0] = COL_RELEASED;
+        ids[1] = COL_TRACK_NAME;
+        ids[2] = COL_ARTIST;
+        ids[3] = order;
+        return order == COL_TRACK_NAME || order == COL_ARTIST ? 3 : 4;
+    }
 
-    while (list != NULL) {
-        temp = list;
-        list = list->next;
-        free(temp);
+    int n = 0;
+    const char *p = opts->columns;
+    for(;;) {
+        size_t len = strcspn(p, ",");
+        int id = 0;
+        while(id < NUM_COLUMNS && (strlen(columns[id].name) != len || strncmp(columns[id].name, p, len) != 0))
+            id++;
+        if(id == NUM_COLUMNS || n == MAX_OUTPUT_COLUMNS)
+            return -1;
+        ids[n++] = id;
+        if(p[len] == '\0')
+            return n;
+        p += len + 1;
     }
 }
 
-/** [1]
- * @brief Entry point for a data processing program.
+/**
+ * @brief Returns the data file fields a run has to parse.
  *
- * This program processes a data file based on command line arguments. It filters and sorts the data, then writes the output to a file.
+ * Only the fields that are filtered on, sorted on, summarised or written out are converted while
+ * reading; converting a file to a cache or row file, or serving it, needs every field.
  *
- * @param argc The count of command-line arguments.
- * @param argv The array containing the command-line arguments.
+ * @param opts The options of the run.
+ * @return unsigned int The FIELD_* bits.
+ */
+unsigned int needed_fields(options_t *opts)
+{
+    if(is_conversion(opts) || opts->serve != NULL)
+        return FIELD_ALL;
+
+    unsigned int fields = 0;
+    if(opts->filter != NULL) {
+        if(strcmp(opts->filter, "YEAR")==0)
+            fields |= FIELD_DATE;
+        else if(strcmp(opts->filter, "FUZZY_TRACK")==0)
+            fields |= FIELD_TRACK_NAME;
+        else
+            fields |= FIELD_ARTIST;
+    }
+    if(opts->count || opts->exists)
+        return fields;
+    if(opts->stats != NULL)
+        return fields | (FIELD_ALL & ~(FIELD_TRACK_NAME | FIELD_ARTIST));
+
+    if(opts->prefix != NULL)
+        fields |= FIELD_STREAMS | (opts->prefix_on != NULL && strcmp(opts->prefix_on, "ARTIST")==0 ? FIELD_ARTIST : FIELD_TRACK_NAME);
+    if(opts->order_by_value != NULL && order_column(opts->order_by_value) >= 0)
+        fields |= columns[order_column(opts->order_by_value)].fields;
+
+    int ids[MAX_OUTPUT_COLUMNS];
+    int n = select_columns(opts, ids);
+    for(int c = 0; c < n; c++)
+        fields |= columns[ids[c]].fields;
+    return fields;
+}
+
+/**
+ * @brief Checks a --presorted=<column>:<ASC|DES> hint and takes its order as the query's.
  *
- * @return int Returns 0 if the program finishes successfully, and 1 if an error occurs.
+ * Pre-sorted inputs are merged straight into the output, so only queries that write records in
+ * that order can use them.
+ *
+ * @param opts The options of the run; the hint is split in place.
+ * @return int 0 if the hint can be used, -1 otherwise (the reason is printed).
  */
+int apply_presorted(options_t *opts)
+{
+    char *direction = strchr(opts->presorted, ':');
+    if(direction != NULL)
+        *direction++ = '\0';
+    if(direction == NULL || order_column(opts->presorted) < 0 || (strcmp(direction, "ASC")!=0 && strcmp(direction, "DES")!=0)) {
+        printf("Error: --presorted expects '<order_by column>:<ASC|DES>'.\n");
+        return -1;
+    }
+    if((opts->order_by_value != NULL && strcmp(opts->order_by_value, opts->presorted)!=0)
+       || (opts->order_by_direction != NULL && strcmp(opts->order_by_direction, direction)!=0)) {
+        printf("Error: --presorted=%s:%s does not match the --order_by and --order of the query.\n", opts->presorted, direction);
+        return -1;
+    }
+    if(opts->infile == NULL || opts->cache != NULL || opts->rows != NULL || is_conversion(opts)
+       || opts->watch || opts->serve != NULL || opts->stats != NULL || opts->prefix != NULL || opts->after != NULL
+       || (opts->filter != NULL && strncmp(opts->filter, "FUZZY_", 6) == 0)) {
+        printf("Error: --presorted needs --data and cannot be combined with --cache, --rows, --save_*, --watch, --serve, --stats, --prefix, --after or fuzzy filters.\n");
+        return -1;
+    }
+    opts->order_by_value = opts->presorted;
+    opts->order_by_direction = direction;
+    return 0;
+}
 
-int main(int argc, char *argv[])
+/**
+ * @brief Writes the header row for a set of output columns.
+ *
+ * @param outfile Pointer to the file.
+ * @param ids The output columns.
+ * @param num_ids The number of output columns.
+ */
+void write_header(FILE *outfile, int *ids, int num_ids)
 {
-    char *line = NULL;
-    node_t *list = NULL;
-    char *filter = NULL;
-    char *filter_value = NULL;
-    char *order_by_value = NULL;
-    char *order_by_direction = NULL;
-    char *limit = NULL;
-    FILE *infile = NULL;
-    FILE *outfile = NULL;
+    for(int c = 0; c < num_ids; c++)
+        fprintf(outfile, c == 0 ? "%s" : ",%s", columns[ids[c]].name);
+    fputc('\n', outfile);
+}
 
-    line = (char *)malloc(sizeof(char) * MAX_LINE_LEN);
-    strcpy(line, "this is the starting point for A3.");
+/** [1]
+ * @brief Writes node data to a file.
+ *
+ * Writes the selected columns of the node, in order, as one CSV row.
+ *
+ * @param current_node Pointer to the node to be written to the file.
+ * @param outfile Pointer to the file.
+ * @param ids The output columns.
+ * @param num_ids The number of output columns.
+ */
+void write_to_file(node_t *current_node, FILE *outfile, int *ids, int num_ids)
+{
+    char buffer[11];
+    struct tm date;
+    for(int c = 0; c < num_ids; c++) {
+        if(c > 0)
+            fputc(',', outfile);
+        switch(ids[c]) {
+            case COL_RELEASED:
+                unpack_date(current_node->date, &date);
+                strftime(buffer, 11, "%Y-%-m-%-d", &date);
+                fputs(buffer, outfile);
+                break;
+            case COL_TRACK_NAME:
+                fputs(node_track_name(current_node), outfile); break;
+            case COL_ARTIST:
+                fputs(node_artist(current_node), outfile); break;
+            case COL_ARTIST_COUNT:
+                fprintf(outfile, "%u", current_node->artist_count); break;
+            case COL_SPOTIFY:
+                fprintf(outfile, "%u", current_node->in_spotify_playlists); break;
+            case COL_STREAMS:
+                fprintf(outfile, "%lu", current_node->streams); break;
+            case COL_APPLE:
+                fprintf(outfile, "%u", current_node->in_apple_playlists); break;
+        }
+    }
+    fputc('\n', outfile);
+}
+
+/**
+ * @brief The output columns of a mapped export, passed to format_row.
+ */
+typedef struct row_format_t
+{
+    int *ids;
+    int num_ids;
+} row_format_t;
 
-    /*--Parse commandline arguments, assign to pointers--*/
-    parse_arguments(argc, argv, &infile, &filter, &filter_value, 
-                    &order_by_value, &order_by_direction, &limit);
+/**
+ * @brief Formats a record as one CSV row, exactly as write_to_file writes it (export_format_t).
+ *
+ * The record's strings must already be filled in; this runs on several threads at once.
+ *
+ * @param node The record.
+ * @param dst Where to write the row, or NULL to only measure it.
+ * @param ctx The row_format_t with the output columns.
+ * @return size_t The length of the row, including its newline.
+ */
+size_t format_row(node_t *node, char *dst, void *ctx)
+{
+    row_format_t *format = (row_format_t *)ctx;
+    size_t len = 0;
+    for(int c = 0; c < format->num_ids; c++) {
+        if(c > 0) {
+            if(dst != NULL)
+                dst[len] = ',';
+            len++;
+        }
+        char *at = dst != NULL ? dst + len : NULL;
+        switch(format->ids[c]) {
+            case COL_RELEASED:
+                len += export_uint(at, node->date >> 9);
+                if(dst != NULL)
+                    dst[len] = '-';
+                len++;
+                len += export_uint(dst != NULL ? dst + len : NULL, (node->date >> 5) & 0xf);
+                if(dst != NULL)
+                    dst[len] = '-';
+                len++;
+                len += export_uint(dst != NULL ? dst + len : NULL, node->date & 0x1f);
+                break;
+            case COL_TRACK_NAME:
+                len += export_string(at, node_track_name(node)); break;
+            case COL_ARTIST:
+                len += export_string(at, node_artist(node)); break;
+            case COL_ARTIST_COUNT:
+                len += export_uint(at, node->artist_count); break;
+            case COL_SPOTIFY:
+                len += export_uint(at, node->in_spotify_playlists); break;
+            case COL_STREAMS:
+                len += export_uint(at, node->streams); break;
+            case COL_APPLE:
+                len += export_uint(at, node->in_apple_playlists); break;
+        }
+    }
+    if(dst != NULL)
+        dst[len] = '\n';
+    return len + 1;
+}
 
-    /*--Set compare function for sorting order--*/
-    int (*compare)(node_t *, node_t *, int);
-    if(order_by_value!=NULL && order_by_direction!=NULL)
-        compare = get_compare(order_by_value);
+/**
+ * @brief Copies a list, keeping its order.
+ *
+ * @param list The list to copy.
+ * @return node_t* The head of the copy.
+ */
+node_t *copy_list(node_t *list)
+{
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    for(node_t *node = list; node != NULL; node = node->next) {
+        node_t *copy = new_node();
+        *copy = *node;
+        copy->next = NULL;
+        if(tail == NULL)
+            head = copy;
+        else
+            tail->next = copy;
+        tail = copy;
+    }
+    return head;
+}
 
-    /*--Skip header row from data file--*/
-    for(fgets(line, MAX_LINE_LEN, infile); line[strlen(line)-1]!='\n';fgets(line, MAX_LINE_LEN, infile));
+/**
+ * @brief Skips the header row of a data file.
+ *
+ * @param infile The data file, positioned at its start.
+ * @param line A buffer of MAX_LINE_LEN characters.
+ */
+void skip_header(FILE *infile, char *line)
+{
+    while(fgets(line, MAX_LINE_LEN, infile) != NULL && line[strlen(line)-1] != '\n');
+}
 
-    /*--Create blank record on heap, fill record, add to list if it matches filter--*/
-    while(fgets(line, MAX_LINE_LEN, infile)!=NULL) 
+/**
+ * @brief Reads records from the data file up to an offset.
+ *
+ * Records that match `load_filter` are appended to `*tail`, or streamed into `stats` and freed when
+ * statistics are given. Row ids continue from `*row_id`.
+ *
+ * @param infile The data file, positioned at the start of a record.
+ * @param end Stop at this offset (the end of the last complete line), or -1 to read to the end of file.
+ * @param opts The options of the run.
+ * @param load_filter The filter applied while reading, or NULL to keep every record.
+ * @param stats The statistics to stream records into, or NULL to keep them.
+ * @param line A buffer of MAX_LINE_LEN characters.
+ * @param row_id The next row id, updated.
+ * @param tail The last record read so far, updated.
+ * @param arena The arena to copy the strings of kept records into.
+ * @param cancel Checked every CANCEL_BATCH records; reading stops early when it fires.
+ * @return node_t* The first record added, or NULL if none was.
+ */
+node_t *read_records(FILE *infile, long end, options_t *opts, char *load_filter, stats_table_t *stats,
+                     char *line, unsigned int *row_id, node_t **tail, arena_t *arena, cancel_t *cancel)
+{
+    node_t *head = NULL;
+    while((end < 0 || ftell(infile) < end) && fgets(line, MAX_LINE_LEN, infile)!=NULL) 
     {   
+        if(*row_id % CANCEL_BATCH == 0 && cancel_check(cancel))
+            break;
+        /*--The strings of a record that is not kept are given back to the arena--*/
+        arena_mark_t mark = arena_mark(arena);
         node_t *record = new_node(); 
-        fill_record(record, line, infile);
-        if(is_filter(record, filter, filter_value))    
-            list = add_end(list, record);
+        bool valid = fill_record(record, line, infile, opts->fields, arena);
+        record->row_id = (*row_id)++;
+        if(!valid) {
+            opts->invalid_rows++;
+            free(record);
+            arena_release(arena, mark);
+        } else if(is_conversion(opts) || load_filter == NULL
+           || is_filter(record, load_filter, opts->filter_value)) {
+            if(stats != NULL) {
+                /*--Stream the record into the statistics, nothing is kept--*/
+                stats_table_add(stats, record);
+                free(record);
+                arena_release(arena, mark);
+                continue;
+            }
+            record->next = NULL;
+            if(*tail != NULL)
+                (*tail)->next = record;
+            if(head == NULL)
+                head = record;
+            *tail = record;
+        } else {
+            free(record);
+            arena_release(arena, mark);
+        }
+    }
+    return head;
+}
+
+/*--Filters of the fused kernels: r is the parsed record, value the --value and year its number--*/
+#define KERNEL_FILTER_NONE(r, value, year) true
+#define KERNEL_FILTER_ARTIST(r, value, year) (strstr(node_artist(r), (value)) != NULL)
+#define KERNEL_FILTER_YEAR(r, value, year) ((int)((r)->date >> 9) == (year))
+
+/*--Sort keys of the fused kernels--*/
+#define KERNEL_KEY_STREAMS(r) ((r)->streams)
+#define KERNEL_KEY_NO_SPOTIFY_PLAYLISTS(r) ((r)->in_spotify_playlists)
+#define KERNEL_KEY_NO_APPLE_PLAYLISTS(r) ((r)->in_apple_playlists)
+
+/*--True if key a with row id ra is output after key b with row id rb (see comes_after)--*/
+#define KERNEL_AFTER_DES(a, b, ra, rb) ((a) < (b) || ((a) == (b) && (ra) < (rb)))
+#define KERNEL_AFTER_ASC(a, b, ra, rb) ((a) > (b) || ((a) == (b) && (ra) < (rb)))
+
+/**
+ * @brief Defines kernel_after_<KEY>_<DIR>, the comes_after of one sort order, for the compiler to inline.
+ */
+#define DEFINE_KERNEL_ORDER(KEY, DIR)                                                               \
+    static inline bool kernel_after_##KEY##_##DIR(const node_t *a, const node_t *b)                 \
+    {                                                                                               \
+        return KERNEL_AFTER_##DIR(KERNEL_KEY_##KEY(a), KERNEL_KEY_##KEY(b), a->row_id, b->row_id);  \
+    }
+
+/**
+ * @brief Defines kernel_<FILTER>_<KEY>_<DIR>, a fused read, filter and top-K loop for one query shape.
+ *
+ * Each line is parsed into a stack record whose strings are given back to the arena unless the record
+ * passes the filter and beats the worst of the K kept so far. Kept records live in a bounded heap and
+ * an evicted node is reused for its replacement, so nothing else is allocated. Filter, key and
+ * direction are fixed at compile time; the loop makes no indirect calls.
+ */
+#define DEFINE_KERNEL(FILTER, KEY, DIR)                                                             \
+    static node_t *kernel_##FILTER##_##KEY##_##DIR(options_t *opts, char *line, size_t k,           \
+                                                   arena_t *arena, cancel_t *cancel)                \
+    {                                                                                               \
+        const char *value = opts->filter_value;                                                     \
+        int year = value != NULL ? atoi(value) : 0;                                                 \
+        (void)year;                                                                                 \
+        node_t **heap = NULL;                                                                       \
+        size_t size = 0;                                                                            \
+        size_t cap = 0;                                                                             \
+        unsigned int row_id = 0;                                                                    \
+        bool cancelled = false;                                                                     \
+        node_t record;                                                                              \
+                                                                                                    \
+        for(int f = 0; f < opts->num_inputs && !cancelled; f++) {                                   \
+            FILE *infile = opts->inputs[f];                                                         \
+            skip_header(infile, line);                                                              \
+            while(fgets(line, MAX_LINE_LEN, infile) != NULL) {                                      \
+                if(row_id % CANCEL_BATCH == 0 && (cancelled = cancel_check(cancel)))                \
+                    break;                                                                          \
+                arena_mark_t mark = arena_mark(arena);                                              \
+                memset(&record, 0, sizeof(record));                                                 \
+                bool valid = fill_record(&record, line, infile, opts->fields, arena);               \
+                record.row_id = row_id++;                                                           \
+                opts->invalid_rows += !valid;                                                       \
+                if(!valid || !KERNEL_FILTER_##FILTER(&record, value, year)                          \
+                   || (size == k && !kernel_after_##KEY##_##DIR(heap[0], &record))) {               \
+                    arena_release(arena, mark);                                                     \
+                    continue;                                                                       \
+                }                                                                                   \
+                if(size < k) {                                                                      \
+                    if(size == cap) {                                                               \
+                        cap = cap == 0 ? 64 : cap * 2;                                              \
+                        heap = realloc(heap, cap * sizeof(node_t *));                               \
+                        assert(heap != NULL && "heap == NULL");                                     \
+                    }                                                                               \
+                    node_t *node = new_node();                                                      \
+                    *node = record;                                                                 \
+                    size_t i = size++;                                                              \
+                    while(i > 0 && kernel_after_##KEY##_##DIR(node, heap[(i - 1) / 2])) {           \
+                        heap[i] = heap[(i - 1) / 2];                                                \
+                        i = (i - 1) / 2;                                                            \
+                    }                                                                               \
+                    heap[i] = node;                                                                 \
+                } else {                                                                            \
+                    node_t *node = heap[0];                                                         \
+                    *node = record;                                                                 \
+                    size_t i = 0;                                                                   \
+                    for(;;) {                                                                       \
+                        size_t c = 2 * i + 1;                                                       \
+                        if(c >= size)                                                               \
+                            break;                                                                  \
+                        if(c + 1 < size && kernel_after_##KEY##_##DIR(heap[c + 1], heap[c]))        \
+                            c++;                                                                    \
+                        if(!kernel_after_##KEY##_##DIR(heap[c], node))                              \
+                            break;                                                                  \
+                        heap[i] = heap[c];                                                          \
+                        i = c;                                                                      \
+                    }                                                                               \
+                    heap[i] = node;                                                                 \
+                }                                                                                   \
+            }                                                                                       \
+        }                                                                                           \
+                                                                                                    \
+        /*--The heap is not sorted; link the kept records up as they are--*/                        \
+        node_t *list = NULL;                                                                        \
+        for(size_t i = 0; i < size; i++) {                                                          \
+            heap[i]->next = list;                                                                   \
+            list = heap[i];                                                                         \
+        }                                                                                           \
+        free(heap);                                                                                 \
+        return list;                                                                                \
+    }
+
+DEFINE_KERNEL_ORDER(STREAMS, DES)
+DEFINE_KERNEL_ORDER(STREAMS, ASC)
+DEFINE_KERNEL_ORDER(NO_SPOTIFY_PLAYLISTS, DES)
+DEFINE_KERNEL_ORDER(NO_SPOTIFY_PLAYLISTS, ASC)
+DEFINE_KERNEL_ORDER(NO_APPLE_PLAYLISTS, DES)
+DEFINE_KERNEL_ORDER(NO_APPLE_PLAYLISTS, ASC)
+
+DEFINE_KERNEL(ARTIST, STREAMS, DES)
+DEFINE_KERNEL(YEAR, STREAMS, DES)
+DEFINE_KERNEL(YEAR, STREAMS, ASC)
+DEFINE_KERNEL(YEAR, NO_SPOTIFY_PLAYLISTS, DES)
+DEFINE_KERNEL(YEAR, NO_SPOTIFY_PLAYLISTS, ASC)
+DEFINE_KERNEL(YEAR, NO_APPLE_PLAYLISTS, DES)
+DEFINE_KERNEL(YEAR, NO_APPLE_PLAYLISTS, ASC)
+DEFINE_KERNEL(NONE, STREAMS, DES)
+DEFINE_KERNEL(NONE, STREAMS, ASC)
+
+/**
+ * @brief A fused kernel: reads every --data file and returns the top --limit matching records, unordered.
+ */
+typedef node_t *(*kernel_t)(options_t *opts, char *line, size_t k, arena_t *arena, cancel_t *cancel);
+
+/**
+ * @brief The query shapes with a fused kernel. A NULL filter is a query without --filter.
+ */
+static const struct
+{
+    const char *filter;
+    const char *order_by;
+    const char *direction;
+    kernel_t run;
+} kernels[] = {
+    {"ARTIST", "STREAMS", "DES", kernel_ARTIST_STREAMS_DES},
+    {"YEAR", "STREAMS", "DES", kernel_YEAR_STREAMS_DES},
+    {"YEAR", "STREAMS", "ASC", kernel_YEAR_STREAMS_ASC},
+    {"YEAR", "NO_SPOTIFY_PLAYLISTS", "DES", kernel_YEAR_NO_SPOTIFY_PLAYLISTS_DES},
+    {"YEAR", "NO_SPOTIFY_PLAYLISTS", "ASC", kernel_YEAR_NO_SPOTIFY_PLAYLISTS_ASC},
+    {"YEAR", "NO_APPLE_PLAYLISTS", "DES", kernel_YEAR_NO_APPLE_PLAYLISTS_DES},
+    {"YEAR", "NO_APPLE_PLAYLISTS", "ASC", kernel_YEAR_NO_APPLE_PLAYLISTS_ASC},
+    {NULL, "STREAMS", "DES", kernel_NONE_STREAMS_DES},
+    {NULL, "STREAMS", "ASC", kernel_NONE_STREAMS_ASC},
+};
+
+/**
+ * @brief Picks the fused kernel for a run, if its query shape has one.
+ *
+ * Only a plain top-K over --data files qualifies: a --limit, an --order_by with a kernel for its
+ * filter, and nothing that needs every record (statistics, fuzzy or prefix search, --after,
+ * conversion, following the file). Everything else takes the generic read_records path.
+ *
+ * @param opts The options of the run.
+ * @return kernel_t The kernel, or NULL.
+ */
+kernel_t find_kernel(options_t *opts)
+{
+    if(opts->limit == NULL || atoi(opts->limit) <= 0 || opts->order_by_value == NULL || opts->order_by_direction == NULL
+       || opts->cache != NULL || opts->rows != NULL || is_conversion(opts)
+       || opts->watch || opts->serve != NULL || opts->stats != NULL || opts->prefix != NULL || opts->after != NULL
+       || (opts->filter != NULL && opts->filter_value == NULL))
+        return NULL;
+
+    for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if((kernels[i].filter == NULL ? opts->filter == NULL : opts->filter != NULL && strcmp(kernels[i].filter, opts->filter) == 0)
+           && strcmp(kernels[i].order_by, opts->order_by_value) == 0 && strcmp(kernels[i].direction, opts->order_by_direction) == 0)
+            return kernels[i].run;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Picks the cache column a run can rank cache blocks by, if it is a plain top-K query.
+ *
+ * The same shapes as find_kernel qualify, over a --cache, for the numeric orders, with any filter
+ * but a fuzzy one. Everything else loads every matching record with bin_load.
+ *
+ * @param opts The options of the run.
+ * @return int The bin_column_id, or -1.
+ */
+int cache_top_column(options_t *opts)
+{
+    if(opts->limit == NULL || atoi(opts->limit) <= 0 || opts->order_by_value == NULL || opts->order_by_direction == NULL
+       || opts->cache == NULL || is_conversion(opts) || opts->stats != NULL || opts->prefix != NULL || opts->after != NULL
+       || (opts->filter != NULL && (opts->filter_value == NULL || strncmp(opts->filter, "FUZZY_", 6) == 0)))
+        return -1;
+    if(strcmp(opts->order_by_value, "STREAMS")==0)
+        return BIN_COL_STREAMS;
+    else if(strcmp(opts->order_by_value, "NO_SPOTIFY_PLAYLISTS")==0)
+        return BIN_COL_SPOTIFY;
+    else if(strcmp(opts->order_by_value, "NO_APPLE_PLAYLISTS")==0)
+        return BIN_COL_APPLE;
+    return -1;
+}
+
+/**
+ * @brief Creates the statistics table asked for by --stats and --group_by.
+ *
+ * @param opts The options of the run.
+ * @return stats_table_t* The table, or NULL when --stats is not given.
+ */
+stats_table_t *new_stats(options_t *opts)
+{
+    if(opts->stats == NULL)
+        return NULL;
+    stats_table_t *stats = stats_table_new(opts->stats, opts->group_by != NULL && strcmp(opts->group_by, "YEAR") == 0);
+    if(stats == NULL) {
+        printf("Error: --stats column list '%s' not valid.\n", opts->stats);
+        exit(1);
+    }
+    return stats;
+}
+
+/**
+ * @brief Counts the records of the data file that match the filter, without keeping any of them.
+ *
+ * Every line is parsed into the same stack record, and the scratch arena its strings go to is rewound
+ * after each line.
+ *
+ * @param infile The data file, positioned at the start of a record.
+ * @param opts The options of the run.
+ * @param line A buffer of MAX_LINE_LEN characters.
+ * @param stop_at Stop once this many matches are found, or 0 to count them all.
+ * @param cancel Checked every CANCEL_BATCH records; counting stops early when it fires.
+ * @param cancelled Set to true if counting stopped early because cancel fired.
+ * @return uint64_t The number of matches.
+ */
+uint64_t count_records(FILE *infile, options_t *opts, char *line, uint64_t stop_at, cancel_t *cancel,
+                       bool *cancelled)
+{
+    node_t record;
+    arena_t *scratch = arena_new();
+    uint64_t count = 0;
+    uint64_t read = 0;
+    while((stop_at == 0 || count < stop_at) && fgets(line, MAX_LINE_LEN, infile)!=NULL)
+    {
+        if(read++ % CANCEL_BATCH == 0 && cancel_check(cancel)) {
+            *cancelled = true;
+            break;
+        }
+        memset(&record, 0, sizeof(record));
+        arena_mark_t mark = arena_mark(scratch);
+        if(!fill_record(&record, line, infile, opts->fields, scratch))
+            opts->invalid_rows++;
+        else if(opts->filter == NULL || is_filter(&record, opts->filter, opts->filter_value))
+            count++;
+        arena_release(scratch, mark);
+    }
+    arena_free(scratch);
+    return count;
+}
+
+/**
+ * @brief Counts the records of a mapped row file that match a filter.
+ *
+ * @param rows The row file.
+ * @param filter The type of filter, or NULL to count every record.
+ * @param filter_value The value to filter by.
+ * @param stop_at Stop once this many matches are found, or 0 to count them all.
+ * @return uint64_t The number of matches.
+ */
+uint64_t count_rows(rows_t *rows, char *filter, char *filter_value, uint64_t stop_at)
+{
+    uint64_t num_records = rows->header->num_records;
+    if(filter == NULL)
+        return stop_at != 0 && num_records > stop_at ? stop_at : num_records;
+
+    uint64_t count = 0;
+    for(uint64_t r = 0; r < num_records && (stop_at == 0 || count < stop_at); r++)
+        if(row_matches(rows, &rows->records[r], filter, filter_value))
+            count++;
+    return count;
+}
+
+/**
+ * @brief Writes the answer of a --count or --exists query.
+ *
+ * @param out The stream to write to.
+ * @param opts The options of the query.
+ * @param count The number of matches found.
+ */
+void write_count(FILE *out, options_t *opts, uint64_t count)
+{
+    if(opts->count)
+        fprintf(out, "count\n%lu\n", (unsigned long)count);
+    else
+        fprintf(out, "exists\n%s\n", count > 0 ? "true" : "false");
+}
+
+/**
+ * @brief Checks the options of a --count or --exists query.
+ *
+ * Only the plain filters can be counted without building records; ordering and limits do not change a count.
+ *
+ * @param opts The options of the query.
+ * @param out Where to write the reason a query is rejected.
+ * @return bool True if the query can be counted.
+ */
+bool valid_count(options_t *opts, FILE *out)
+{
+    if(opts->stats != NULL || opts->prefix != NULL || opts->after != NULL
+       || (opts->filter != NULL && strncmp(opts->filter, "FUZZY_", 6) == 0)) {
+        fprintf(out, "Error: --count and --exists cannot be combined with --stats, --prefix, --after or fuzzy filters.\n");
+        return false;
+    }
+    if(opts->filter != NULL && opts->filter_value == NULL) {
+        fprintf(out, "Error: --filter needs --value.\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Runs the query on the loaded records and writes the result to a stream.
+ *
+ * Applies the fuzzy filter, then writes either the statistics or the ordered, limited records.
+ * The records are freed.
+ *
+ * @param list The loaded records.
+ * @param opts The options of the query.
+ * @param stats The statistics table, or NULL.
+ * @param src Where the records came from.
+ * @param out The stream to write the result to.
+ * @param notes Where to print the cursor of the next page, or NULL.
+ * @param cancel The cancellation token, or NULL.
+ * @return int 0 on success, -1 if the query was cancelled before anything was written.
+ */
+int write_query(node_t *list, options_t *opts, stats_table_t *stats, source_t *src, FILE *out, FILE *notes,
+                cancel_t *cancel)
+{
+    /*--Set compare function for sorting order--*/
+    int (*compare)(node_t *, node_t *, int) = NULL;
+    if(opts->order_by_value!=NULL && opts->order_by_direction!=NULL)
+        compare = get_compare(opts->order_by_value);
+
+    /*--Apply a fuzzy artist/track filter through the trigram index, unless the source already did--*/
+    if(opts->filter != NULL && strncmp(opts->filter, "FUZZY_", 6) == 0 && !src->filtered)
+        list = fuzzy_filter(list, opts->filter, opts->filter_value,
+                            opts->max_edits != NULL ? atoi(opts->max_edits) : 1, src);
+
+    /*--Write summary statistics and stop--*/
+    if(stats != NULL)
+    {
+        size_t count = 0;
+        for(node_t *node = list; node != NULL; node = node->next) {
+            if(++count % CANCEL_BATCH == 0 && cancel_check(cancel)) {
+                free_list(list);
+                return -1;
+            }
+            stats_table_add(stats, node);
+        }
+        stats_table_write(stats, out);
+        free_list(list);
+        return 0;
     }
 
     /*--Create a new ordered list, assigning it to final_list--*/
-    node_t *final_list = order_list(list, order_by_direction, compare);
+    node_t *final_list = NULL;
+    if(opts->prefix != NULL)
+    {
+        /*--Autocomplete: top-K by streams straight from the prefix index, unless the source already did--*/
+        if(opts->order_by_value == NULL)
+            opts->order_by_value = "STREAMS";
+        bool on_artist = opts->prefix_on != NULL && strcmp(opts->prefix_on, "ARTIST") == 0;
+        if(src->ranked)
+            final_list = list;
+        else
+            final_list = prefix_search(list, opts->prefix, on_artist, opts->limit != NULL ? atoi(opts->limit) : 10, src);
+        list = NULL;
+    }
+    else
+    {
+        int order = strcmp(opts->order_by_direction, "DES") == 0 ? -1 : 1;
 
-    /*--Write header row to file, return outfile in append mode--*/
-    outfile = write_header_to_file(order_by_value);
-    
-    /*--Output Final List--*/
+        /*--A string order compares the strings, so records from a cache, row file or store need them first--*/
+        if(text_order(opts->order_by_value)) {
+            size_t count = 0;
+            for(node_t *node = list; node != NULL; node = node->next) {
+                if(++count % CANCEL_BATCH == 0 && cancel_check(cancel)) {
+                    free_list(list);
+                    return -1;
+                }
+                fill_strings(src, node);
+            }
+        }
+
+        /*--Keyset pagination: skip everything up to the --after cursor--*/
+        if(opts->after != NULL)
+            list = after_cursor(list, opts->after, compare, order);
+
+        /*--With a limit, select the page with a bounded heap instead of sorting everything--*/
+        if(opts->limit != NULL)
+            final_list = top_k(&list, compare, order, (size_t)atoi(opts->limit));
+        else {
+            final_list = order_list(list, opts->order_by_direction, compare, cancel);
+            list = NULL;
+        }
+    }
+
+    /*--Nothing has been written yet; give up if the query was cancelled meanwhile--*/
+    if(cancel_check(cancel)) {
+        free_list(list);
+        free_list(final_list);
+        return -1;
+    }
+
+    /*--Write header row; record strings are only decoded when a string column is written--*/
+    int ids[MAX_OUTPUT_COLUMNS];
+    int num_ids = select_columns(opts, ids);
+    unsigned int fields = 0;
+    for(int c = 0; c < num_ids; c++)
+        fields |= columns[ids[c]].fields;
+    write_header(out, ids, num_ids);
+
+    /*--Large results are formatted in parallel straight into the mapped output file--*/
     size_t limit_count =0;
     node_t *node = final_list;  
+    node_t *last_node = NULL;
+    size_t num_rows = 0;
+    for(node_t *row = final_list; row != NULL && (opts->limit == NULL || num_rows < (size_t)atoi(opts->limit)); row = row->next)
+        num_rows++;
+    if(num_rows >= EXPORT_MIN_ROWS) {
+        node_t **rows = malloc(num_rows * sizeof(node_t *));
+        assert(rows != NULL && "rows == NULL");
+        for(size_t i = 0; i < num_rows; i++, node = node->next) {
+            if(fields & (FIELD_TRACK_NAME | FIELD_ARTIST))
+                fill_strings(src, node);
+            rows[i] = node;
+        }
+        row_format_t format = {ids, num_ids};
+        if(export_rows(out, rows, num_rows, format_row, &format) == 0) {
+            limit_count = num_rows;
+            last_node = rows[num_rows - 1];
+            node = NULL;
+        } else
+            node = final_list;
+        free(rows);
+    }
+
+    /*--Output Final List--*/
     while (node != NULL) {
-        write_to_file(node, outfile, order_by_value);
+        last_node = node;
+        if(fields & (FIELD_TRACK_NAME | FIELD_ARTIST))
+            fill_strings(src, node);
+        write_to_file(node, out, ids, num_ids);
         node = node->next;
         limit_count++;
-        if(limit!=NULL && limit_count == atoi(limit))
+        if(opts->limit!=NULL && limit_count == atoi(opts->limit))
             break;
     }
 
-    /*--Free Memory--*/
+    /*--Print the cursor for the next page when this one is full--*/
+    if(notes != NULL && opts->limit != NULL && opts->prefix == NULL && !text_order(opts->order_by_value)
+       && last_node != NULL && limit_count == atoi(opts->limit))
+        fprintf(notes, "Next page: --after=%lu,%u\n", sort_key(last_node, opts->order_by_value), last_node->row_id);
+
     free_list(list);
     free_list(final_list);
-    free(line);
-    fclose(infile);
+    return 0;
+}
+
+/**
+ * @brief Runs the query on the loaded records and writes the result to OUTPUT_FILE.
+ *
+ * The output is written to OUTPUT_TMP and renamed over OUTPUT_FILE, so a reader never sees a
+ * partly written file. The records are freed.
+ *
+ * @param list The loaded records.
+ * @param opts The options of the run.
+ * @param stats The statistics table, or NULL.
+ * @param src Where the records came from.
+ * @param cancel The cancellation token, or NULL.
+ * @return int 0 on success, -1 if the query was cancelled; OUTPUT_FILE is then left as it was.
+ */
+int write_results(node_t *list, options_t *opts, stats_table_t *stats, source_t *src, cancel_t *cancel)
+{
+    if(stats == NULL && (opts->order_by_value != NULL ? order_column(opts->order_by_value) < 0 : opts->prefix == NULL)) {
+        printf("Error: --order_by value not valid.\n");
+        exit(1);
+    }
+    int ids[MAX_OUTPUT_COLUMNS];
+    if(stats == NULL && select_columns(opts, ids) < 0) {
+        printf("Error: --columns value '%s' not valid.\n", opts->columns);
+        exit(1);
+    }
+    if(opts->after != NULL && text_order(opts->order_by_value)) {
+        printf("Error: --after cannot page an --order_by=%s query.\n", opts->order_by_value);
+        exit(1);
+    }
+
+    /*--Opened for reading too, so large results can be written through a shared mapping--*/
+    FILE *outfile = fopen(OUTPUT_TMP, "w+");
+    int status = write_query(list, opts, stats, src, outfile, stdout, cancel);
+    fclose(outfile);
+    if(status != 0) {
+        remove(OUTPUT_TMP);
+        return -1;
+    }
+    rename(OUTPUT_TMP, OUTPUT_FILE);
+    return 0;
+}
+
+/**
+ * @brief Answers a --history query and writes it to OUTPUT_FILE.
+ *
+ * With --track, every snapshot of that track is written (only of the series by --artist, if given).
+ * With --growth=N, the --limit (default 10) series of the latest snapshot whose streams grew the most
+ * over the last N snapshots are written, fastest first.
+ *
+ * @param opts The options of the run.
+ */
+void write_history(options_t *opts)
+{
+    if((opts->track == NULL) == (opts->growth == NULL)) {
+        printf("Error: --history needs either --track or --growth.\n");
+        exit(1);
+    }
+    if(opts->growth != NULL && atoi(opts->growth) <= 0) {
+        printf("Error: --growth expects a number of snapshots, got '%s'\n", opts->growth);
+        exit(1);
+    }
+    tseries_t *ts = tseries_open(opts->history);
+    if(ts == NULL) {
+        printf("Error: could not open history '%s'\n", opts->history);
+        exit(1);
+    }
+
+    FILE *outfile = fopen(OUTPUT_TMP, "w");
+    if(opts->track != NULL)
+    {
+        ts_point_t *points = malloc(sizeof(ts_point_t) * (ts->num_snapshots + 1));
+        fprintf(outfile, "snapshot,track_name,artist(s)_name,streams,in_spotify_playlists,in_apple_playlists\n");
+        for(uint32_t key = 0; key < ts->num_keys; key++) {
+            if(strcmp(ts->tracks[key], opts->track) != 0 || (opts->artist != NULL && strcmp(ts->artists[key], opts->artist) != 0))
+                continue;
+            uint32_t n = tseries_history(ts, key, points);
+            for(uint32_t i = 0; i < n; i++)
+                fprintf(outfile, "%s,%s,%s,%lu,%lu,%lu\n", tseries_label(ts, points[i].snapshot), ts->tracks[key], ts->artists[key],
+                        (unsigned long)points[i].values[TS_STREAMS], (unsigned long)points[i].values[TS_SPOTIFY],
+                        (unsigned long)points[i].values[TS_APPLE]);
+        }
+        free(points);
+    }
+    else
+    {
+        uint32_t k = opts->limit != NULL ? (uint32_t)atoi(opts->limit) : 10;
+        if(k > ts->num_keys)
+            k = ts->num_keys;
+        ts_growth_t *top = malloc(sizeof(ts_growth_t) * (k + 1));
+        uint32_t n = tseries_growth(ts, (uint32_t)atoi(opts->growth), k, top);
+        fprintf(outfile, "track_name,artist(s)_name,growth\n");
+        for(uint32_t i = 0; i < n; i++)
+            fprintf(outfile, "%s,%s,%ld\n", ts->tracks[top[i].key], ts->artists[top[i].key], (long)top[i].growth);
+        free(top);
+    }
     fclose(outfile);
+    rename(OUTPUT_TMP, OUTPUT_FILE);
+    tseries_close(ts);
+}
+
+/**
+ * @brief A --data file read as one sorted run of a --presorted merge.
+ *
+ * Records are parsed one at a time into two arenas used in turn, so the record handed to the merge
+ * and the one before it, which the next is checked against, are the only ones kept.
+ */
+typedef struct sorted_input_t
+{
+    FILE *infile;
+    const char *name;
+    options_t *opts;
+    char *line;
+    cancel_t *cancel;
+    int (*compare)(node_t *, node_t *, int);
+    int order;
+    arena_t *arenas[2];
+    node_t *prev;
+    unsigned int row_id;
+    unsigned int kept;
+    bool unsorted;
+} sorted_input_t;
+
+/**
+ * @brief Reads the next matching record of a pre-sorted --data file, for merge_next.
+ *
+ * The --presorted hint is verified on the way: a record that sorts before the previous one kept
+ * from the same file marks the file unsorted and ends its run.
+ *
+ * @param p The sorted_input_t of the file.
+ * @return node_t* The record, or NULL at the end of the file, on a hint violation or when cancelled.
+ */
+node_t *next_sorted(void *p)
+{
+    sorted_input_t *in = (sorted_input_t *)p;
+    arena_t *arena = in->arenas[in->kept % 2];
+    arena_reset(arena);
+    while(!in->unsorted && fgets(in->line, MAX_LINE_LEN, in->infile) != NULL)
+    {
+        if(in->row_id % CANCEL_BATCH == 0 && cancel_check(in->cancel))
+            return NULL;
+        arena_mark_t mark = arena_mark(arena);
+        node_t *record = arena_alloc(arena, sizeof(node_t));
+        memset(record, 0, sizeof(node_t));
+        bool valid = fill_record(record, in->line, in->infile, in->opts->fields, arena);
+        record->row_id = in->row_id++;
+        if(!valid)
+            in->opts->invalid_rows++;
+        if(!valid || (in->opts->filter != NULL && !is_filter(record, in->opts->filter, in->opts->filter_value))) {
+            arena_release(arena, mark);
+            continue;
+        }
+        if(in->prev != NULL && in->compare(record, in->prev, in->order) < 0) {
+            in->unsorted = true;
+            return NULL;
+        }
+        in->prev = record;
+        in->kept++;
+        return record;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Merges pre-sorted --data files into OUTPUT_FILE without sorting or keeping any records.
+ *
+ * Records are written as the loser tree hands them out, and reading stops as soon as --limit
+ * records are written. The output goes through OUTPUT_TMP like write_results.
+ *
+ * @param opts The options of the run, with the --presorted hint applied.
+ * @param line A buffer of MAX_LINE_LEN characters.
+ * @param cancel The cancellation token, or NULL.
+ * @return int 0 on success, -1 if the query was cancelled; OUTPUT_FILE is then left as it was.
+ */
+int write_merged(options_t *opts, char *line, cancel_t *cancel)
+{
+    int ids[MAX_OUTPUT_COLUMNS];
+    int num_ids = select_columns(opts, ids);
+    if(num_ids < 0) {
+        printf("Error: --columns value '%s' not valid.\n", opts->columns);
+        exit(1);
+    }
+
+    sorted_input_t inputs[MAX_INPUTS];
+    void *runs[MAX_INPUTS];
+    for(int i = 0; i < opts->num_inputs; i++) {
+        sorted_input_t in = {opts->inputs[i], opts->data_files[i], opts, line, cancel, get_compare(opts->order_by_value),
+                             strcmp(opts->order_by_direction, "DES") == 0 ? -1 : 1, {arena_new(), arena_new()}, NULL, 0, 0, false};
+        inputs[i] = in;
+        runs[i] = &inputs[i];
+        skip_header(in.infile, line);
+    }
+    merge_t *merge = merge_new(runs, opts->num_inputs, next_sorted, inputs[0].compare, inputs[0].order);
 
-    exit(0);
+    FILE *outfile = fopen(OUTPUT_TMP, "w");
+    write_header(outfile, ids, num_ids);
+    size_t limit = opts->limit != NULL ? (size_t)atoi(opts->limit) : 0;
+    size_t written = 0;
+    node_t *node;
+    while((limit == 0 || written < limit) && (node = merge_next(merge)) != NULL) {
+        write_to_file(node, outfile, ids, num_ids);
+        written++;
+    }
+    fclose(outfile);
+    merge_free(merge);
+
+    int status = cancel_check(cancel) ? -1 : 0;
+    for(int i = 0; i < opts->num_inputs; i++) {
+        if(inputs[i].unsorted && status == 0) {
+            printf("Error: '%s' is not sorted by %s %s (data row %u).\n", inputs[i].name,
+                   opts->order_by_value, opts->order_by_direction, inputs[i].row_id);
+            remove(OUTPUT_TMP);
+            exit(1);
+        }
+        arena_free(inputs[i].arenas[0]);
+        arena_free(inputs[i].arenas[1]);
+    }
+    if(status != 0) {
+        remove(OUTPUT_TMP);
+        return -1;
+    }
+    rename(OUTPUT_TMP, OUTPUT_FILE);
+    return 0;
+}
+
+/**
+ * @brief Rebuilds the prefix indexes of the store once enough rows were appended after them.
+ *
+ * Only called by the ingester, which owns the store, after publishing. The indexes are built
+ * outside the lock and swapped in under it.
+ *
+ * @param names The name indexes.
+ * @param store The store.
+ */
+void index_prefixes(names_t *names, store_t *store)
+{
+    uint64_t num_rows = store->length;
+    uint64_t delta = names->prefix_rows / 8 > PREFIX_DELTA_ROWS ? names->prefix_rows / 8 : PREFIX_DELTA_ROWS;
+    if(names->track_prefix != NULL && num_rows - names->prefix_rows <= delta)
+        return;
+
+    store_snapshot_t snap;
+    store_snapshot(store, &snap);
+    const char **tracks = malloc(sizeof(char *) * (num_rows + 1));
+    const char **artists = malloc(sizeof(char *) * (num_rows + 1));
+    uint64_t *streams = malloc(sizeof(uint64_t) * (num_rows + 1));
+    assert(tracks != NULL && artists != NULL && streams != NULL && "prefix arrays == NULL");
+    for(uint64_t row = 0; row < num_rows; row++) {
+        const store_chunk_t *chunk = store_chunk(&snap, row);
+        tracks[row] = chunk->track_name[row % STORE_CHUNK_ROWS];
+        artists[row] = chunk->artist[row % STORE_CHUNK_ROWS];
+        streams[row] = chunk->streams[row % STORE_CHUNK_ROWS];
+    }
+    prefix_index_t *track_prefix = prefix_build(tracks, streams, (uint32_t)num_rows);
+    prefix_index_t *artist_prefix = prefix_build(artists, streams, (uint32_t)num_rows);
+    free(streams);
+    free(artists);
+    free(tracks);
+
+    pthread_rwlock_wrlock(&names->lock);
+    prefix_index_t *old_tracks = names->track_prefix;
+    prefix_index_t *old_artists = names->artist_prefix;
+    names->track_prefix = track_prefix;
+    names->artist_prefix = artist_prefix;
+    names->prefix_rows = num_rows;
+    pthread_rwlock_unlock(&names->lock);
+    prefix_free(old_tracks);
+    prefix_free(old_artists);
+}
+
+/**
+ * @brief Appends records to the store and its name indexes, and publishes them together.
+ *
+ * The indexes are written to in batches of STORE_CHUNK_ROWS rows, so fuzzy queries are not held
+ * up for a whole reload.
+ *
+ * @param store The store.
+ * @param list The records to append, freed.
+ * @param names The name indexes of the store.
+ */
+void append_to_store(store_t *store, node_t *list, names_t *names)
+{
+    while(list != NULL) {
+        pthread_rwlock_wrlock(&names->lock);
+        for(int i = 0; i < STORE_CHUNK_ROWS && list != NULL; i++) {
+            node_t *next = list->next;
+            trigram_add_row(names->artists, node_artist(list));
+            trigram_add_row(names->tracks, node_track_name(list));
+            store_append(store, list);
+            free(list);
+            list = next;
+        }
+        pthread_rwlock_unlock(&names->lock);
+    }
+    store_publish(store);
+    index_prefixes(names, store);
+}
+
+/**
+ * @brief Points the name indexes at a new, empty store.
+ *
+ * @param names The name indexes.
+ * @param store The store whose rows will be added next.
+ */
+void reset_names(names_t *names, const store_t *store)
+{
+    pthread_rwlock_wrlock(&names->lock);
+    trigram_free(names->artists);
+    trigram_free(names->tracks);
+    prefix_free(names->track_prefix);
+    prefix_free(names->artist_prefix);
+    names->artists = trigram_new();
+    names->tracks = trigram_new();
+    names->track_prefix = NULL;
+    names->artist_prefix = NULL;
+    names->prefix_rows = 0;
+    names->store = store;
+    pthread_rwlock_unlock(&names->lock);
+}
+
+/**
+ * @brief Allocates the per-artist verdicts of an artist filter over a snapshot.
+ *
+ * @param snap The snapshot.
+ * @param filter The type of filter, or NULL.
+ * @return signed char* One verdict per artist id, all unknown (0), or NULL if the filter is not on the artist.
+ */
+signed char *new_artist_verdicts(const store_snapshot_t *snap, char *filter)
+{
+    if(filter == NULL || (strcmp(filter, "ARTIST")!=0 && strcmp(filter, "ARTIST_IS")!=0))
+        return NULL;
+    signed char *verdicts = calloc(snap->num_artists + 1, sizeof(signed char));
+    assert(verdicts != NULL && "verdicts == NULL");
+    return verdicts;
+}
+
+/**
+ * @brief Checks if a row of a store snapshot matches a filter.
+ *
+ * Applies the same rules as `is_filter`, reading only the filtered column in place. An artist filter
+ * reads the row's artist id and only reads the artist the first time that id is seen.
+ *
+ * @param snap The snapshot.
+ * @param row The row to check.
+ * @param filter The type of filter, or NULL to match every row.
+ * @param filter_value The value to filter by.
+ * @param year The YEAR filter value, already converted.
+ * @param verdicts From new_artist_verdicts: 1 or -1 once an artist id is decided.
+ * @param bytes Increased by the bytes of column data read.
+ * @return bool True if the row matches the filter.
+ */
+bool store_matches(const store_snapshot_t *snap, uint64_t row, char *filter, char *filter_value, int year,
+                   signed char *verdicts, uint64_t *bytes)
+{
+    const store_chunk_t *chunk = store_chunk(snap, row);
+    uint32_t i = row % STORE_CHUNK_ROWS;
+
+    if(filter == NULL)
+        return true;
+    else if(verdicts != NULL) {
+        uint32_t id = chunk->artist_id[i];
+        *bytes += sizeof(uint32_t);
+        if(verdicts[id] == 0) {
+            *bytes += sizeof(char *) + strlen(chunk->artist[i]) + 1;
+            bool match = strcmp(filter, "ARTIST_IS")==0 ? artist_has_token(chunk->artist[i], filter_value)
+                                                        : strstr(chunk->artist[i], filter_value)!=NULL;
+            verdicts[id] = match ? 1 : -1;
+        }
+        return verdicts[id] > 0;
+    } else if(strcmp(filter, "YEAR")==0) {
+        *bytes += sizeof(uint32_t);
+        return (int)(chunk->date[i] >> 9) == year;
+    } else
+        return false;
+}
+
+/**
+ * @brief Counts the rows of a store snapshot that match a filter, without building any nodes.
+ *
+ * @param snap The snapshot to scan.
+ * @param filter The type of filter, or NULL to count every row.
+ * @param filter_value The value to filter by.
+ * @param stop_at Stop once this many matches are found, or 0 to count them all.
+ * @param bytes Increased by the bytes of column data read.
+ * @param cancel Checked every CANCEL_BATCH rows; the scan stops early when it fires.
+ * @param cancelled Set to whether the scan stopped early because cancel fired.
+ * @return uint64_t The number of matches.
+ */
+uint64_t count_store(const store_snapshot_t *snap, char *filter, char *filter_value, uint64_t stop_at,
+                     uint64_t *bytes, cancel_t *cancel, bool *cancelled)
+{
+    *cancelled = false;
+    if(filter == NULL)
+        return stop_at != 0 && snap->num_rows > stop_at ? stop_at : snap->num_rows;
+
+    uint64_t count = 0;
+    int year = strcmp(filter, "YEAR")==0 ? atoi(filter_value) : 0;
+    signed char *verdicts = new_artist_verdicts(snap, filter);
+    for(uint64_t row = 0; row < snap->num_rows && (stop_at == 0 || count < stop_at); row++) {
+        if(row % CANCEL_BATCH == 0 && cancel_check(cancel)) {
+            *cancelled = true;
+            break;
+        }
+        if(store_matches(snap, row, filter, filter_value, year, verdicts, bytes))
+            count++;
+    }
+    free(verdicts);
+    return count;
+}
+
+/**
+ * @brief Collects the rows of a store snapshot that match a filter.
+ *
+ * Applies the same rules as `is_filter`, reading the columns in place. When `stats` is given the
+ * matching rows are streamed into it and nothing is collected.
+ *
+ * @param snap The snapshot to scan.
+ * @param filter The type of filter, or NULL to keep every row.
+ * @param filter_value The value to filter by.
+ * @param stats The statistics to stream rows into, or NULL.
+ * @param bytes Increased by the bytes of column data read.
+ * @param cancel Checked every CANCEL_BATCH rows; the scan stops early when it fires.
+ * @return node_t* The matching rows, without strings, in row order.
+ */
+node_t *collect_store(const store_snapshot_t *snap, char *filter, char *filter_value, stats_table_t *stats,
+                      uint64_t *bytes, cancel_t *cancel)
+{
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    int year = filter != NULL && strcmp(filter, "YEAR")==0 ? atoi(filter_value) : 0;
+    signed char *verdicts = new_artist_verdicts(snap, filter);
+
+    for(uint64_t row = 0; row < snap->num_rows; row++) {
+        if(row % CANCEL_BATCH == 0 && cancel_check(cancel))
+            break;
+        if(!store_matches(snap, row, filter, filter_value, year, verdicts, bytes))
+            continue;
+
+        /*--Every numeric column of a matching row is read--*/
+        *bytes += 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+        node_t *node = store_to_node(snap, row);
+        if(stats != NULL) {
+            stats_table_add(stats, node);
+            free(node);
+            continue;
+        }
+        if(tail == NULL)
+            head = node;
+        else
+            tail->next = node;
+        tail = node;
+    }
+    free(verdicts);
+    return head;
+}
+
+/**
+ * @brief Collects the rows of a store snapshot whose artist or track name fuzzily contains a value.
+ *
+ * The name indexes give the name of every row, so only the matching rows are read.
+ *
+ * @param names The server's name indexes.
+ * @param store The store the snapshot was taken of.
+ * @param snap The snapshot.
+ * @param filter "FUZZY_ARTIST" or "FUZZY_TRACK".
+ * @param filter_value The text to look for.
+ * @param max_edits The largest edit distance accepted.
+ * @param bytes Increased by the bytes of column data read.
+ * @param cancel Checked every CANCEL_BATCH rows; the scan stops early when it fires.
+ * @param list Set to the matching rows, without strings, in row order.
+ * @return bool false if the indexes belong to another store (a reload is under way); list is not set.
+ */
+bool collect_fuzzy(names_t *names, const store_t *store, const store_snapshot_t *snap, char *filter,
+                   char *filter_value, int max_edits, uint64_t *bytes, cancel_t *cancel, node_t **list)
+{
+    pthread_rwlock_rdlock(&names->lock);
+    if(names->store != store) {
+        pthread_rwlock_unlock(&names->lock);
+        return false;
+    }
+    trigram_index_t *index = strcmp(filter, "FUZZY_TRACK")==0 ? names->tracks : names->artists;
+    bool *matched = trigram_match(index, filter_value, max_edits);
+    size_t num_rows = 0;
+    uint64_t *rows = malloc(sizeof(uint64_t) * (snap->num_rows + 1));
+    for(uint64_t row = 0; row < snap->num_rows; row++)
+        if(matched[index->rows[row]])
+            rows[num_rows++] = row;
+    pthread_rwlock_unlock(&names->lock);
+    free(matched);
+
+    /*--Rows are read outside the lock, where the query may yield--*/
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    for(size_t i = 0; i < num_rows; i++) {
+        if(i % CANCEL_BATCH == 0 && cancel_check(cancel))
+            break;
+        *bytes += 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+        node_t *node = store_to_node(snap, rows[i]);
+        if(tail == NULL)
+            head = node;
+        else
+            tail->next = node;
+        tail = node;
+    }
+    free(rows);
+    *list = head;
+    return true;
+}
+
+/**
+ * @brief A row of a store snapshot and its stream count, for ranking prefix matches.
+ */
+typedef struct ranked_row_t
+{
+    uint64_t streams;
+    uint64_t row;
+} ranked_row_t;
+
+/**
+ * @brief Orders rows by descending streams, then by row.
+ */
+int compare_ranked(const void *a, const void *b)
+{
+    const ranked_row_t *x = a;
+    const ranked_row_t *y = b;
+    if(x->streams != y->streams)
+        return x->streams > y->streams ? -1 : 1;
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+/**
+ * @brief Collects the `k` rows of a store snapshot with the most streams whose track name (or artist)
+ *        starts with `prefix`.
+ *
+ * The server's prefix index ranks the rows it covers; the rows appended after it was built are
+ * scanned, and both are merged in the order prefix_search gives.
+ *
+ * @param names The server's name indexes.
+ * @param store The store the snapshot was taken of.
+ * @param snap The snapshot.
+ * @param prefix The typed text (case-insensitive).
+ * @param on_artist Search artist names instead of track names.
+ * @param k The number of results wanted.
+ * @param bytes Increased by the bytes of column data read.
+ * @param cancel Checked every CANCEL_BATCH rows; the scan stops early when it fires.
+ * @param list Set to the rows, without strings, most streams first.
+ * @return bool false if the index cannot answer for the snapshot (a reload or rebuild is under way);
+ *         list is not set.
+ */
+bool collect_prefix(names_t *names, const store_t *store, const store_snapshot_t *snap, char *prefix,
+                    bool on_artist, uint32_t k, uint64_t *bytes, cancel_t *cancel, node_t **list)
+{
+    pthread_rwlock_rdlock(&names->lock);
+    if(names->store != store || names->track_prefix == NULL || names->prefix_rows > snap->num_rows) {
+        pthread_rwlock_unlock(&names->lock);
+        return false;
+    }
+    uint64_t indexed = names->prefix_rows;
+    if(k > snap->num_rows)
+        k = (uint32_t)snap->num_rows;
+    uint32_t *refs = malloc(sizeof(uint32_t) * (k + 1));
+    uint32_t num_refs = prefix_top_k(on_artist ? names->artist_prefix : names->track_prefix, prefix, k, refs);
+    pthread_rwlock_unlock(&names->lock);
+
+    /*--Rows past the index are read outside the lock, where the query may yield--*/
+    size_t num_rows = 0;
+    size_t cap = (size_t)num_refs + 64;
+    ranked_row_t *rows = malloc(sizeof(ranked_row_t) * cap);
+    for(uint32_t i = 0; i < num_refs; i++) {
+        rows[num_rows].row = refs[i];
+        rows[num_rows].streams = store_chunk(snap, refs[i])->streams[refs[i] % STORE_CHUNK_ROWS];
+        num_rows++;
+    }
+    free(refs);
+    for(uint64_t row = indexed; row < snap->num_rows; row++) {
+        if((row - indexed) % CANCEL_BATCH == 0 && cancel_check(cancel))
+            break;
+        const store_chunk_t *chunk = store_chunk(snap, row);
+        const char *name = on_artist ? chunk->artist[row % STORE_CHUNK_ROWS] : chunk->track_name[row % STORE_CHUNK_ROWS];
+        *bytes += strlen(name) + 1;
+        if(!prefix_matches(name, prefix))
+            continue;
+        if(num_rows == cap) {
+            cap *= 2;
+            rows = realloc(rows, sizeof(ranked_row_t) * cap);
+            assert(rows != NULL && "rows == NULL");
+        }
+        rows[num_rows].row = row;
+        rows[num_rows].streams = chunk->streams[row % STORE_CHUNK_ROWS];
+        num_rows++;
+    }
+    qsort(rows, num_rows, sizeof(ranked_row_t), compare_ranked);
+
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    for(size_t i = 0; i < num_rows && i < k; i++) {
+        *bytes += 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+        node_t *node = store_to_node(snap, rows[i].row);
+        if(tail == NULL)
+            head = node;
+        else
+            tail->next = node;
+        tail = node;
+    }
+    free(rows);
+    *list = head;
+    return true;
+}
+
+/**
+ * @brief Splits a request line into arguments.
+ *
+ * Arguments are separated by spaces; spaces inside double quotes are kept, and so are the quotes,
+ * which `parse_arguments` strips. argv[0] is a placeholder, as for a command line.
+ *
+ * @param request The request, modified in place.
+ * @param argv The array to fill.
+ * @param max The size of `argv`.
+ * @return int The number of arguments, or -1 if there are too many.
+ */
+int split_request(char *request, char **argv, int max)
+{
+    int argc = 0;
+    argv[argc++] = "query";
+
+    char *p = request;
+    while(*p != '\0') {
+        while(*p == ' ')
+            p++;
+        if(*p == '\0')
+            break;
+        if(argc == max)
+            return -1;
+        argv[argc++] = p;
+        bool quoted = false;
+        while(*p != '\0' && (quoted || *p != ' ')) {
+            if(*p == '"')
+                quoted = !quoted;
+            p++;
+        }
+        if(*p != '\0')
+            *p++ = '\0';
+    }
+    return argc;
+}
+
+/**
+ * @brief Checks the options of a server query, so running it cannot exit the server.
+ *
+ * @param query The parsed options.
+ * @param out Where to write the reason a query is rejected.
+ * @return bool True if the query can be run.
+ */
+bool valid_query(options_t *query, FILE *out)
+{
+    if(query->data != NULL || query->infile != NULL || query->cache != NULL || query->rows != NULL || is_conversion(query) || query->history != NULL
+       || query->watch || query->serve != NULL || query->presorted != NULL || query->cache_index != NULL) {
+        fprintf(out, "Error: only query options are accepted by the server.\n");
+        return false;
+    }
+    if(query->filter != NULL) {
+        if(strcmp(query->filter, "ARTIST")!=0 && strcmp(query->filter, "ARTIST_IS")!=0 && strcmp(query->filter, "YEAR")!=0
+           && strcmp(query->filter, "FUZZY_ARTIST")!=0 && strcmp(query->filter, "FUZZY_TRACK")!=0) {
+            fprintf(out, "Error: filter '%s' not valid.\n", query->filter);
+            return false;
+        }
+        if(query->filter_value == NULL) {
+            fprintf(out, "Error: --filter needs --value.\n");
+            return false;
+        }
+    }
+    if(query->limit != NULL && !valid_limit(query->limit)) {
+        fprintf(out, "Error: --limit must be a whole number from 1 to %d.\n", INT_MAX);
+        return false;
+    }
+    if(query->count || query->exists)
+        return valid_count(query, out);
+    if(query->stats == NULL && query->prefix == NULL) {
+        if(query->order_by_value == NULL || query->order_by_direction == NULL
+           || (strcmp(query->order_by_direction, "ASC")!=0 && strcmp(query->order_by_direction, "DES")!=0)) {
+            fprintf(out, "Error: --order_by and --order=ASC|DES are required.\n");
+            return false;
+        }
+    }
+    if(query->order_by_value != NULL && order_column(query->order_by_value) < 0) {
+        fprintf(out, "Error: --order_by value '%s' not valid.\n", query->order_by_value);
+        return false;
+    }
+    int ids[MAX_OUTPUT_COLUMNS];
+    if(query->stats == NULL && select_columns(query, ids) < 0) {
+        fprintf(out, "Error: --columns value '%s' not valid.\n", query->columns);
+        return false;
+    }
+    if(query->after != NULL && strchr(query->after, ',') == NULL) {
+        fprintf(out, "Error: --after expects '<sort key>,<row id>', got '%s'\n", query->after);
+        return false;
+    }
+    if(query->after != NULL && text_order(query->order_by_value)) {
+        fprintf(out, "Error: --after cannot page an --order_by=%s query.\n", query->order_by_value);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Adds a query sent with --id to the running queries, so CANCEL can reach it.
+ *
+ * @param state The server state.
+ * @param running The query's entry; nothing is done if it has no id.
+ */
+void add_running(server_state_t *state, running_t *running)
+{
+    if(running->id == NULL)
+        return;
+    pthread_mutex_lock(&state->running_lock);
+    running->next = state->running;
+    state->running = running;
+    pthread_mutex_unlock(&state->running_lock);
+}
+
+/**
+ * @brief Removes a query added with add_running from the running queries.
+ *
+ * @param state The server state.
+ * @param running The query's entry; nothing is done if it has no id.
+ */
+void remove_running(server_state_t *state, running_t *running)
+{
+    if(running->id == NULL)
+        return;
+    pthread_mutex_lock(&state->running_lock);
+    running_t **p = &state->running;
+    while(*p != running)
+        p = &(*p)->next;
+    *p = running->next;
+    pthread_mutex_unlock(&state->running_lock);
+}
+
+/**
+ * @brief Answers a --count or --exists query against a snapshot of the store.
+ *
+ * @param state The server state.
+ * @param query The parsed, valid query.
+ * @param out The stream to write the response to.
+ * @return int The query's metrics shape, or -2 if it was cancelled.
+ */
+int answer_count(server_state_t *state, options_t *query, FILE *out)
+{
+    cancel_t cancel;
+    char *timeout = query->timeout != NULL ? query->timeout : state->opts->timeout;
+    cancel_init(&cancel, timeout != NULL ? atol(timeout) : 0);
+    running_t running = {query->id, &cancel, NULL};
+    add_running(state, &running);
+
+    int slot = epoch_enter(state->epoch);
+    store_snapshot_t snap;
+    store_snapshot(__atomic_load_n(&state->store, __ATOMIC_ACQUIRE), &snap);
+    uint64_t bytes = 0;
+    bool cancelled;
+    uint64_t count = count_store(&snap, query->filter, query->filter_value, query->exists ? 1 : 0, &bytes, &cancel,
+                                 &cancelled);
+    metrics_scanned(state->metrics, snap.num_rows, bytes);
+    epoch_exit(state->epoch, slot);
+    remove_running(state, &running);
+
+    /*--A count that finished is answered even if the deadline passed since--*/
+    if(cancelled) {
+        fprintf(out, "Error: query cancelled.\n");
+        return -2;
+    }
+    write_count(out, query, count);
+    return metrics_shape(query->filter, "COUNT", NULL);
+}
+
+/**
+ * @brief Answers one query against a snapshot of the store.
+ *
+ * The request holds the same query options as the command line. The snapshot is taken and used
+ * inside an epoch, so rows appended meanwhile are not seen and nothing it reads is freed.
+ *
+ * @param state The server state.
+ * @param request The request line.
+ * @param out The stream to write the response to.
+ * @return int The query's metrics shape, -1 if the request was rejected, -2 if it was cancelled.
+ */
+int answer_query(server_state_t *state, char *request, FILE *out)
+{
+    char *argv[SERVER_MAX_ARGS];
+    options_t query = {0};
+
+    int argc = split_request(request, argv, SERVER_MAX_ARGS);
+    if(argc < 0 || parse_arguments(argc, argv, &query, false) != 0) {
+        close_inputs(&query);
+        fprintf(out, "Error: request not valid.\n");
+        return -1;
+    }
+    if(!valid_query(&query, out)) {
+        close_inputs(&query);
+        return -1;
+    }
+
+    if(query.count || query.exists)
+        return answer_count(state, &query, out);
+
+    stats_table_t *stats = NULL;
+    if(query.stats != NULL) {
+        stats = stats_table_new(query.stats, query.group_by != NULL && strcmp(query.group_by, "YEAR") == 0);
+        if(stats == NULL) {
+            fprintf(out, "Error: --stats column list '%s' not valid.\n", query.stats);
+            close_inputs(&query);
+            return -1;
+        }
+    }
+
+    bool is_fuzzy = query.filter != NULL && strncmp(query.filter, "FUZZY_", 6) == 0;
+    char *load_filter = is_fuzzy || query.prefix != NULL ? NULL : query.filter;
+    int shape = metrics_shape(query.prefix != NULL ? "PREFIX" : query.filter,
+                              query.stats != NULL ? "STATS" : query.order_by_value, query.limit);
+
+    /*--The query's own --timeout wins over the server's; --id makes it cancellable with CANCEL--*/
+    cancel_t cancel;
+    char *timeout = query.timeout != NULL ? query.timeout : state->opts->timeout;
+    cancel_init(&cancel, timeout != NULL ? atol(timeout) : 0);
+    running_t running = {query.id, &cancel, NULL};
+    add_running(state, &running);
+
+    /*--The store may be swapped by a reload; the one loaded here stays valid until epoch_exit--*/
+    int slot = epoch_enter(state->epoch);
+    store_t *store = __atomic_load_n(&state->store, __ATOMIC_ACQUIRE);
+    store_snapshot_t snap;
+    store_snapshot(store, &snap);
+    uint64_t bytes = 0;
+    node_t *list = NULL;
+    source_t src = {NULL, NULL, &snap, arena_new(), false, false};
+    int k = query.limit != NULL ? atoi(query.limit) : 10;
+    if(is_fuzzy)
+        src.filtered = collect_fuzzy(&state->names, store, &snap, query.filter, query.filter_value,
+                                     query.max_edits != NULL ? atoi(query.max_edits) : 1, &bytes, &cancel, &list);
+    else if(query.prefix != NULL && stats == NULL && k > 0)
+        src.ranked = collect_prefix(&state->names, store, &snap, query.prefix,
+                                    query.prefix_on != NULL && strcmp(query.prefix_on, "ARTIST") == 0,
+                                    (uint32_t)k, &bytes, &cancel, &list);
+    if(!src.filtered && !src.ranked)
+        list = collect_store(&snap, load_filter, query.filter_value, is_fuzzy ? NULL : stats, &bytes, &cancel);
+    metrics_scanned(state->metrics, snap.num_rows, bytes);
+    if(write_query(list, &query, stats, &src, out, NULL, &cancel) != 0) {
+        fprintf(out, "Error: query cancelled.\n");
+        shape = -2;
+    }
+    epoch_exit(state->epoch, slot);
+    arena_free(src.arena);
+
+    remove_running(state, &running);
+    stats_table_free(stats);
+    return shape;
+}
+
+/**
+ * @brief Cancels the running queries that were sent with a given --id.
+ *
+ * @param state The server state.
+ * @param id The id to cancel.
+ * @return int The number of queries cancelled.
+ */
+int cancel_queries(server_state_t *state, const char *id)
+{
+    int count = 0;
+    pthread_mutex_lock(&state->running_lock);
+    for(running_t *r = state->running; r != NULL; r = r->next) {
+        if(strcmp(r->id, id) == 0) {
+            cancel_request(r->cancel);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&state->running_lock);
+    return count;
+}
+
+/**
+ * @brief Answers one server request.
+ *
+ * "METRICS" returns the server metrics in the Prometheus text format and "CANCEL <id>" cancels the
+ * running queries sent with that --id; anything else is a query, whose latency is recorded under
+ * its shape.
+ *
+ * @param request The request line.
+ * @param out The stream to write the response to.
+ * @param arg Pointer to the `server_state_t`.
+ */
+void serve_query(char *request, FILE *out, void *arg)
+{
+    server_state_t *state = (server_state_t *)arg;
+    struct timespec start, end;
+
+    if(strcmp(request, "METRICS") == 0) {
+        metrics_write(state->metrics, out);
+        return;
+    }
+    if(strncmp(request, "CANCEL ", 7) == 0) {
+        fprintf(out, "Cancelled %d queries.\n", cancel_queries(state, request + 7));
+        return;
+    }
+
+    metrics_queue(state->metrics, 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int shape = answer_query(state, request, out);
+    fflush(out);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    metrics_queue(state->metrics, -1);
+
+    if(shape == -2)
+        metrics_cancelled(state->metrics);
+    else if(shape < 0)
+        metrics_error(state->metrics);
+    else
+        metrics_record(state->metrics, shape, (uint64_t)((end.tv_sec - start.tv_sec) * 1000000
+                                                         + (end.tv_nsec - start.tv_nsec) / 1000));
+}
+
+/**
+ * @brief Tells whether a server request is cheap enough to answer on the event loop.
+ *
+ * METRICS and CANCEL are, and so is any query while the store holds at most SERVER_INLINE_ROWS
+ * rows; everything else goes to the worker pool, where long scans yield to short requests.
+ *
+ * @param request The request line.
+ * @param arg Pointer to the `server_state_t`.
+ * @return bool True to answer the request inline.
+ */
+bool inline_request(const char *request, void *arg)
+{
+    server_state_t *state = (server_state_t *)arg;
+
+    if(strcmp(request, "METRICS") == 0 || strncmp(request, "CANCEL ", 7) == 0)
+        return true;
+    int slot = epoch_enter(state->epoch);
+    store_snapshot_t snap;
+    store_snapshot(__atomic_load_n(&state->store, __ATOMIC_ACQUIRE), &snap);
+    epoch_exit(state->epoch, slot);
+    return snap.num_rows <= SERVER_INLINE_ROWS;
+}
+
+/**
+ * @brief Frees retired memory once the readers that could still see it have left.
+ *
+ * Runs on the ingester so query threads never pay for freeing. Gives up after about a second;
+ * whatever a slow reader still holds is freed on a later call.
+ *
+ * @param epoch The epoch domain.
+ */
+void drain_retired(epoch_t *epoch)
+{
+    for(int i = 0; i < 100; i++) {
+        epoch_reclaim(epoch);
+        pthread_mutex_lock(&epoch->lock);
+        bool pending = epoch->retired != NULL;
+        pthread_mutex_unlock(&epoch->lock);
+        if(!pending)
+            return;
+        usleep(10000);
+    }
+}
+
+/**
+ * @brief Follows the data file and keeps the store up to date.
+ *
+ * Runs on its own thread for the life of the server. Appended records are added to the store and
+ * seen by queries once published. When the file is rewritten (for example replaced by a new export)
+ * a new store is built here while queries keep using the old one, then swapped in with a single
+ * pointer store. Queries already running finish on the old store, which is freed once they have left.
+ *
+ * @param arg Pointer to the `server_state_t`.
+ * @return void* Always NULL.
+ */
+void *ingest(void *arg)
+{
+    server_state_t *state = (server_state_t *)arg;
+    options_t *opts = state->opts;
+
+    watch_t *watch = watch_open(opts->data);
+    if(watch == NULL) {
+        printf("Error: could not watch '%s', new records will not be loaded.\n", opts->data);
+        return NULL;
+    }
+
+    while(watch_wait(watch) == 0)
+    {
+        long end = 0;
+        int change = watch_check(&opts->inputs[0], opts->data, state->consumed, state->fingerprint, &end);
+        /*--A rewrite may have replaced the stream; the followed file is the only input--*/
+        opts->infile = opts->inputs[0];
+        if(change == WATCH_UNCHANGED)
+            continue;
+
+        unsigned int row_id = 0;
+        node_t *tail = NULL;
+        if(change == WATCH_REWRITTEN)
+        {
+            skip_header(opts->infile, state->line);
+            store_t *store = store_new(state->epoch);
+            reset_names(&state->names, store);
+            append_to_store(store, read_records(opts->infile, end, opts, NULL, NULL, state->line, &row_id, &tail,
+                                                state->arena, NULL), &state->names);
+
+            store_t *old = state->store;
+            __atomic_store_n(&state->store, store, __ATOMIC_RELEASE);
+            epoch_retire(state->epoch, old, store_free);
+            printf("Reloaded %u records from '%s'.\n", row_id, opts->data);
+        }
+        else
+        {
+            row_id = (unsigned int)state->store->length;
+            append_to_store(state->store, read_records(opts->infile, end, opts, NULL, NULL, state->line, &row_id, &tail,
+                                                       state->arena, NULL), &state->names);
+            printf("Loaded %u records from '%s'.\n", row_id, opts->data);
+        }
+        fflush(stdout);
+        /*--The store holds its own copies of the strings--*/
+        arena_reset(state->arena);
+        state->consumed = end;
+        state->fingerprint = watch_fingerprint(opts->infile, end);
+        drain_retired(state->epoch);
+    }
+    watch_close(watch);
+    return NULL;
+}
+
+/** [1]
+ * @brief Entry point for a data processing program.
+ *
+ * This program processes a data file based on command line arguments. It filters and sorts the data, then writes the output to a file.
+ *
+ * @param argc The count of command-line arguments.
+ * @param argv The array containing the command-line arguments.
+ *
+ * @return int Returns 0 if the program finishes successfully, and 1 if an error occurs.
+ */
+
+int main(int argc, char *argv[])
+{
+    char *line = NULL;
+    node_t *list = NULL;
+    options_t opts = {0};
+    bin_t *bin = NULL;
+    rows_t *rows = NULL;
+    arena_t *strings = arena_new();
+
+    line = (char *)malloc(sizeof(char) * MAX_LINE_LEN);
+    strcpy(line, "this is the starting point for A3.");
+
+    /*--Parse commandline arguments, assign to options--*/
+    if(parse_arguments(argc, argv, &opts, true) != 0)
+        exit(1);
+    if(opts.limit != NULL && !valid_limit(opts.limit)) {
+        printf("Error: --limit must be a whole number from 1 to %d.\n", INT_MAX);
+        exit(1);
+    }
+    if(opts.presorted != NULL && apply_presorted(&opts) != 0)
+        exit(1);
+    opts.fields = needed_fields(&opts);
+
+    /*--Fuzzy filters run on the loaded records, everything is loaded unfiltered first--*/
+    bool is_fuzzy = opts.filter != NULL && strncmp(opts.filter, "FUZZY_", 6) == 0;
+    char *load_filter = is_fuzzy || opts.prefix != NULL ? NULL : opts.filter;
+
+    /*--Summary statistics replace the ordered output--*/
+    stats_table_t *stats = new_stats(&opts);
+
+    if(opts.serve != NULL && (opts.num_inputs != 1 || opts.cache != NULL || opts.rows != NULL || opts.watch
+                              || is_conversion(&opts))) {
+        printf("Error: --serve needs one --data and cannot be combined with --cache, --rows, --watch or --save_*.\n");
+        exit(1);
+    }
+
+    if(opts.watch && (opts.num_inputs != 1 || opts.cache != NULL || opts.rows != NULL
+                      || is_conversion(&opts))) {
+        printf("Error: --watch needs one --data and cannot be combined with --cache, --rows or --save_*.\n");
+        exit(1);
+    }
+
+    if(opts.save_history != NULL && (opts.infile == NULL || opts.cache != NULL || opts.rows != NULL)) {
+        printf("Error: --save_history needs --data.\n");
+        exit(1);
+    }
+
+    unsigned int cache_indexes = 0;
+    if(opts.cache_index != NULL && (opts.save_cache == NULL || parse_cache_index(opts.cache_index, &cache_indexes) != 0)) {
+        printf("Error: --cache_index expects FUZZY and/or PREFIX, separated by commas, with --save_cache.\n");
+        exit(1);
+    }
+
+    /*--History queries read nothing but the history file--*/
+    if(opts.history != NULL)
+    {
+        write_history(&opts);
+        arena_free(strings);
+        free(line);
+        close_inputs(&opts);
+        exit(0);
+    }
+
+    /*--The time budget covers loading the records and answering the query--*/
+    cancel_t cancel;
+    cancel_init(&cancel, opts.timeout != NULL ? atol(opts.timeout) : 0);
+
+    /*--Count-only queries never build records: answer from the source directly and stop--*/
+    if(opts.count || opts.exists)
+    {
+        if(opts.serve != NULL || opts.watch || is_conversion(&opts)) {
+            printf("Error: --count and --exists cannot be combined with --serve, --watch or --save_*.\n");
+            exit(1);
+        }
+        if(!valid_count(&opts, stdout))
+            exit(1);
+
+        uint64_t stop_at = opts.exists ? 1 : 0;
+        uint64_t count = 0;
+        bool cancelled = false;
+        if(opts.cache != NULL) {
+            if((bin = bin_open(opts.cache)) == NULL) {
+                printf("Error: could not open cache '%s'\n", opts.cache);
+                exit(1);
+            }
+            count = bin_count(bin, opts.filter, opts.filter_value, stop_at);
+        } else if(opts.rows != NULL) {
+            if((rows = rows_open(opts.rows)) == NULL) {
+                printf("Error: could not open row file '%s'\n", opts.rows);
+                exit(1);
+            }
+            count = count_rows(rows, opts.filter, opts.filter_value, stop_at);
+        } else if(opts.infile != NULL) {
+            for(int i = 0; i < opts.num_inputs && (stop_at == 0 || count < stop_at) && !cancelled; i++) {
+                skip_header(opts.inputs[i], line);
+                count += count_records(opts.inputs[i], &opts, line, stop_at != 0 ? stop_at - count : 0, &cancel,
+                                       &cancelled);
+            }
+            report_invalid_rows(&opts);
+        } else {
+            printf("Error: no input given, expected --data, --cache or --rows.\n");
+            exit(1);
+        }
+        /*--Only a count that stopped early is lost; one that finished is written even if late--*/
+        if(cancelled) {
+            printf("Error: query timed out after %s ms\n", opts.timeout);
+            exit(1);
+        }
+
+        FILE *outfile = fopen(OUTPUT_TMP, "w");
+        write_count(outfile, &opts, count);
+        fclose(outfile);
+        rename(OUTPUT_TMP, OUTPUT_FILE);
+        arena_free(strings);
+        free(line);
+        bin_close(bin);
+        rows_close(rows);
+        close_inputs(&opts);
+        exit(0);
+    }
+
+    /*--Pre-sorted inputs are merged straight into the output; nothing is sorted or kept--*/
+    if(opts.presorted != NULL)
+    {
+        if(write_merged(&opts, line, &cancel) != 0) {
+            printf("Error: query timed out after %s ms\n", opts.timeout);
+            exit(1);
+        }
+        report_invalid_rows(&opts);
+        arena_free(strings);
+        free(line);
+        close_inputs(&opts);
+        exit(0);
+    }
+
+    /*--Where the parsed part of the data file ends, and the state to continue parsing from--*/
+    long consumed = -1;
+    unsigned int row_id = 0;
+    node_t *tail = NULL;
+    bool filtered = false;
+    bool ranked = false;
+
+    if(opts.cache != NULL)
+    {
+        /*--Load matching records from the binary cache, strings are decoded on output--*/
+        bin = bin_open(opts.cache);
+        if(bin == NULL) {
+            printf("Error: could not open cache '%s'\n", opts.cache);
+            exit(1);
+        }
+        /*--A top-K query only reads the blocks whose zones can hold one of the K best records--*/
+        int top_column = cache_top_column(&opts);
+        if(is_fuzzy && bin->artist_names != NULL
+           && (strcmp(opts.filter, "FUZZY_ARTIST")==0 || strcmp(opts.filter, "FUZZY_TRACK")==0)) {
+            /*--A fuzzy filter is answered from the name index stored with the cache, if it has one--*/
+            list = bin_fuzzy(bin, strcmp(opts.filter, "FUZZY_TRACK")==0, opts.filter_value,
+                             opts.max_edits != NULL ? atoi(opts.max_edits) : 1, opts.fields);
+            filtered = true;
+        }
+        else if(opts.prefix != NULL && bin->track_prefix != NULL && stats == NULL) {
+            /*--So is autocomplete, from the prefix index stored with the cache--*/
+            list = bin_prefix(bin, opts.prefix_on != NULL && strcmp(opts.prefix_on, "ARTIST") == 0, opts.prefix,
+                              opts.limit != NULL ? (uint32_t)atoi(opts.limit) : 10, opts.fields);
+            ranked = true;
+        }
+        else if(top_column >= 0)
+            list = bin_top(bin, load_filter, opts.filter_value, opts.fields, top_column,
+                           strcmp(opts.order_by_direction, "DES") == 0, (size_t)atoi(opts.limit));
+        else
+            list = bin_load(bin, load_filter, opts.filter_value, opts.fields);
+    }
+    else if(opts.rows != NULL)
+    {
+        /*--Scan the mapped row file in place, strings are copied on output--*/
+        rows = rows_open(opts.rows);
+        if(rows == NULL) {
+            printf("Error: could not open row file '%s'\n", opts.rows);
+            exit(1);
+        }
+        collect_t collect = {load_filter, opts.filter_value, NULL, NULL};
+        rows_apply(rows, collect_row, &collect);
+        list = collect.head;
+    }
+    else
+    {
+        if(opts.infile == NULL) {
+            printf("Error: no input given, expected --data, --cache or --rows.\n");
+            exit(1);
+        }
+
+        /*--When following the file, stop at the last complete line; the rest is still being written--*/
+        if(opts.watch || opts.serve != NULL) {
+            consumed = watch_line_end(opts.infile);
+            rewind(opts.infile);
+        }
+
+        /*--Common top-K shapes run fused: only the --limit best records are ever kept--*/
+        kernel_t kernel = find_kernel(&opts);
+        if(kernel != NULL)
+            list = kernel(&opts, line, (size_t)atoi(opts.limit), strings, &cancel);
+
+        /*--Otherwise skip the header row of each data file, then read the records one file after the other;
+            a followed file is always read whole--*/
+        for(int i = 0; kernel == NULL && i < opts.num_inputs && !cancel_check(&cancel); i++) {
+            skip_header(opts.inputs[i], line);
+            node_t *added = read_records(opts.inputs[i], consumed, &opts, load_filter, is_fuzzy ? NULL : stats,
+                                         line, &row_id, &tail, strings, opts.watch || opts.serve != NULL ? NULL : &cancel);
+            if(list == NULL)
+                list = added;
+        }
+        if(cancel_check(&cancel)) {
+            printf("Error: query timed out after %s ms\n", opts.timeout);
+            exit(1);
+        }
+        report_invalid_rows(&opts);
+    }
+
+    /*--Convert the whole data file to a binary cache and/or row file, or add it to a history, and stop--*/
+    if(is_conversion(&opts))
+    {
+        if(opts.save_history != NULL
+           && tseries_append(opts.save_history, list, opts.snapshot != NULL ? opts.snapshot : opts.data) != 0) {
+            printf("Error: could not append to history '%s'\n", opts.save_history);
+            exit(1);
+        }
+        if(opts.save_cache != NULL && bin_write(opts.save_cache, list, cache_indexes) != 0) {
+            printf("Error: could not write cache '%s'\n", opts.save_cache);
+            exit(1);
+        }
+        if(opts.save_rows != NULL && rows_write(opts.save_rows, list) != 0) {
+            printf("Error: could not write row file '%s'\n", opts.save_rows);
+            exit(1);
+        }
+        free_list(list);
+        arena_free(strings);
+        free(line);
+        close_inputs(&opts);
+        exit(0);
+    }
+
+    /*--Server mode: answer queries over a Unix socket while appended records are loaded--*/
+    if(opts.serve != NULL)
+    {
+        server_state_t state = {&opts, epoch_new(), NULL, metrics_new(), consumed, 0, line, strings,
+                                PTHREAD_MUTEX_INITIALIZER, NULL, {PTHREAD_RWLOCK_INITIALIZER, NULL, NULL, NULL, NULL, NULL, 0}};
+        state.store = store_new(state.epoch);
+        reset_names(&state.names, state.store);
+        append_to_store(state.store, list, &state.names);
+        arena_reset(strings);
+        state.fingerprint = watch_fingerprint(opts.infile, consumed);
+
+        pthread_t ingester;
+        if(pthread_create(&ingester, NULL, ingest, &state) != 0) {
+            printf("Error: could not start the ingester\n");
+            exit(1);
+        }
+        printf("Serving %lu records of '%s' on '%s'.\n", (unsigned long)state.store->length, opts.data, opts.serve);
+        fflush(stdout);
+        if(server_run(opts.serve, serve_query, inline_request, &state) != 0) {
+            printf("Error: could not listen on '%s'\n", opts.serve);
+            exit(1);
+        }
+        printf("Stopped serving '%s'.\n", opts.serve);
+        exit(0);
+    }
+
+    if(!opts.watch)
+    {
+        source_t src = {bin, rows, NULL, strings, filtered, ranked};
+        if(write_results(list, &opts, stats, &src, &cancel) != 0) {
+            printf("Error: query timed out after %s ms\n", opts.timeout);
+            exit(1);
+        }
+        stats_table_free(stats);
+        arena_free(strings);
+        free(line);
+        bin_close(bin);
+        rows_close(rows);
+        close_inputs(&opts);
+        exit(0);
+    }
+
+    /*--Watch mode: keep every loaded record, answer the query on a copy after each change--*/
+    watch_t *watch = watch_open(opts.data);
+    if(watch == NULL) {
+        printf("Error: could not watch '%s'\n", opts.data);
+        exit(1);
+    }
+    uint64_t fingerprint = watch_fingerprint(opts.infile, consumed);
+    source_t csv = {NULL, NULL, NULL, strings, false, false};
+    if(write_results(copy_list(list), &opts, stats, &csv, &cancel) != 0)
+        printf("Query timed out after %s ms, %s not written.\n", opts.timeout, OUTPUT_FILE);
+    printf("Watching '%s' for changes.\n", opts.data);
+    fflush(stdout);
+
+    for(;;)
+    {
+        if(watch_wait(watch) != 0) {
+            printf("Error: watching '%s' failed\n", opts.data);
+            exit(1);
+        }
+
+        /*--Parse only the appended lines, unless what was already parsed has changed--*/
+        long end = 0;
+        int change = watch_check(&opts.inputs[0], opts.data, consumed, fingerprint, &end);
+        /*--A rewrite may have replaced the stream; the followed file is the only input--*/
+        opts.infile = opts.inputs[0];
+        if(change == WATCH_UNCHANGED)
+            continue;
+        if(change == WATCH_REWRITTEN)
+        {
+            free_list(list);
+            arena_reset(strings);
+            list = tail = NULL;
+            row_id = 0;
+            if(stats != NULL) {
+                stats_table_free(stats);
+                stats = new_stats(&opts);
+            }
+            skip_header(opts.infile, line);
+        }
+
+        node_t *added = read_records(opts.infile, end, &opts, load_filter, is_fuzzy ? NULL : stats,
+                                     line, &row_id, &tail, strings, NULL);
+        if(list == NULL)
+            list = added;
+        report_invalid_rows(&opts);
+        consumed = end;
+        fingerprint = watch_fingerprint(opts.infile, consumed);
+
+        /*--Fuzzy matches are recomputed from all records, so their statistics start over--*/
+        if(is_fuzzy && stats != NULL) {
+            stats_table_free(stats);
+            stats = new_stats(&opts);
+        }
+        /*--Each rerun gets the full time budget--*/
+        cancel_init(&cancel, opts.timeout != NULL ? atol(opts.timeout) : 0);
+        if(write_results(copy_list(list), &opts, stats, &csv, &cancel) != 0)
+            printf("Query timed out after %s ms, %s not updated.\n", opts.timeout, OUTPUT_FILE);
+        else
+            printf("Updated %s, %u records read.\n", OUTPUT_FILE, row_id);
+        fflush(stdout);
+    }
 }
@@ -0,0 +1,278 @@
+/** @file stats.c
+ *  @brief Implementation of single-pass summary statistics.
+ *
+ * A full batch is reduced in two sweeps while it sits in L1: the first
+ * finds min, max and the sum (AVX2 on x86-64 when available), the second
+ * accumulates the squared deviations from the batch mean and the log2
+ * histogram. The batch result is then merged into the running totals with
+ * Chan et al.'s pairwise update, which keeps the variance numerically stable.
+ *
+ * Histogram bucket b counts values of bit width b, i.e. values in
+ * [2^(b-1), 2^b); bucket 0 counts zeros.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "stats.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define STATS_HAVE_AVX2 1
+#endif
+
+static const char *column_names[STATS_MAX_COLUMNS] = {
+    "streams", "in_spotify_playlists", "in_apple_playlists"
+};
+
+static uint64_t column_value(node_t *node, int column)
+{
+    switch (column) {
+        case 0:
+            return node->streams;
+        case 1:
+            return node->in_spotify_playlists;
+        default:
+            return node->in_apple_playlists;
+    }
+}
+
+#ifdef STATS_HAVE_AVX2
+static bool cpu_has_avx2(void)
+{
+    /* Server query threads may race to initialise this; they all store the same value */
+    static int has_avx2 = -1;
+    int cached = __atomic_load_n(&has_avx2, __ATOMIC_RELAXED);
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&has_avx2, cached, __ATOMIC_RELAXED);
+    }
+    return cached == 1;
+}
+
+/**
+ * @brief Unsigned 64-bit min/max/sum over n values (n a multiple of 4).
+ *
+ * AVX2 only has signed 64-bit compares, so values are compared with their
+ * sign bit flipped.
+ */
+__attribute__((target("avx2")))
+static void reduce_avx2(const uint64_t *values, uint32_t n, uint64_t *min, uint64_t *max, uint64_t *sum)
+{
+    const __m256i flip = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+    __m256i vmin = _mm256_set1_epi64x(0x7fffffffffffffffll);
+    __m256i vmax = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+    __m256i vsum = _mm256_setzero_si256();
+    uint64_t lanes[4];
+
+    for (uint32_t i = 0; i < n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        __m256i f = _mm256_xor_si256(v, flip);
+        vmin = _mm256_blendv_epi8(vmin, f, _mm256_cmpgt_epi64(vmin, f));
+        vmax = _mm256_blendv_epi8(vmax, f, _mm256_cmpgt_epi64(f, vmax));
+        vsum = _mm256_add_epi64(vsum, v);
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_xor_si256(vmin, flip));
+    for (int j = 0; j < 4; j++)
+        if (lanes[j] < *min)
+            *min = lanes[j];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_xor_si256(vmax, flip));
+    for (int j = 0; j < 4; j++)
+        if (lanes[j] > *max)
+            *max = lanes[j];
+    _mm256_storeu_si256((__m256i *)lanes, vsum);
+    *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+/**
+ * @brief Folds the buffered batch of a column into its running statistics.
+ */
+static void flush_batch(stats_t *stats)
+{
+    uint32_t n = stats->batch_len;
+    uint64_t min = UINT64_MAX, max = 0, sum = 0;
+    uint32_t i = 0;
+
+    if (n == 0)
+        return;
+#ifdef STATS_HAVE_AVX2
+    if (cpu_has_avx2()) {
+        i = n / 4 * 4;
+        reduce_avx2(stats->batch, i, &min, &max, &sum);
+    }
+#endif
+    for (; i < n; i++) {
+        uint64_t v = stats->batch[i];
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+        sum += v;
+    }
+
+    /* The integer sum can only wrap when values approach 2^64 / STATS_BATCH */
+    double batch_sum = (double)sum;
+    if (max > UINT64_MAX / STATS_BATCH) {
+        batch_sum = 0;
+        for (i = 0; i < n; i++)
+            batch_sum += (double)stats->batch[i];
+    }
+
+    double batch_mean = batch_sum / n;
+    double batch_m2 = 0;
+    for (i = 0; i < n; i++) {
+        uint64_t v = stats->batch[i];
+        double d = (double)v - batch_mean;
+        batch_m2 += d * d;
+        stats->histogram[v == 0 ? 0 : 64 - __builtin_clzll(v)]++;
+    }
+
+    if (stats->count == 0) {
+        stats->min = min;
+        stats->max = max;
+        stats->mean = batch_mean;
+        stats->m2 = batch_m2;
+    } else {
+        double total = (double)stats->count + n;
+        double delta = batch_mean - stats->mean;
+        stats->min = min < stats->min ? min : stats->min;
+        stats->max = max > stats->max ? max : stats->max;
+        stats->mean += delta * n / total;
+        stats->m2 += batch_m2 + delta * delta * (double)stats->count * n / total;
+    }
+    stats->count += n;
+    stats->batch_len = 0;
+}
+
+/**
+ * Function: stats_table_new
+ * -------------------------
+ * @brief  Creates a statistics table for a comma-separated list of columns.
+ *
+ * @param columns Column names: streams, in_spotify_playlists, in_apple_playlists.
+ * @param by_year Keep separate statistics for every release year.
+ *
+ * @return stats_table_t* The table, or NULL if a column name is not valid.
+ *
+ */
+stats_table_t *stats_table_new(char *columns, bool by_year)
+{
+    stats_table_t *table = emalloc(sizeof(stats_table_t));
+    memset(table, 0, sizeof(*table));
+    table->by_year = by_year;
+
+    const char *p = columns;
+    while (*p != '\0') {
+        size_t len = strcspn(p, ",");
+        int column = -1;
+        for (int c = 0; c < STATS_MAX_COLUMNS; c++)
+            if (strlen(column_names[c]) == len && strncmp(column_names[c], p, len) == 0)
+                column = c;
+        if (column < 0 || table->num_columns == STATS_MAX_COLUMNS) {
+            free(table);
+            return NULL;
+        }
+        table->columns[table->num_columns++] = column;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    if (table->num_columns == 0) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+/**
+ * Function: stats_table_add
+ * -------------------------
+ * @brief  Adds one record to the statistics.
+ *
+ * @param table The table.
+ * @param node The record.
+ *
+ */
+void stats_table_add(stats_table_t *table, node_t *node)
+{
+    int group = 0;
+    if (table->by_year) {
+        group = (int)(node->date >> 9) - 1900;
+        if (group < 0)
+            group = 0;
+        else if (group >= STATS_MAX_GROUPS)
+            group = STATS_MAX_GROUPS - 1;
+    }
+
+    stats_t *stats = table->groups[group];
+    if (stats == NULL) {
+        stats = emalloc(table->num_columns * sizeof(stats_t));
+        memset(stats, 0, table->num_columns * sizeof(stats_t));
+        table->groups[group] = stats;
+    }
+
+    for (int c = 0; c < table->num_columns; c++) {
+        stats[c].batch[stats[c].batch_len++] = column_value(node, table->columns[c]);
+        if (stats[c].batch_len == STATS_BATCH)
+            flush_batch(&stats[c]);
+    }
+}
+
+/**
+ * Function: stats_table_write
+ * ---------------------------
+ * @brief  Flushes pending batches and writes the statistics as CSV.
+ *
+ * One row per (year, column); the variance is the sample variance. The
+ * histogram column lists "bucket:count" pairs for non-empty buckets.
+ *
+ * @param table The table.
+ * @param out The file to write to.
+ *
+ */
+void stats_table_write(stats_table_t *table, FILE *out)
+{
+    fputs(table->by_year ? "year,column,count,min,max,mean,variance,histogram\n"
+                         : "column,count,min,max,mean,variance,histogram\n", out);
+
+    for (int g = 0; g < STATS_MAX_GROUPS; g++) {
+        stats_t *stats = table->groups[g];
+        if (stats == NULL)
+            continue;
+        for (int c = 0; c < table->num_columns; c++) {
+            flush_batch(&stats[c]);
+            double variance = stats[c].count > 1 ? stats[c].m2 / (double)(stats[c].count - 1) : 0;
+
+            if (table->by_year)
+                fprintf(out, "%d,", g + 1900);
+            fprintf(out, "%s,%lu,%lu,%lu,%.2f,%.2f,", column_names[table->columns[c]],
+                    (unsigned long)stats[c].count, (unsigned long)stats[c].min,
+                    (unsigned long)stats[c].max, stats[c].mean, variance);
+            const char *sep = "";
+            for (int b = 0; b < STATS_BUCKETS; b++) {
+                if (stats[c].histogram[b] == 0)
+                    continue;
+                fprintf(out, "%s%d:%lu", sep, b, (unsigned long)stats[c].histogram[b]);
+                sep = ";";
+            }
+            fputc('\n', out);
+        }
+    }
+}
+
+/**
+ * Function: stats_table_free
+ * --------------------------
+ * @brief  Frees a statistics table.
+ *
+ * @param table The table to free.
+ *
+ */
+void stats_table_free(stats_table_t *table)
+{
+    if (table == NULL)
+        return;
+    for (int g = 0; g < STATS_MAX_GROUPS; g++)
+        free(table->groups[g]);
+    free(table);
+}
@@ -0,0 +1,55 @@
+/** @file stats.h
+ *  @brief Function prototypes for single-pass summary statistics.
+ *
+ * Records are fed one at a time; each (group, column) buffers values into a
+ * batch of STATS_BATCH and folds full batches into its running count, min,
+ * max, mean, variance (Chan's parallel update) and log2 histogram.
+ */
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "list.h"
+
+#define STATS_BATCH 256
+#define STATS_BUCKETS 65
+#define STATS_MAX_COLUMNS 3
+#define STATS_MAX_GROUPS 256
+
+/**
+ * @brief Running statistics of one numeric column.
+ */
+typedef struct stats_t
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double mean;
+    double m2;
+    uint64_t histogram[STATS_BUCKETS];
+    uint64_t batch[STATS_BATCH];
+    uint32_t batch_len;
+} stats_t;
+
+/**
+ * @brief Statistics for a set of columns, optionally grouped by release year.
+ */
+typedef struct stats_table_t
+{
+    int num_columns;
+    int columns[STATS_MAX_COLUMNS];
+    bool by_year;
+    stats_t *groups[STATS_MAX_GROUPS];
+} stats_table_t;
+
+/**
+ * Function protypes associated with summary statistics.
+ */
+stats_table_t *stats_table_new(char *columns, bool by_year);
+void stats_table_add(stats_table_t *table, node_t *node);
+void stats_table_write(stats_table_t *table, FILE *out);
+void stats_table_free(stats_table_t *table);
+
+#endif
@@ -0,0 +1,245 @@
+/** @file store.c
+ *  @brief Implementation of the append-only in-memory column store.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "store.h"
+
+#define STORE_INITIAL_CHUNKS 16
+
+static uint64_t hash_string(const char *s)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (; *s != '\0'; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+static void grow_slots(store_t *store)
+{
+    free(store->artist_slots);
+    store->num_slots = store->num_slots == 0 ? 1024 : store->num_slots * 2;
+    store->artist_slots = emalloc(store->num_slots * sizeof(uint32_t));
+    memset(store->artist_slots, 0xff, store->num_slots * sizeof(uint32_t));
+    for (uint32_t id = 0; id < store->artist_count; id++) {
+        uint32_t slot = (uint32_t)hash_string(store->artists[id]) & (store->num_slots - 1);
+        while (store->artist_slots[slot] != UINT32_MAX)
+            slot = (slot + 1) & (store->num_slots - 1);
+        store->artist_slots[slot] = id;
+    }
+}
+
+/**
+ * @brief Returns the id of an artist, copying it into the store the first time it is seen.
+ */
+static uint32_t intern_artist(store_t *store, const char *artist)
+{
+    uint32_t slot = (uint32_t)hash_string(artist) & (store->num_slots - 1);
+    while (store->artist_slots[slot] != UINT32_MAX) {
+        uint32_t id = store->artist_slots[slot];
+        if (strcmp(store->artists[id], artist) == 0)
+            return id;
+        slot = (slot + 1) & (store->num_slots - 1);
+    }
+
+    if (store->artist_count == store->artist_cap) {
+        store->artist_cap = store->artist_cap == 0 ? 256 : store->artist_cap * 2;
+        store->artists = realloc(store->artists, store->artist_cap * sizeof(char *));
+        assert(store->artists != NULL && "store->artists == NULL");
+    }
+    uint32_t id = store->artist_count++;
+    store->artists[id] = strdup(artist);
+    store->artist_slots[slot] = id;
+    if (store->artist_count * 2 > store->num_slots)
+        grow_slots(store);
+    return id;
+}
+
+static store_dir_t *new_dir(uint32_t capacity)
+{
+    store_dir_t *dir = emalloc(sizeof(store_dir_t) + capacity * sizeof(store_chunk_t *));
+    dir->capacity = capacity;
+    memset(dir->chunks, 0, capacity * sizeof(store_chunk_t *));
+    return dir;
+}
+
+/**
+ * Function: store_new
+ * -------------------
+ * @brief  Creates an empty store.
+ *
+ * @param epoch The epoch domain readers of the store enter.
+ *
+ * @return store_t* The new store.
+ *
+ */
+store_t *store_new(epoch_t *epoch)
+{
+    store_t *store = emalloc(sizeof(store_t));
+    store->epoch = epoch;
+    store->dir = new_dir(STORE_INITIAL_CHUNKS);
+    store->num_rows = 0;
+    store->length = 0;
+    store->num_artists = 0;
+    store->artists = NULL;
+    store->artist_count = 0;
+    store->artist_cap = 0;
+    store->artist_slots = NULL;
+    store->num_slots = 0;
+    grow_slots(store);
+    return store;
+}
+
+/**
+ * Function: store_append
+ * ----------------------
+ * @brief  Appends a record. It is not visible to readers until store_publish.
+ *
+ * Only one thread may append to a store.
+ *
+ * @param store The store.
+ * @param node The record to copy.
+ *
+ */
+void store_append(store_t *store, const node_t *node)
+{
+    uint64_t row = store->length;
+    uint32_t c = (uint32_t)(row / STORE_CHUNK_ROWS);
+    uint32_t i = (uint32_t)(row % STORE_CHUNK_ROWS);
+
+    if (c == store->dir->capacity) {
+        /*--Readers may still be scanning the old directory; retire it instead of freeing--*/
+        store_dir_t *old = store->dir;
+        store_dir_t *dir = new_dir(old->capacity * 2);
+        memcpy(dir->chunks, old->chunks, old->capacity * sizeof(store_chunk_t *));
+        __atomic_store_n(&store->dir, dir, __ATOMIC_RELEASE);
+        epoch_retire(store->epoch, old, free);
+    }
+    if (store->dir->chunks[c] == NULL)
+        __atomic_store_n(&store->dir->chunks[c], emalloc(sizeof(store_chunk_t)), __ATOMIC_RELEASE);
+
+    store_chunk_t *chunk = store->dir->chunks[c];
+    chunk->streams[i] = node->streams;
+    chunk->in_spotify_playlists[i] = node->in_spotify_playlists;
+    chunk->in_apple_playlists[i] = node->in_apple_playlists;
+    chunk->date[i] = node->date;
+    chunk->artist_count[i] = node->artist_count;
+    chunk->track_name[i] = strdup(node_track_name(node));
+    chunk->artist_id[i] = intern_artist(store, node_artist(node));
+    chunk->artist[i] = store->artists[chunk->artist_id[i]];
+    store->length++;
+}
+
+/**
+ * Function: store_publish
+ * -----------------------
+ * @brief  Makes every appended record visible to new snapshots at once.
+ *
+ * @param store The store.
+ *
+ */
+void store_publish(store_t *store)
+{
+    __atomic_store_n(&store->num_artists, store->artist_count, __ATOMIC_RELEASE);
+    __atomic_store_n(&store->num_rows, store->length, __ATOMIC_RELEASE);
+}
+
+/**
+ * Function: store_snapshot
+ * ------------------------
+ * @brief  Takes a consistent view of the published rows.
+ *
+ * The row count is loaded before the directory and the artist count: every
+ * directory and artist count published after a row count covers those rows.
+ * Call between epoch_enter and epoch_exit, and only use the snapshot until
+ * epoch_exit.
+ *
+ * @param store The store.
+ * @param snap The snapshot to fill.
+ *
+ */
+void store_snapshot(store_t *store, store_snapshot_t *snap)
+{
+    snap->num_rows = __atomic_load_n(&store->num_rows, __ATOMIC_ACQUIRE);
+    snap->dir = __atomic_load_n(&store->dir, __ATOMIC_ACQUIRE);
+    snap->num_artists = __atomic_load_n(&store->num_artists, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Function: store_to_node
+ * -----------------------
+ * @brief  Creates a node holding the numeric fields of a row.
+ *
+ * Strings are left empty until store_fill_strings is called.
+ *
+ * @param snap The snapshot.
+ * @param row The row index, which becomes the node's row_id.
+ *
+ * @return node_t* The new node.
+ *
+ */
+node_t *store_to_node(const store_snapshot_t *snap, uint64_t row)
+{
+    const store_chunk_t *chunk = store_chunk(snap, row);
+    uint32_t i = (uint32_t)(row % STORE_CHUNK_ROWS);
+
+    node_t *node = new_node();
+    node->artist_count = chunk->artist_count[i];
+    node->date = chunk->date[i];
+    node->in_spotify_playlists = (unsigned int)chunk->in_spotify_playlists[i];
+    node->streams = chunk->streams[i];
+    node->in_apple_playlists = (unsigned int)chunk->in_apple_playlists[i];
+    node->row_id = (unsigned int)row;
+    node->artist_id = chunk->artist_id[i];
+    return node;
+}
+
+/**
+ * Function: store_fill_strings
+ * ----------------------------
+ * @brief  Points a node at the track name and artist of its row.
+ *
+ * The strings are read in place, so they may only be used until the
+ * epoch the snapshot was taken in is left.
+ *
+ * @param snap The snapshot the node was created from.
+ * @param node The node to fill, identified by its row_id.
+ * @param arena The arena the node's string references are allocated from.
+ *
+ */
+void store_fill_strings(const store_snapshot_t *snap, node_t *node, arena_t *arena)
+{
+    const store_chunk_t *chunk = store_chunk(snap, node->row_id);
+    uint32_t i = node->row_id % STORE_CHUNK_ROWS;
+
+    node_set_strings(node, arena, chunk->track_name[i], chunk->artist[i]);
+}
+
+/**
+ * Function: store_free
+ * --------------------
+ * @brief  Frees a store and every row in it.
+ *
+ * Takes a void pointer so a whole store can be passed to epoch_retire.
+ *
+ * @param store The store to free.
+ *
+ */
+void store_free(void *store)
+{
+    store_t *s = (store_t *)store;
+    if (s == NULL)
+        return;
+    for (uint64_t row = 0; row < s->length; row++)
+        free(s->dir->chunks[row / STORE_CHUNK_ROWS]->track_name[row % STORE_CHUNK_ROWS]);
+    for (uint32_t id = 0; id < s->artist_count; id++)
+        free(s->artists[id]);
+    free(s->artists);
+    free(s->artist_slots);
+    for (uint32_t c = 0; c < s->dir->capacity && s->dir->chunks[c] != NULL; c++)
+        free(s->dir->chunks[c]);
+    free(s->dir);
+    free(s);
+}
@@ -0,0 +1,98 @@
+/** @file store.h
+ *  @brief Function prototypes for the append-only in-memory column store.
+ *
+ * Rows are stored column by column in chunks of STORE_CHUNK_ROWS. A single
+ * writer appends rows and then publishes the new row count with a release
+ * store; readers take a snapshot (the row count, then the chunk directory)
+ * with acquire loads and see exactly the rows published before it, without
+ * taking a lock. Published rows are never modified.
+ *
+ * Growing the chunk directory replaces it with a larger copy; the old one
+ * is retired through the store's epoch domain, so snapshots must be taken
+ * and used between epoch_enter and epoch_exit.
+ *
+ * Artists are interned: equal artists share one string and one artist_id,
+ * numbered from 0 in order of first appearance, so artist filters can be
+ * decided once per artist instead of once per row.
+ */
+#ifndef _STORE_H_
+#define _STORE_H_
+
+#include <stdint.h>
+#include "epoch.h"
+#include "list.h"
+
+#define STORE_CHUNK_ROWS 4096
+
+/**
+ * @brief The columns of STORE_CHUNK_ROWS consecutive rows.
+ */
+typedef struct store_chunk_t
+{
+    uint64_t streams[STORE_CHUNK_ROWS];
+    uint64_t in_spotify_playlists[STORE_CHUNK_ROWS];
+    uint64_t in_apple_playlists[STORE_CHUNK_ROWS];
+    uint32_t date[STORE_CHUNK_ROWS];
+    uint32_t artist_count[STORE_CHUNK_ROWS];
+    uint32_t artist_id[STORE_CHUNK_ROWS];
+    char *track_name[STORE_CHUNK_ROWS];
+    const char *artist[STORE_CHUNK_ROWS];
+} store_chunk_t;
+
+/**
+ * @brief The chunk directory. Slots past the last chunk are NULL.
+ */
+typedef struct store_dir_t
+{
+    uint32_t capacity;
+    store_chunk_t *chunks[];
+} store_dir_t;
+
+/**
+ * @brief The store. num_rows and num_artists are published by the writer; length, the interned
+ *        artists and their hash slots are private to it.
+ */
+typedef struct store_t
+{
+    epoch_t *epoch;
+    store_dir_t *dir;
+    uint64_t num_rows;
+    uint64_t length;
+    uint32_t num_artists;
+    char **artists;
+    uint32_t artist_count;
+    uint32_t artist_cap;
+    uint32_t *artist_slots;
+    uint32_t num_slots;
+} store_t;
+
+/**
+ * @brief A consistent view of the rows published at one point in time.
+ */
+typedef struct store_snapshot_t
+{
+    const store_dir_t *dir;
+    uint64_t num_rows;
+    uint32_t num_artists;
+} store_snapshot_t;
+
+/**
+ * @brief Returns the chunk holding a row of a snapshot.
+ */
+static inline const store_chunk_t *store_chunk(const store_snapshot_t *snap, uint64_t row)
+{
+    return snap->dir->chunks[row / STORE_CHUNK_ROWS];
+}
+
+/**
+ * Function protypes associated with the column store.
+ */
+store_t *store_new(epoch_t *epoch);
+void store_append(store_t *store, const node_t *node);
+void store_publish(store_t *store);
+void store_snapshot(store_t *store, store_snapshot_t *snap);
+node_t *store_to_node(const store_snapshot_t *snap, uint64_t row);
+void store_fill_strings(const store_snapshot_t *snap, node_t *node, arena_t *arena);
+void store_free(void *store);
+
+#endif
@@ -0,0 +1,540 @@
+/** @file trigram.c
+ *  @brief Implementation of the trigram search index.
+ *
+ * Strings are lower-cased (ASCII) when interned. Each distinct trigram of a
+ * string is hashed into one of 2^TRIGRAM_BUCKET_BITS buckets, with ids
+ * ascending inside a bucket. In memory every bucket is a growable list, so
+ * adding a string only appends its id to the lists of its trigrams. Written
+ * out, only the non-empty buckets are kept, as one compressed posting array
+ * (starts marks where each listed bucket begins), and the row strings are
+ * bit packed.
+ *
+ * A query of m characters has m - 2 trigrams and every edit destroys at
+ * most three of them, so a string within k edits must share at least
+ * (distinct query trigrams - 3k) buckets with the query (the q-gram lemma).
+ * Strings that pass the count are verified with Sellers' approximate
+ * substring algorithm, cut off at k edits.
+ *
+ * Layout of a written index (host byte order, each part padded to 8 bytes):
+ *
+ *   trigram_file_t
+ *   u32 offsets[num_strings + 1], string bytes
+ *   u32 keys[num_keys], u32 starts[num_keys + 1], u32 postings[num_postings]
+ *   packed string id of every row (row_bits per row)
+ */
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitpack.h"
+#include "emalloc.h"
+#include "trigram.h"
+
+#define NUM_BUCKETS (1u << TRIGRAM_BUCKET_BITS)
+#define MAX_PATTERN 200
+
+/**
+ * @brief The header of a written index.
+ */
+typedef struct trigram_file_t
+{
+    uint32_t num_strings;
+    uint32_t num_keys;
+    uint64_t num_rows;
+    uint64_t num_bytes;
+    uint32_t num_postings;
+    uint32_t row_bits;
+} trigram_file_t;
+
+static uint64_t hash_string(const char *s)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (; *s != '\0'; s++)
+        h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+static uint32_t trigram_bucket(const char *p)
+{
+    uint32_t key = (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+    return (key * 2654435761u) >> (32 - TRIGRAM_BUCKET_BITS);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes the distinct trigram buckets of s into out, returns how many.
+ */
+static uint32_t distinct_buckets(const char *s, size_t len, uint32_t *out)
+{
+    uint32_t n = 0;
+
+    for (size_t i = 0; i + 3 <= len; i++)
+        out[n++] = trigram_bucket(s + i);
+    qsort(out, n, sizeof(uint32_t), compare_u32);
+
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < n; i++)
+        if (k == 0 || out[k - 1] != out[i])
+            out[k++] = out[i];
+    return k;
+}
+
+static char *normalize(const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = emalloc(len + 1);
+    for (size_t i = 0; i <= len; i++)
+        copy[i] = (char)tolower((unsigned char)s[i]);
+    return copy;
+}
+
+static const char *string_at(const trigram_index_t *index, uint32_t id)
+{
+    return index->bytes + index->offsets[id];
+}
+
+static void grow_slots(trigram_index_t *index)
+{
+    free(index->slots);
+    index->num_slots = index->num_slots == 0 ? 1024 : index->num_slots * 2;
+    index->slots = emalloc(index->num_slots * sizeof(uint32_t));
+    memset(index->slots, 0xff, index->num_slots * sizeof(uint32_t));
+    for (uint32_t id = 0; id < index->num_strings; id++) {
+        uint32_t slot = (uint32_t)hash_string(string_at(index, id)) & (index->num_slots - 1);
+        while (index->slots[slot] != UINT32_MAX)
+            slot = (slot + 1) & (index->num_slots - 1);
+        index->slots[slot] = id;
+    }
+}
+
+/**
+ * @brief Returns the posting list of a bucket, or NULL (with *len 0) if it is empty.
+ */
+static const uint32_t *bucket_postings(const trigram_index_t *index, uint32_t bucket, uint32_t *len)
+{
+    if (!index->mapped) {
+        *len = index->lists[bucket].len;
+        return index->lists[bucket].ids;
+    }
+    uint32_t lo = 0, hi = index->num_keys;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index->keys[mid] < bucket)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == index->num_keys || index->keys[lo] != bucket) {
+        *len = 0;
+        return NULL;
+    }
+    *len = index->starts[lo + 1] - index->starts[lo];
+    return index->postings + index->starts[lo];
+}
+
+/**
+ * @brief Returns true if pattern occurs in text with at most k edits.
+ */
+static bool within_edits(const char *pattern, size_t m, const char *text, int k)
+{
+    int col[MAX_PATTERN + 1];
+
+    if ((int)m <= k)
+        return true;
+    for (size_t i = 0; i <= m; i++)
+        col[i] = (int)i;
+
+    for (; *text != '\0'; text++) {
+        int diag = col[0];
+        col[0] = 0;
+        for (size_t i = 1; i <= m; i++) {
+            int above = col[i];
+            int cost = diag + (pattern[i - 1] != *text);
+            int v = above + 1 < col[i - 1] + 1 ? above + 1 : col[i - 1] + 1;
+            col[i] = cost < v ? cost : v;
+            diag = above;
+        }
+        if (col[m] <= k)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Function: trigram_new
+ * ---------------------
+ * @brief  Creates an empty in-memory index.
+ *
+ * @return trigram_index_t* The new index.
+ *
+ */
+trigram_index_t *trigram_new(void)
+{
+    trigram_index_t *index = emalloc(sizeof(trigram_index_t));
+    memset(index, 0, sizeof(*index));
+    index->lists = calloc(NUM_BUCKETS, sizeof(trigram_list_t));
+    assert(index->lists != NULL && "index->lists == NULL");
+    grow_slots(index);
+    return index;
+}
+
+/**
+ * Function: trigram_add
+ * ---------------------
+ * @brief  Interns a string, returning the id of an equal earlier string if
+ *         there is one.
+ *
+ * Strings are compared after normalization, so ids are case-insensitive. A
+ * new string is added to the posting lists of its trigrams right away.
+ *
+ * @param index An in-memory index.
+ * @param s The string to add.
+ *
+ * @return uint32_t The string id.
+ *
+ */
+uint32_t trigram_add(trigram_index_t *index, const char *s)
+{
+    char *norm = normalize(s);
+    uint32_t slot = (uint32_t)hash_string(norm) & (index->num_slots - 1);
+
+    while (index->slots[slot] != UINT32_MAX) {
+        uint32_t id = index->slots[slot];
+        if (strcmp(string_at(index, id), norm) == 0) {
+            free(norm);
+            return id;
+        }
+        slot = (slot + 1) & (index->num_slots - 1);
+    }
+
+    size_t len = strlen(norm);
+    if (index->num_bytes + len + 1 > index->cap_bytes) {
+        while (index->num_bytes + len + 1 > index->cap_bytes)
+            index->cap_bytes = index->cap_bytes == 0 ? 4096 : index->cap_bytes * 2;
+        index->bytes = realloc(index->bytes, index->cap_bytes);
+        assert(index->bytes != NULL && "index->bytes == NULL");
+    }
+    if (index->num_strings + 1 >= index->cap_strings) {
+        index->cap_strings = index->cap_strings == 0 ? 256 : index->cap_strings * 2;
+        index->offsets = realloc(index->offsets, index->cap_strings * sizeof(uint32_t));
+        assert(index->offsets != NULL && "index->offsets == NULL");
+    }
+    uint32_t id = index->num_strings;
+    index->offsets[id] = (uint32_t)index->num_bytes;
+    memcpy(index->bytes + index->num_bytes, norm, len + 1);
+    index->num_bytes += len + 1;
+    index->offsets[id + 1] = (uint32_t)index->num_bytes;
+    index->slots[slot] = id;
+    index->num_strings++;
+    if (index->num_strings * 2 > index->num_slots)
+        grow_slots(index);
+
+    uint32_t buckets[MAX_PATTERN];
+    uint32_t n = distinct_buckets(norm, strnlen(norm, MAX_PATTERN - 1), buckets);
+    for (uint32_t i = 0; i < n; i++) {
+        trigram_list_t *list = &index->lists[buckets[i]];
+        if (list->len == list->cap) {
+            list->cap = list->cap == 0 ? 4 : list->cap * 2;
+            list->ids = realloc(list->ids, list->cap * sizeof(uint32_t));
+            assert(list->ids != NULL && "list->ids == NULL");
+        }
+        list->ids[list->len++] = id;
+    }
+    free(norm);
+    return id;
+}
+
+/**
+ * Function: trigram_add_row
+ * -------------------------
+ * @brief  Adds the next row, interning its string.
+ *
+ * @param index An in-memory index.
+ * @param s The row's string.
+ *
+ */
+void trigram_add_row(trigram_index_t *index, const char *s)
+{
+    uint32_t id = trigram_add(index, s);
+    if (index->num_rows == index->cap_rows) {
+        index->cap_rows = index->cap_rows == 0 ? 4096 : index->cap_rows * 2;
+        index->rows = realloc(index->rows, index->cap_rows * sizeof(uint32_t));
+        assert(index->rows != NULL && "index->rows == NULL");
+    }
+    index->rows[index->num_rows++] = id;
+}
+
+/**
+ * Function: trigram_search
+ * ------------------------
+ * @brief  Finds the strings containing query with at most max_edits edits.
+ *
+ * @param index The index.
+ * @param query The text to look for (matched case-insensitively).
+ * @param max_edits The largest edit distance accepted.
+ * @param out Receives the matching ids in ascending order; must have room
+ *            for every string in the index.
+ *
+ * @return uint32_t The number of ids written to out.
+ *
+ */
+uint32_t trigram_search(trigram_index_t *index, const char *query, int max_edits, uint32_t *out)
+{
+    uint32_t buckets[MAX_PATTERN];
+    char *pattern = normalize(query);
+    size_t m = strnlen(pattern, MAX_PATTERN - 1);
+    uint32_t num_buckets = distinct_buckets(pattern, m, buckets);
+    int threshold = (int)num_buckets - 3 * max_edits;
+    uint32_t num_touched = 0;
+    uint32_t k = 0;
+
+    pattern[m] = '\0';
+    if (threshold <= 0) {
+        /* Too short or too many edits for the lemma: verify every string */
+        for (uint32_t id = 0; id < index->num_strings; id++)
+            if (within_edits(pattern, m, string_at(index, id), max_edits))
+                out[k++] = id;
+        free(pattern);
+        return k;
+    }
+
+    /* Per-search counters, so concurrent searches do not share state */
+    uint16_t *counts = calloc(index->num_strings + 1, sizeof(uint16_t));
+    uint32_t *touched = emalloc((index->num_strings + 1) * sizeof(uint32_t));
+    assert(counts != NULL && "counts == NULL");
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        uint32_t len;
+        const uint32_t *p = bucket_postings(index, buckets[i], &len);
+        for (const uint32_t *end = p + len; p != end; p++)
+            if (counts[*p]++ == 0)
+                touched[num_touched++] = *p;
+    }
+
+    for (uint32_t i = 0; i < num_touched; i++) {
+        uint32_t id = touched[i];
+        if (counts[id] >= threshold && within_edits(pattern, m, string_at(index, id), max_edits))
+            out[k++] = id;
+    }
+    qsort(out, k, sizeof(uint32_t), compare_u32);
+    free(touched);
+    free(counts);
+    free(pattern);
+    return k;
+}
+
+/**
+ * Function: trigram_match
+ * -----------------------
+ * @brief  Marks the strings containing query with at most max_edits edits.
+ *
+ * @param index The index.
+ * @param query The text to look for (matched case-insensitively).
+ * @param max_edits The largest edit distance accepted.
+ *
+ * @return bool* One flag per string id (freed by the caller).
+ *
+ */
+bool *trigram_match(trigram_index_t *index, const char *query, int max_edits)
+{
+    uint32_t *matches = emalloc((index->num_strings + 1) * sizeof(uint32_t));
+    bool *matched = calloc(index->num_strings + 1, sizeof(bool));
+    assert(matched != NULL && "matched == NULL");
+    uint32_t num_matches = trigram_search(index, query, max_edits, matches);
+    for (uint32_t i = 0; i < num_matches; i++)
+        matched[matches[i]] = true;
+    free(matches);
+    return matched;
+}
+
+/**
+ * Function: trigram_rows
+ * ----------------------
+ * @brief  Reads the string ids of consecutive rows.
+ *
+ * @param index The index.
+ * @param first The first row.
+ * @param n The number of rows; first + n must not exceed the rows added.
+ * @param out Receives n string ids.
+ *
+ */
+void trigram_rows(const trigram_index_t *index, uint64_t first, uint32_t n, uint32_t *out)
+{
+    if (!index->mapped) {
+        memcpy(out, index->rows + first, n * sizeof(uint32_t));
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        out[i] = (uint32_t)bitpack_get(index->packed_rows, index->row_bits, (uint32_t)(first + i));
+}
+
+static size_t padding(size_t len)
+{
+    return (8 - len % 8) % 8;
+}
+
+static void put_padded(FILE *out, const void *data, size_t len)
+{
+    static const unsigned char zeros[8] = {0};
+    if (len > 0)
+        fwrite(data, 1, len, out);
+    fwrite(zeros, 1, padding(len), out);
+}
+
+/**
+ * Function: trigram_write
+ * -----------------------
+ * @brief  Writes an in-memory index at the current (8-byte aligned) position of a file.
+ *
+ * @param index The index.
+ * @param out The file.
+ *
+ * @return int 0 on success, -1 if the file could not be written.
+ *
+ */
+int trigram_write(trigram_index_t *index, FILE *out)
+{
+    trigram_file_t header = {0};
+    header.num_strings = index->num_strings;
+    header.num_rows = index->num_rows;
+    header.num_bytes = index->num_bytes;
+    header.row_bits = bitpack_width(index->num_strings > 0 ? index->num_strings - 1 : 0);
+    for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+        if (index->lists[b].len > 0) {
+            header.num_keys++;
+            header.num_postings += index->lists[b].len;
+        }
+    }
+
+    uint32_t *keys = emalloc((header.num_keys + 1) * sizeof(uint32_t));
+    uint32_t *starts = emalloc((header.num_keys + 1) * sizeof(uint32_t));
+    uint32_t k = 0;
+    starts[0] = 0;
+    for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+        if (index->lists[b].len > 0) {
+            keys[k] = b;
+            starts[k + 1] = starts[k] + index->lists[b].len;
+            k++;
+        }
+    }
+
+    uint32_t zero = 0;
+    put_padded(out, &header, sizeof(header));
+    put_padded(out, index->num_strings > 0 ? index->offsets : &zero, (header.num_strings + 1) * sizeof(uint32_t));
+    put_padded(out, index->bytes, index->num_bytes);
+    put_padded(out, keys, header.num_keys * sizeof(uint32_t));
+    put_padded(out, starts, (header.num_keys + 1) * sizeof(uint32_t));
+    for (uint32_t b = 0; b < NUM_BUCKETS; b++)
+        if (index->lists[b].len > 0)
+            fwrite(index->lists[b].ids, sizeof(uint32_t), index->lists[b].len, out);
+    if (header.num_postings % 2 != 0)
+        fwrite(&zero, sizeof(uint32_t), 1, out);
+
+    uint64_t *values = emalloc((header.num_rows + 1) * sizeof(uint64_t));
+    for (uint64_t r = 0; r < header.num_rows; r++)
+        values[r] = index->rows[r];
+    size_t size = bitpack_size((uint32_t)header.num_rows, header.row_bits);
+    unsigned char *packed = emalloc(size);
+    bitpack_pack(values, (uint32_t)header.num_rows, 0, header.row_bits, packed);
+    put_padded(out, packed, size);
+
+    free(packed);
+    free(values);
+    free(starts);
+    free(keys);
+    return ferror(out) ? -1 : 0;
+}
+
+/**
+ * @brief Takes the next len bytes (and their padding) of a written index, or NULL past the end.
+ */
+static const unsigned char *take(const unsigned char *data, size_t size, size_t *pos, size_t len)
+{
+    if (len > size - *pos)
+        return NULL;
+    const unsigned char *p = data + *pos;
+    len += padding(len);
+    *pos = len > size - *pos ? size : *pos + len;
+    return p;
+}
+
+/**
+ * Function: trigram_map
+ * ---------------------
+ * @brief  Opens an index written by trigram_write in place, read-only.
+ *
+ * The index points into data, which must stay mapped until trigram_free.
+ *
+ * @param data The start of the written index, 8-byte aligned.
+ * @param size The bytes available from data on.
+ * @param used Set to the size of the written index.
+ *
+ * @return trigram_index_t* The index, or NULL if the data is truncated or inconsistent.
+ *
+ */
+trigram_index_t *trigram_map(const unsigned char *data, size_t size, size_t *used)
+{
+    trigram_file_t header;
+    size_t pos = 0;
+    const unsigned char *p = take(data, size, &pos, sizeof(header));
+    if (p == NULL)
+        return NULL;
+    memcpy(&header, p, sizeof(header));
+    if (header.row_bits > 32)
+        return NULL;
+
+    trigram_index_t *index = emalloc(sizeof(trigram_index_t));
+    memset(index, 0, sizeof(*index));
+    index->mapped = true;
+    index->num_strings = header.num_strings;
+    index->num_keys = header.num_keys;
+    index->num_rows = header.num_rows;
+    index->num_bytes = header.num_bytes;
+    index->row_bits = header.row_bits;
+    index->offsets = (uint32_t *)take(data, size, &pos, ((size_t)header.num_strings + 1) * sizeof(uint32_t));
+    index->bytes = (char *)take(data, size, &pos, header.num_bytes);
+    index->keys = (const uint32_t *)take(data, size, &pos, (size_t)header.num_keys * sizeof(uint32_t));
+    index->starts = (const uint32_t *)take(data, size, &pos, ((size_t)header.num_keys + 1) * sizeof(uint32_t));
+    index->postings = (const uint32_t *)take(data, size, &pos, (size_t)header.num_postings * sizeof(uint32_t));
+    index->packed_rows = take(data, size, &pos, bitpack_size((uint32_t)header.num_rows, header.row_bits));
+
+    if (index->offsets == NULL || index->bytes == NULL || index->keys == NULL || index->starts == NULL
+        || index->postings == NULL || index->packed_rows == NULL
+        || index->offsets[header.num_strings] != header.num_bytes || index->starts[header.num_keys] != header.num_postings
+        || (header.num_bytes > 0 && index->bytes[header.num_bytes - 1] != '\0')) {
+        free(index);
+        return NULL;
+    }
+    *used = pos;
+    return index;
+}
+
+/**
+ * Function: trigram_free
+ * ----------------------
+ * @brief  Frees an index and every string it interned.
+ *
+ * A mapped index leaves the mapping alone.
+ *
+ * @param index The index to free.
+ *
+ */
+void trigram_free(trigram_index_t *index)
+{
+    if (index == NULL)
+        return;
+    if (!index->mapped) {
+        for (uint32_t b = 0; b < NUM_BUCKETS; b++)
+            free(index->lists[b].ids);
+        free(index->lists);
+        free(index->bytes);
+        free(index->offsets);
+        free(index->slots);
+        free(index->rows);
+    }
+    free(index);
+}
@@ -0,0 +1,77 @@
+/** @file trigram.h
+ *  @brief Function prototypes for the trigram search index.
+ *
+ * The index interns distinct strings (artists or track names), keeps a
+ * posting list of string ids per hashed trigram, and answers
+ * typo-tolerant substring queries: candidates come from posting-list
+ * counting and are verified with a bounded edit distance. It also records
+ * the string of every row added with trigram_add_row, so a search can be
+ * turned into the matching rows without reading the rows themselves.
+ *
+ * An index is either built in memory, where strings and rows can be added
+ * at any time, or mapped read-only from a file written by trigram_write.
+ * Searches may run concurrently with each other, but not with an add.
+ */
+#ifndef _TRIGRAM_H_
+#define _TRIGRAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRIGRAM_BUCKET_BITS 18
+
+/**
+ * @brief The posting list of one bucket of an in-memory index.
+ */
+typedef struct trigram_list_t
+{
+    uint32_t *ids;
+    uint32_t len;
+    uint32_t cap;
+} trigram_list_t;
+
+/**
+ * @brief A trigram index over a set of interned strings and the rows using them.
+ *
+ * In memory the postings are one growable list per bucket; mapped, they are
+ * the non-empty buckets (keys) with where each list starts in postings.
+ */
+typedef struct trigram_index_t
+{
+    char *bytes;
+    size_t num_bytes;
+    size_t cap_bytes;
+    uint32_t *offsets;
+    uint32_t num_strings;
+    uint32_t cap_strings;
+    uint32_t *slots;
+    uint32_t num_slots;
+    trigram_list_t *lists;
+    uint32_t num_keys;
+    const uint32_t *keys;
+    const uint32_t *starts;
+    const uint32_t *postings;
+    uint32_t *rows;
+    uint64_t num_rows;
+    uint64_t cap_rows;
+    const unsigned char *packed_rows;
+    uint32_t row_bits;
+    bool mapped;
+} trigram_index_t;
+
+/**
+ * Function protypes associated with the trigram index.
+ */
+trigram_index_t *trigram_new(void);
+uint32_t trigram_add(trigram_index_t *index, const char *s);
+void trigram_add_row(trigram_index_t *index, const char *s);
+uint32_t trigram_search(trigram_index_t *index, const char *query, int max_edits, uint32_t *out);
+bool *trigram_match(trigram_index_t *index, const char *query, int max_edits);
+void trigram_rows(const trigram_index_t *index, uint64_t first, uint32_t n, uint32_t *out);
+int trigram_write(trigram_index_t *index, FILE *out);
+trigram_index_t *trigram_map(const unsigned char *data, size_t size, size_t *used);
+void trigram_free(trigram_index_t *index);
+
+#endif
@@ -0,0 +1,598 @@
+/** @file tseries.c
+ *  @brief Implementation of the snapshot history (time-series) store.
+ *
+ * Layout of a history file (host byte order, checked through the endian mark):
+ *
+ *   ts_header_t
+ *   snapshot, snapshot, ...   (8-byte aligned, each linked to the one before)
+ *
+ * An append writes the new snapshot at the end of the file and only then
+ * rewrites the header to point at it, so an interrupted append leaves the
+ * file as it was. Appending needs every series' latest values, which are
+ * rebuilt from all snapshots; queries only read what they need.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "tseries.h"
+
+/**
+ * @brief A growable byte buffer.
+ */
+typedef struct buf_t
+{
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+static void buf_put(buf_t *buf, const void *src, size_t len)
+{
+    if (buf->len + len > buf->cap) {
+        buf->cap = (buf->len + len) * 2;
+        buf->data = realloc(buf->data, buf->cap);
+        assert(buf->data != NULL && "buf->data == NULL");
+    }
+    memcpy(buf->data + buf->len, src, len);
+    buf->len += len;
+}
+
+static void buf_put_varint(buf_t *buf, uint64_t value)
+{
+    unsigned char bytes[10];
+    size_t n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (unsigned char)value;
+    buf_put(buf, bytes, n);
+}
+
+static void buf_align(buf_t *buf, size_t align)
+{
+    static const unsigned char zeros[8] = {0};
+    buf_put(buf, zeros, (align - buf->len % align) % align);
+}
+
+/**
+ * @brief Reads a varint, never past end. A truncated varint reads as what was there.
+ */
+static uint64_t get_varint(const unsigned char **p, const unsigned char *end)
+{
+    uint64_t value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            break;
+    }
+    return value;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint32_t hash_key(const char *track, const char *artist)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *s = (const unsigned char *)track; *s != '\0'; s++)
+        h = (h ^ *s) * 16777619u;
+    h = (h ^ 0xffu) * 16777619u;
+    for (const unsigned char *s = (const unsigned char *)artist; *s != '\0'; s++)
+        h = (h ^ *s) * 16777619u;
+    return h;
+}
+
+/**
+ * @brief Returns the hash slot of a key: the slot holding it, or the empty slot it would go to.
+ */
+static uint32_t find_slot(tseries_t *ts, const char *track, const char *artist)
+{
+    uint32_t slot = hash_key(track, artist) & (ts->num_slots - 1);
+    while (ts->slots[slot] != 0) {
+        uint32_t key = ts->slots[slot] - 1;
+        if (strcmp(ts->tracks[key], track) == 0 && strcmp(ts->artists[key], artist) == 0)
+            break;
+        slot = (slot + 1) & (ts->num_slots - 1);
+    }
+    return slot;
+}
+
+/**
+ * @brief Interns a key, returning its id. New keys get the next id; the strings are not copied.
+ */
+static uint32_t intern_key(tseries_t *ts, const char *track, const char *artist)
+{
+    /*--Keep the table at most half full--*/
+    if (2 * (ts->num_keys + 1) > ts->num_slots) {
+        free(ts->slots);
+        ts->num_slots = ts->num_slots == 0 ? 1024 : ts->num_slots * 2;
+        ts->slots = calloc(ts->num_slots, sizeof(uint32_t));
+        assert(ts->slots != NULL && "ts->slots == NULL");
+        for (uint32_t key = 0; key < ts->num_keys; key++)
+            ts->slots[find_slot(ts, ts->tracks[key], ts->artists[key])] = key + 1;
+    }
+
+    uint32_t slot = find_slot(ts, track, artist);
+    if (ts->slots[slot] != 0)
+        return ts->slots[slot] - 1;
+
+    if (ts->num_keys == ts->cap_keys) {
+        ts->cap_keys = ts->cap_keys == 0 ? 1024 : ts->cap_keys * 2;
+        ts->tracks = realloc(ts->tracks, ts->cap_keys * sizeof(const char *));
+        ts->artists = realloc(ts->artists, ts->cap_keys * sizeof(const char *));
+        assert(ts->tracks != NULL && ts->artists != NULL && "ts->tracks == NULL");
+    }
+    ts->tracks[ts->num_keys] = track;
+    ts->artists[ts->num_keys] = artist;
+    ts->slots[slot] = ++ts->num_keys;
+    return ts->num_keys - 1;
+}
+
+/**
+ * @brief Reads the entries of a snapshot in key order.
+ */
+typedef struct ts_cursor_t
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    uint32_t entry;
+    uint32_t num_entries;
+    uint32_t key;
+} ts_cursor_t;
+
+static const ts_index_t *snapshot_index(const ts_snapshot_t *snap)
+{
+    return (const ts_index_t *)((const unsigned char *)snap + snap->index_offset);
+}
+
+static uint32_t snapshot_restarts(const ts_snapshot_t *snap)
+{
+    return (snap->num_entries + TS_INDEX_INTERVAL - 1) / TS_INDEX_INTERVAL;
+}
+
+static void cursor_start(ts_cursor_t *c, const ts_snapshot_t *snap, uint32_t restart)
+{
+    const unsigned char *entries = (const unsigned char *)snap + snap->entries_offset;
+    c->p = entries + (restart > 0 ? snapshot_index(snap)[restart].offset : 0);
+    c->end = entries + snap->entries_size;
+    c->entry = restart * TS_INDEX_INTERVAL;
+    c->num_entries = snap->num_entries;
+    c->key = 0;
+}
+
+static bool cursor_next(ts_cursor_t *c, int64_t deltas[TS_NUM_VALUES])
+{
+    if (c->entry >= c->num_entries || c->p >= c->end)
+        return false;
+    uint64_t gap = get_varint(&c->p, c->end);
+    c->key = c->entry++ % TS_INDEX_INTERVAL == 0 ? (uint32_t)gap : c->key + (uint32_t)gap;
+    for (int v = 0; v < TS_NUM_VALUES; v++)
+        deltas[v] = unzigzag(get_varint(&c->p, c->end));
+    return true;
+}
+
+/**
+ * Function: tseries_open
+ * ----------------------
+ * @brief  Maps a history file, validates it and loads its key table.
+ *
+ * @param path The history file to open.
+ *
+ * @return tseries_t* The opened file, or NULL if it is missing, truncated,
+ *         from another version, or written with a different byte order.
+ *
+ */
+tseries_t *tseries_open(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ts_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    tseries_t *ts = emalloc(sizeof(tseries_t));
+    memset(ts, 0, sizeof(tseries_t));
+    ts->base = base;
+    ts->size = (size_t)st.st_size;
+    ts->header = base;
+
+    const ts_header_t *h = ts->header;
+    if (memcmp(h->magic, TS_MAGIC, 4) != 0 || h->version != TS_VERSION || h->endian_mark != TS_ENDIAN_MARK
+        || h->num_keys > UINT32_MAX || h->num_snapshots > ts->size / sizeof(ts_snapshot_t)) {
+        tseries_close(ts);
+        return NULL;
+    }
+
+    /*--Walk the snapshots back from the last one, checking each fits in the file--*/
+    ts->num_snapshots = h->num_snapshots;
+    ts->snapshots = emalloc((ts->num_snapshots + 1) * sizeof(const ts_snapshot_t *));
+    uint64_t offset = h->last_snapshot;
+    for (uint32_t s = ts->num_snapshots; s-- > 0;) {
+        const ts_snapshot_t *snap = (const ts_snapshot_t *)(ts->base + offset);
+        if (offset % 8 != 0 || offset < sizeof(ts_header_t) || offset + sizeof(ts_snapshot_t) > ts->size
+            || snap->size > ts->size - offset || snap->keys_offset < sizeof(ts_snapshot_t)
+            || snap->keys_offset > snap->index_offset || snap->index_offset % 4 != 0
+            || snap->index_offset + (uint64_t)snapshot_restarts(snap) * sizeof(ts_index_t) > snap->entries_offset
+            || (uint64_t)snap->entries_offset + snap->entries_size > snap->size
+            || memchr((const char *)snap + sizeof(ts_snapshot_t), '\0', snap->keys_offset - sizeof(ts_snapshot_t)) == NULL
+            || (s > 0 && snap->prev >= offset)) {
+            tseries_close(ts);
+            return NULL;
+        }
+        ts->snapshots[s] = snap;
+        offset = snap->prev;
+    }
+
+    /*--Intern the keys in id order; each snapshot lists the keys it saw first--*/
+    for (uint32_t s = 0; s < ts->num_snapshots; s++) {
+        const ts_snapshot_t *snap = ts->snapshots[s];
+        const char *p = (const char *)snap + snap->keys_offset;
+        const char *end = (const char *)snap + snap->index_offset;
+        if (snap->first_key != ts->num_keys) {
+            tseries_close(ts);
+            return NULL;
+        }
+        for (uint32_t i = 0; i < snap->num_new_keys; i++) {
+            const char *track = p;
+            const char *artist = p < end ? memchr(p, '\0', end - p) : NULL;
+            const char *next = artist != NULL && ++artist < end ? memchr(artist, '\0', end - artist) : NULL;
+            if (next == NULL || intern_key(ts, track, artist) != ts->num_keys - 1) {
+                tseries_close(ts);
+                return NULL;
+            }
+            p = next + 1;
+        }
+    }
+    if (ts->num_keys != h->num_keys) {
+        tseries_close(ts);
+        return NULL;
+    }
+    return ts;
+}
+
+/**
+ * Function: tseries_close
+ * -----------------------
+ * @brief  Unmaps a history file and frees its key table.
+ *
+ * @param ts The opened file, or NULL.
+ *
+ */
+void tseries_close(tseries_t *ts)
+{
+    if (ts == NULL)
+        return;
+    if (ts->base != NULL)
+        munmap((void *)ts->base, ts->size);
+    free(ts->snapshots);
+    free(ts->tracks);
+    free(ts->artists);
+    free(ts->slots);
+    free(ts);
+}
+
+/**
+ * Function: tseries_label
+ * -----------------------
+ * @brief  Returns the label a snapshot was appended with.
+ *
+ * @param ts The opened file.
+ * @param snapshot The snapshot, 0 for the oldest.
+ *
+ * @return const char* The label.
+ *
+ */
+const char *tseries_label(tseries_t *ts, uint32_t snapshot)
+{
+    return (const char *)ts->snapshots[snapshot] + sizeof(ts_snapshot_t);
+}
+
+/**
+ * @brief An entry of the snapshot being appended.
+ */
+typedef struct ts_entry_t
+{
+    uint32_t key;
+    uint64_t values[TS_NUM_VALUES];
+} ts_entry_t;
+
+static int compare_entries(const void *a, const void *b)
+{
+    uint32_t x = ((const ts_entry_t *)a)->key;
+    uint32_t y = ((const ts_entry_t *)b)->key;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Function: tseries_append
+ * ------------------------
+ * @brief  Appends the records of a list to a history file as a new snapshot.
+ *
+ * The file is created if it does not exist. When a (track, artist) pair
+ * appears more than once in the list, its first record is used.
+ *
+ * @param path The history file.
+ * @param list The records of the snapshot.
+ * @param label The label of the snapshot, e.g. its chart date.
+ *
+ * @return int 0 on success, -1 if the file is not a valid history file or
+ *         could not be written.
+ *
+ */
+int tseries_append(const char *path, node_t *list, const char *label)
+{
+    tseries_t empty = {0};
+    tseries_t *ts = tseries_open(path);
+    if (ts == NULL) {
+        if (access(path, F_OK) == 0)
+            return -1;
+        ts = &empty;
+    }
+    uint32_t old_keys = ts->num_keys;
+
+    /*--Rebuild the latest values of every series, the base of the new deltas--*/
+    uint64_t (*latest)[TS_NUM_VALUES] = calloc(old_keys + 1, sizeof(*latest));
+    assert(latest != NULL && "latest == NULL");
+    for (uint32_t s = 0; s < ts->num_snapshots; s++) {
+        ts_cursor_t c;
+        int64_t deltas[TS_NUM_VALUES];
+        cursor_start(&c, ts->snapshots[s], 0);
+        while (cursor_next(&c, deltas))
+            for (int v = 0; v < TS_NUM_VALUES && c.key < old_keys; v++)
+                latest[c.key][v] += (uint64_t)deltas[v];
+    }
+
+    /*--Intern the records' keys, keeping the first record of each--*/
+    size_t num_records = 0;
+    for (node_t *curr = list; curr != NULL; curr = curr->next)
+        num_records++;
+    ts_entry_t *entries = emalloc((num_records + 1) * sizeof(ts_entry_t));
+    unsigned char *seen = calloc(old_keys + num_records + 1, 1);
+    assert(seen != NULL && "seen == NULL");
+    size_t num_entries = 0;
+    for (node_t *curr = list; curr != NULL; curr = curr->next) {
+        uint32_t key = intern_key(ts, node_track_name(curr), node_artist(curr));
+        if (seen[key])
+            continue;
+        seen[key] = 1;
+        ts_entry_t *e = &entries[num_entries++];
+        e->key = key;
+        e->values[TS_STREAMS] = curr->streams;
+        e->values[TS_SPOTIFY] = curr->in_spotify_playlists;
+        e->values[TS_APPLE] = curr->in_apple_playlists;
+    }
+    free(seen);
+    qsort(entries, num_entries, sizeof(ts_entry_t), compare_entries);
+
+    /*--Encode the snapshot: header, label, new keys, restart index, entries--*/
+    ts_snapshot_t snap = {0};
+    buf_t buf = {0};
+    buf_t stream = {0};
+    buf_put(&buf, &snap, sizeof(snap));
+    buf_put(&buf, label, strlen(label) + 1);
+    snap.keys_offset = (uint32_t)buf.len;
+    for (uint32_t key = old_keys; key < ts->num_keys; key++) {
+        buf_put(&buf, ts->tracks[key], strlen(ts->tracks[key]) + 1);
+        buf_put(&buf, ts->artists[key], strlen(ts->artists[key]) + 1);
+    }
+    buf_align(&buf, 4);
+    snap.index_offset = (uint32_t)buf.len;
+    uint32_t prev_key = 0;
+    for (size_t i = 0; i < num_entries; i++) {
+        ts_entry_t *e = &entries[i];
+        if (i % TS_INDEX_INTERVAL == 0) {
+            ts_index_t restart = {e->key, (uint32_t)stream.len};
+            buf_put(&buf, &restart, sizeof(restart));
+            prev_key = 0;
+        }
+        buf_put_varint(&stream, e->key - prev_key);
+        prev_key = e->key;
+        for (int v = 0; v < TS_NUM_VALUES; v++) {
+            uint64_t base = e->key < old_keys ? latest[e->key][v] : 0;
+            buf_put_varint(&stream, zigzag((int64_t)(e->values[v] - base)));
+        }
+    }
+    snap.entries_offset = (uint32_t)buf.len;
+    snap.entries_size = (uint32_t)stream.len;
+    if (stream.len > 0)
+        buf_put(&buf, stream.data, stream.len);
+    buf_align(&buf, 8);
+
+    snap.size = buf.len;
+    snap.first_key = old_keys;
+    snap.num_new_keys = ts->num_keys - old_keys;
+    snap.num_entries = (uint32_t)num_entries;
+
+    /*--Write the snapshot after the last byte of the file, then point the header at it--*/
+    ts_header_t header = {{0}};
+    memcpy(header.magic, TS_MAGIC, 4);
+    header.version = TS_VERSION;
+    header.endian_mark = TS_ENDIAN_MARK;
+    header.num_snapshots = ts->num_snapshots + 1;
+    header.num_keys = ts->num_keys;
+
+    int status = -1;
+    FILE *out = fopen(path, ts == &empty ? "w+b" : "r+b");
+    if (out != NULL) {
+        if (ts == &empty)
+            fwrite(&header, sizeof(header), 1, out);
+        fseek(out, 0, SEEK_END);
+        long end = ftell(out);
+        header.last_snapshot = (uint64_t)(end + 7) / 8 * 8;
+        snap.prev = ts == &empty ? 0 : ts->header->last_snapshot;
+        memcpy(buf.data, &snap, sizeof(snap));
+        for (long pad = end; pad < (long)header.last_snapshot; pad++)
+            fputc(0, out);
+        fwrite(buf.data, 1, buf.len, out);
+        if (fflush(out) == 0 && !ferror(out)) {
+            fseek(out, 0, SEEK_SET);
+            fwrite(&header, sizeof(header), 1, out);
+            status = ferror(out) ? -1 : 0;
+        }
+        if (fclose(out) != 0)
+            status = -1;
+    }
+
+    free(buf.data);
+    free(stream.data);
+    free(entries);
+    free(latest);
+    if (ts != &empty)
+        tseries_close(ts);
+    else {
+        free(empty.tracks);
+        free(empty.artists);
+        free(empty.slots);
+    }
+    return status;
+}
+
+/**
+ * Function: tseries_history
+ * -------------------------
+ * @brief  Returns a series' values in every snapshot it appears in.
+ *
+ * Each snapshot is searched through its restart index, so at most
+ * TS_INDEX_INTERVAL entries are decoded per snapshot.
+ *
+ * @param ts The opened file.
+ * @param key The series' key id.
+ * @param out Receives up to ts->num_snapshots points, oldest first.
+ *
+ * @return uint32_t The number of points.
+ *
+ */
+uint32_t tseries_history(tseries_t *ts, uint32_t key, ts_point_t *out)
+{
+    uint64_t values[TS_NUM_VALUES] = {0};
+    uint32_t n = 0;
+
+    for (uint32_t s = 0; s < ts->num_snapshots; s++) {
+        const ts_snapshot_t *snap = ts->snapshots[s];
+        const ts_index_t *index = snapshot_index(snap);
+        uint32_t lo = 0;
+        uint32_t hi = snapshot_restarts(snap);
+        if (hi == 0 || index[0].key > key)
+            continue;
+        /*--Find the last restart point at or before the key--*/
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (index[mid].key <= key)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        ts_cursor_t c;
+        int64_t deltas[TS_NUM_VALUES];
+        cursor_start(&c, snap, lo);
+        while (cursor_next(&c, deltas) && c.key <= key) {
+            if (c.key == key) {
+                out[n].snapshot = s;
+                for (int v = 0; v < TS_NUM_VALUES; v++)
+                    out[n].values[v] = values[v] += (uint64_t)deltas[v];
+                n++;
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+static int compare_growth(const void *a, const void *b)
+{
+    const ts_growth_t *x = (const ts_growth_t *)a;
+    const ts_growth_t *y = (const ts_growth_t *)b;
+    if (x->growth != y->growth)
+        return x->growth < y->growth ? 1 : -1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/**
+ * Function: tseries_growth
+ * ------------------------
+ * @brief  Finds the series whose streams grew the most over the last snapshots.
+ *
+ * Growth is the latest streams minus the streams as of `window` snapshots
+ * earlier, i.e. the sum of the last `window` deltas. A series first seen
+ * inside the window is measured from its first value there; since key ids
+ * follow first appearance, those are the ids from the window's first
+ * snapshot's first_key on, and their first delta is skipped. Only series in
+ * the latest snapshot are ranked. Ties go to the lower key id.
+ *
+ * @param ts The opened file.
+ * @param window The number of snapshots to look back over, at least 1.
+ * @param k The number of series wanted.
+ * @param out Receives up to k series, fastest growing first.
+ *
+ * @return uint32_t The number of series written to out.
+ *
+ */
+uint32_t tseries_growth(tseries_t *ts, uint32_t window, uint32_t k, ts_growth_t *out)
+{
+    if (ts->num_snapshots == 0 || k == 0)
+        return 0;
+    if (window > ts->num_snapshots)
+        window = ts->num_snapshots;
+
+    int64_t *growth = calloc(ts->num_keys + 1, sizeof(int64_t));
+    unsigned char *seen = calloc(ts->num_keys + 1, 1);
+    assert(growth != NULL && seen != NULL && "growth == NULL");
+    uint64_t new_keys = ts->snapshots[ts->num_snapshots - window]->first_key;
+    ts_cursor_t c;
+    int64_t deltas[TS_NUM_VALUES];
+    for (uint32_t s = ts->num_snapshots - window; s < ts->num_snapshots; s++) {
+        cursor_start(&c, ts->snapshots[s], 0);
+        while (cursor_next(&c, deltas)) {
+            if (c.key >= ts->num_keys)
+                continue;
+            if (c.key >= new_keys && !seen[c.key])
+                seen[c.key] = 1;
+            else
+                growth[c.key] += deltas[TS_STREAMS];
+        }
+    }
+
+    /*--Rank the series of the latest snapshot--*/
+    const ts_snapshot_t *latest = ts->snapshots[ts->num_snapshots - 1];
+    ts_growth_t *ranked = emalloc((latest->num_entries + 1) * sizeof(ts_growth_t));
+    uint32_t n = 0;
+    cursor_start(&c, latest, 0);
+    while (cursor_next(&c, deltas))
+        if (c.key < ts->num_keys) {
+            ranked[n].key = c.key;
+            ranked[n++].growth = growth[c.key];
+        }
+    qsort(ranked, n, sizeof(ts_growth_t), compare_growth);
+
+    if (n > k)
+        n = k;
+    memcpy(out, ranked, n * sizeof(ts_growth_t));
+    free(ranked);
+    free(seen);
+    free(growth);
+    return n;
+}
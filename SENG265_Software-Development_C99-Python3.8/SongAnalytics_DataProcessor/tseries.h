@@ -0,0 +1,124 @@
+/** @file tseries.h
+ *  @brief Function prototypes for the snapshot history (time-series) store.
+ *
+ * A history file collects full chart snapshots, oldest first. Every
+ * (track, artist) pair is interned once and numbered in the order it was
+ * first seen. Each snapshot stores, per series it contains, the change of
+ * streams and playlist counts since that series' previous snapshot, as
+ * zigzag varints in series order. A track's history adds up its deltas
+ * snapshot by snapshot, and growth over the last N snapshots is the sum of
+ * the last N deltas, so only those N snapshots are read.
+ */
+#ifndef _TSERIES_H_
+#define _TSERIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "list.h"
+
+#define TS_MAGIC "SAHS"
+#define TS_VERSION 1
+#define TS_ENDIAN_MARK 0x01020304u
+#define TS_INDEX_INTERVAL 64
+
+/**
+ * @brief The numeric columns tracked per series.
+ */
+enum ts_value_id
+{
+    TS_STREAMS,
+    TS_SPOTIFY,
+    TS_APPLE,
+    TS_NUM_VALUES
+};
+
+/**
+ * @brief File header, stored at offset 0 and rewritten by every append.
+ */
+typedef struct ts_header_t
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t endian_mark;
+    uint32_t num_snapshots;
+    uint64_t num_keys;
+    uint64_t last_snapshot;
+} ts_header_t;
+
+/**
+ * @brief Snapshot header. Offsets are relative to the snapshot start.
+ *
+ * It is followed by the label, the keys first seen in this snapshot (track
+ * and artist strings, ids from first_key on), the restart index and the
+ * entries. An entry at a restart point stores its key id, the others the
+ * gap to the previous entry's id.
+ */
+typedef struct ts_snapshot_t
+{
+    uint64_t prev;
+    uint64_t size;
+    uint64_t first_key;
+    uint32_t num_new_keys;
+    uint32_t num_entries;
+    uint32_t keys_offset;
+    uint32_t index_offset;
+    uint32_t entries_offset;
+    uint32_t entries_size;
+} ts_snapshot_t;
+
+/**
+ * @brief A restart point: the key id of every TS_INDEX_INTERVAL-th entry and where it starts.
+ */
+typedef struct ts_index_t
+{
+    uint32_t key;
+    uint32_t offset;
+} ts_index_t;
+
+/**
+ * @brief A series' values in one snapshot.
+ */
+typedef struct ts_point_t
+{
+    uint32_t snapshot;
+    uint64_t values[TS_NUM_VALUES];
+} ts_point_t;
+
+/**
+ * @brief A series and its change over a window of snapshots.
+ */
+typedef struct ts_growth_t
+{
+    uint32_t key;
+    int64_t growth;
+} ts_growth_t;
+
+/**
+ * @brief An opened (memory-mapped) history file with its key table.
+ */
+typedef struct tseries_t
+{
+    const unsigned char *base;
+    size_t size;
+    const ts_header_t *header;
+    uint32_t num_snapshots;
+    const ts_snapshot_t **snapshots;
+    uint32_t num_keys;
+    uint32_t cap_keys;
+    const char **tracks;
+    const char **artists;
+    uint32_t *slots;
+    uint32_t num_slots;
+} tseries_t;
+
+/**
+ * Function protypes associated with the history store.
+ */
+int tseries_append(const char *path, node_t *list, const char *label);
+tseries_t *tseries_open(const char *path);
+void tseries_close(tseries_t *ts);
+const char *tseries_label(tseries_t *ts, uint32_t snapshot);
+uint32_t tseries_history(tseries_t *ts, uint32_t key, ts_point_t *out);
+uint32_t tseries_growth(tseries_t *ts, uint32_t window, uint32_t k, ts_growth_t *out);
+
+#endif
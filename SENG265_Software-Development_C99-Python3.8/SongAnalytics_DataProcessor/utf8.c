@@ -0,0 +1,197 @@
+/** @file utf8.c
+ *  @brief Implementation of UTF-8 validation and safe truncation.
+ *
+ * The per-byte checks follow the well-formed byte sequences table of the
+ * Unicode standard (table 3-7): the first byte fixes how many continuation
+ * bytes follow and the allowed range of the second one.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "utf8.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define UTF8_HAVE_SSE2 1
+#endif
+
+/**
+ * Function: utf8_ascii_prefix
+ * ---------------------------
+ * @brief  Returns how many leading bytes are ASCII, testing whole blocks at a time.
+ *
+ * @param s The bytes.
+ * @param len The number of bytes.
+ *
+ * @return size_t The length of the ASCII prefix; len if every byte is ASCII.
+ *
+ */
+size_t utf8_ascii_prefix(const char *s, size_t len)
+{
+    size_t i = 0;
+#ifdef UTF8_HAVE_SSE2
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+        if (_mm_movemask_epi8(block) != 0)
+            break;
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, s + i, sizeof(word));
+        if ((word & 0x8080808080808080ull) != 0)
+            break;
+    }
+    while (i < len && (unsigned char)s[i] < 0x80)
+        i++;
+    return i;
+}
+
+/**
+ * Function: utf8_init
+ * -------------------
+ * @brief  Starts validating a new piece of text.
+ *
+ * @param state The state to reset.
+ *
+ */
+void utf8_init(utf8_state_t *state)
+{
+    state->need = 0;
+    state->lo = 0x80;
+    state->hi = 0xbf;
+    state->bad = false;
+}
+
+/**
+ * Function: utf8_feed
+ * -------------------
+ * @brief  Validates the next bytes of a text.
+ *
+ * @param state The state left by the previous bytes.
+ * @param s The bytes.
+ * @param len The number of bytes.
+ *
+ * @return bool False if the text is not valid UTF-8 so far.
+ *
+ */
+bool utf8_feed(utf8_state_t *state, const char *s, size_t len)
+{
+    size_t i = 0;
+    while (!state->bad && i < len) {
+        /*--Between characters, skip ASCII a block at a time--*/
+        if (state->need == 0) {
+            i += utf8_ascii_prefix(s + i, len - i);
+            if (i == len)
+                break;
+        }
+
+        unsigned char b = (unsigned char)s[i++];
+        if (state->need > 0) {
+            if (b < state->lo || b > state->hi)
+                state->bad = true;
+            state->need--;
+            state->lo = 0x80;
+            state->hi = 0xbf;
+        } else if (b >= 0xc2 && b <= 0xdf) {
+            state->need = 1;
+        } else if (b >= 0xe0 && b <= 0xef) {
+            state->need = 2;
+            if (b == 0xe0)
+                state->lo = 0xa0;   /* no overlong forms */
+            else if (b == 0xed)
+                state->hi = 0x9f;   /* no surrogates */
+        } else if (b >= 0xf0 && b <= 0xf4) {
+            state->need = 3;
+            if (b == 0xf0)
+                state->lo = 0x90;   /* no overlong forms */
+            else if (b == 0xf4)
+                state->hi = 0x8f;   /* nothing above U+10FFFF */
+        } else {
+            state->bad = true;
+        }
+    }
+    return !state->bad;
+}
+
+/**
+ * Function: utf8_complete
+ * -----------------------
+ * @brief  Checks that a text fed so far is valid and does not end inside a character.
+ *
+ * @param state The state after the last bytes.
+ *
+ * @return bool True if the whole text is valid UTF-8.
+ *
+ */
+bool utf8_complete(const utf8_state_t *state)
+{
+    return !state->bad && state->need == 0;
+}
+
+/**
+ * Function: utf8_valid
+ * --------------------
+ * @brief  Checks that a string is valid UTF-8.
+ *
+ * @param s The bytes.
+ * @param len The number of bytes.
+ *
+ * @return bool True if valid.
+ *
+ */
+bool utf8_valid(const char *s, size_t len)
+{
+    utf8_state_t state;
+    utf8_init(&state);
+    utf8_feed(&state, s, len);
+    return utf8_complete(&state);
+}
+
+/**
+ * Function: utf8_append
+ * ---------------------
+ * @brief  Appends a piece of text to a fixed-size buffer without splitting a character.
+ *
+ * When the piece does not fit, the text is cut before the first character
+ * that would not fit whole, and truncated is set; once it is set, later
+ * pieces are dropped, since they continue text that was cut. A newline
+ * ending the piece is always kept.
+ *
+ * @param dst The NUL-terminated buffer.
+ * @param size The size of the buffer, at least 2.
+ * @param piece The text to append.
+ * @param truncated Set when the text is cut, and checked before appending.
+ *
+ * @return size_t The length of dst afterwards.
+ *
+ */
+size_t utf8_append(char *dst, size_t size, const char *piece, bool *truncated)
+{
+    size_t len = strlen(dst);
+    size_t n = strlen(piece);
+    bool newline = n > 0 && piece[n - 1] == '\n';
+
+    if (!*truncated && len + n < size) {
+        memcpy(dst + len, piece, n + 1);
+        return len + n;
+    }
+
+    /*--Copy what fits, then back up to the start of the character the cut falls into--*/
+    size_t room = size - 1 - (newline ? 1 : 0);
+    size_t end = len;
+    if (!*truncated && len < room) {
+        size_t copied = n < room - len ? n : room - len;
+        memcpy(dst + len, piece, copied);
+        end = len + copied;
+        unsigned char next = (unsigned char)piece[copied];
+        while (end > 0 && (next & 0xc0) == 0x80)
+            next = (unsigned char)dst[--end];
+    }
+    *truncated = true;
+    if (end > room)
+        end = room;
+    if (newline)
+        dst[end++] = '\n';
+    dst[end] = '\0';
+    return end;
+}
@@ -0,0 +1,41 @@
+/** @file utf8.h
+ *  @brief Function prototypes for UTF-8 validation and safe truncation.
+ *
+ * Validation is incremental, so a record read in several pieces is checked
+ * piece by piece, and a character split between two reads is still judged
+ * as a whole. Runs of ASCII, the common case, are skipped a block at a time
+ * (16 bytes per SSE2 test on x86-64, 8 per word test elsewhere); only
+ * blocks with a high bit set go through the per-byte checks, which reject
+ * overlong forms, surrogates and code points above U+10FFFF.
+ */
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Validation state between two pieces of input.
+ *
+ * need is the number of continuation bytes still expected, lo and hi bound
+ * the next one. bad sticks once an invalid byte is seen.
+ */
+typedef struct utf8_state_t
+{
+    unsigned char need;
+    unsigned char lo;
+    unsigned char hi;
+    bool bad;
+} utf8_state_t;
+
+/**
+ * Function protypes associated with UTF-8 handling.
+ */
+void utf8_init(utf8_state_t *state);
+bool utf8_feed(utf8_state_t *state, const char *s, size_t len);
+bool utf8_complete(const utf8_state_t *state);
+bool utf8_valid(const char *s, size_t len);
+size_t utf8_ascii_prefix(const char *s, size_t len);
+size_t utf8_append(char *dst, size_t size, const char *piece, bool *truncated);
+
+#endif
@@ -0,0 +1,232 @@
+/** @file watch.c
+ *  @brief Implementation of watching the data file with inotify.
+ *
+ * watch_wait only reports that the file may have changed; watch_check then
+ * decides between an incremental parse (the file grew and what was already
+ * read is unchanged) and a full one.
+ */
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "watch.h"
+
+#define EVENT_BUF_LEN (64 * (sizeof(struct inotify_event) + 256))
+#define WATCH_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+
+/**
+ * @brief Reads pending events, returns 1 if one of them names the file.
+ */
+static int read_events(watch_t *watch)
+{
+    char buf[EVENT_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int relevant = 0;
+
+    ssize_t len = read(watch->fd, buf, sizeof(buf));
+    if (len <= 0)
+        return len < 0 && errno != EAGAIN && errno != EINTR ? -1 : 0;
+
+    for (char *p = buf; p < buf + len; ) {
+        const struct inotify_event *event = (const struct inotify_event *)p;
+        if (event->len > 0 && strcmp(event->name, watch->name) == 0)
+            relevant = 1;
+        p += sizeof(struct inotify_event) + event->len;
+    }
+    return relevant;
+}
+
+/**
+ * Function: watch_open
+ * --------------------
+ * @brief  Starts watching a file for modification or replacement.
+ *
+ * @param path The file to watch.
+ *
+ * @return watch_t* The watch, or NULL if inotify could not be set up.
+ *
+ */
+watch_t *watch_open(const char *path)
+{
+    char *dir_copy = strdup(path);
+    char *name_copy = strdup(path);
+    watch_t *watch = emalloc(sizeof(watch_t));
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watch->wd = watch->fd < 0 ? -1 : inotify_add_watch(watch->fd, dirname(dir_copy), WATCH_MASK);
+    watch->name = strdup(basename(name_copy));
+    free(dir_copy);
+    free(name_copy);
+
+    if (watch->wd < 0) {
+        watch_close(watch);
+        return NULL;
+    }
+    return watch;
+}
+
+/**
+ * Function: watch_wait
+ * --------------------
+ * @brief  Blocks until the file changes, then waits for it to go quiet.
+ *
+ * Writers usually produce a burst of events, so after the first relevant
+ * event this keeps draining until WATCH_QUIET_MS pass without another one.
+ *
+ * @param watch The watch.
+ *
+ * @return int 0 when the file changed, -1 on error.
+ *
+ */
+int watch_wait(watch_t *watch)
+{
+    struct pollfd pfd = {watch->fd, POLLIN, 0};
+    int changed = 0;
+
+    while (!changed) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+        changed = read_events(watch);
+        if (changed < 0)
+            return -1;
+    }
+    while (poll(&pfd, 1, WATCH_QUIET_MS) > 0)
+        if (read_events(watch) < 0)
+            return -1;
+    return 0;
+}
+
+/**
+ * Function: watch_close
+ * ---------------------
+ * @brief  Stops watching and frees the watch.
+ *
+ * @param watch The watch to close.
+ *
+ */
+void watch_close(watch_t *watch)
+{
+    if (watch == NULL)
+        return;
+    if (watch->fd >= 0)
+        close(watch->fd);
+    free(watch->name);
+    free(watch);
+}
+
+/**
+ * Function: watch_line_end
+ * ------------------------
+ * @brief  Finds the offset just past the last newline of a file.
+ *
+ * Anything after it is a line still being written and must not be parsed yet.
+ *
+ * @param file The file.
+ *
+ * @return long The offset, 0 if the file has no complete line.
+ *
+ */
+long watch_line_end(FILE *file)
+{
+    char buf[4096];
+
+    fseek(file, 0, SEEK_END);
+    long end = ftell(file);
+    while (end > 0) {
+        long start = end > (long)sizeof(buf) ? end - (long)sizeof(buf) : 0;
+        fseek(file, start, SEEK_SET);
+        size_t n = fread(buf, 1, (size_t)(end - start), file);
+        for (size_t i = n; i > 0; i--)
+            if (buf[i - 1] == '\n')
+                return start + (long)i;
+        end = start;
+    }
+    return 0;
+}
+
+static uint64_t hash_bytes(FILE *file, long offset, long len, uint64_t h)
+{
+    int c;
+
+    fseek(file, offset, SEEK_SET);
+    for (long i = 0; i < len && (c = fgetc(file)) != EOF; i++)
+        h = (h ^ (unsigned char)c) * 1099511628211ull;
+    return h;
+}
+
+/**
+ * Function: watch_fingerprint
+ * ---------------------------
+ * @brief  Hashes the start and the end of the first `end` bytes of a file.
+ *
+ * Used to tell whether a file that grew still begins with what was already
+ * parsed. Only WATCH_SAMPLE bytes at each end are read, so an edit in the
+ * middle of a large file that keeps both ends intact is not noticed.
+ *
+ * @param file The file.
+ * @param end The length of the region already parsed.
+ *
+ * @return uint64_t An FNV-1a hash of the sampled bytes.
+ *
+ */
+uint64_t watch_fingerprint(FILE *file, long end)
+{
+    long head = end < WATCH_SAMPLE ? end : WATCH_SAMPLE;
+    long tail = end - head < WATCH_SAMPLE ? end - head : WATCH_SAMPLE;
+
+    uint64_t h = hash_bytes(file, 0, head, 1469598103934665603ull);
+    return hash_bytes(file, end - tail, tail, h);
+}
+
+/**
+ * Function: watch_check
+ * ---------------------
+ * @brief  Works out how a followed file changed since part of it was parsed.
+ *
+ * A file replaced by rename is a different inode and is reopened. It is
+ * rewritten if it was replaced, shrank, or no longer begins with what was
+ * parsed. The file is left positioned where parsing should resume: at
+ * consumed when appended, at 0 when rewritten.
+ *
+ * @param file The open file, replaced when the path now names another file.
+ * @param path The path being followed.
+ * @param consumed How many bytes were parsed.
+ * @param fingerprint watch_fingerprint of those bytes.
+ * @param end Set to the end of the last complete line.
+ *
+ * @return int WATCH_UNCHANGED, WATCH_APPENDED or WATCH_REWRITTEN.
+ *
+ */
+int watch_check(FILE **file, const char *path, long consumed, uint64_t fingerprint, long *end)
+{
+    struct stat old_st, new_st;
+    bool replaced = false;
+
+    FILE *current = fopen(path, "r");
+    if (current != NULL) {
+        fstat(fileno(*file), &old_st);
+        fstat(fileno(current), &new_st);
+        replaced = old_st.st_ino != new_st.st_ino || old_st.st_dev != new_st.st_dev;
+        if (replaced) {
+            fclose(*file);
+            *file = current;
+        } else {
+            fclose(current);
+        }
+    }
+
+    *end = watch_line_end(*file);
+    if (replaced || *end < consumed || watch_fingerprint(*file, consumed) != fingerprint) {
+        rewind(*file);
+        return WATCH_REWRITTEN;
+    }
+    if (*end == consumed)
+        return WATCH_UNCHANGED;
+    fseek(*file, consumed, SEEK_SET);
+    return WATCH_APPENDED;
+}
@@ -0,0 +1,39 @@
+/** @file watch.h
+ *  @brief Function prototypes for watching the data file with inotify.
+ */
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define WATCH_QUIET_MS 100
+#define WATCH_SAMPLE 4096
+#define WATCH_UNCHANGED 0
+#define WATCH_APPENDED 1
+#define WATCH_REWRITTEN 2
+
+/**
+ * @brief An inotify watch on the directory that holds a file.
+ *
+ * The directory is watched rather than the file itself so that a file
+ * replaced by rename (the usual way a new export is dropped in) is noticed.
+ */
+typedef struct watch_t
+{
+    int fd;
+    int wd;
+    char *name;
+} watch_t;
+
+/**
+ * Function protypes associated with watching a file.
+ */
+watch_t *watch_open(const char *path);
+int watch_wait(watch_t *watch);
+void watch_close(watch_t *watch);
+long watch_line_end(FILE *file);
+uint64_t watch_fingerprint(FILE *file, long end);
+int watch_check(FILE **file, const char *path, long consumed, uint64_t fingerprint, long *end);
+
+#endif
@@ -0,0 +1,148 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+"""
+Helpers for workload.sh: prepares pre-sorted inputs and replays a socket session against a server.
+Sample input: python3 workload.py split synthetic.csv a.csv b.csv
+              python3 workload.py session workload.sock served.csv 3
+"""
+import csv
+import socket
+import sys
+import threading
+from typing import List
+
+# One connection per list, sent at the same time, so the workers serve them concurrently
+SESSIONS = [
+    ['--order_by=STREAMS --order=DES --limit=10',
+     '--filter=ARTIST --value="Taylor Swift" --order_by=NO_SPOTIFY_PLAYLISTS --order=ASC --limit=50',
+     '--filter=YEAR --value=2021 --count',
+     '--filter=ARTIST_IS --value=SZA --exists'],
+    ['--filter=YEAR --value=2019 --order_by=NO_APPLE_PLAYLISTS --order=DES --limit=100',
+     '--stats=streams --group_by=YEAR',
+     '--order_by=TRACK_NAME --order=ASC --limit=1000'],
+    ['--filter=FUZZY_ARTIST --value="Tailor Swift" --order_by=STREAMS --order=DES --limit=20',
+     '--filter=FUZZY_TRACK --value=Lvoe --order_by=STREAMS --order=DES --limit=20',
+     '--prefix=lo --limit=10',
+     '--prefix=s --prefix_on=ARTIST --limit=10',
+     '--prefix=L --limit=2147483647'],
+    ['--filter=ARTIST --value="Dua Lipa" --order_by=STREAMS --order=ASC --limit=500',
+     '--order_by=STREAMS --order=DES --limit=20 --after=1000000,0',
+     '--filter=ARTIST --value=Drake --columns=track_name,streams --order_by=STREAMS --order=DES --limit=100'],
+]
+
+# Malformed requests: each must be answered with an error, without stopping the server
+REJECTED = ['=',
+            '""',
+            '--prefix=L --limit=-1',
+            '--prefix=L --limit=3000000000',
+            '--filter=FUZZY_ARTIST --value=Drak --prefix=D --limit=-1']
+
+
+def split_sorted(data: str, out_a: str, out_b: str) -> None:
+    """
+    Splits a data file into two halves, each sorted by streams, descending.
+
+    Parameters
+    ----------
+    data : str
+        The data file.
+    out_a : str
+        Where to write the odd records.
+    out_b : str
+        Where to write the even records.
+    """
+    with open(data, encoding='utf-8', newline='') as infile:
+        header = infile.readline()
+        lines = infile.readlines()
+    rows = [(int(next(csv.reader([line]))[7]), line) for line in lines]
+    for path, half in ((out_a, rows[0::2]), (out_b, rows[1::2])):
+        half.sort(key=lambda row: -row[0])
+        with open(path, 'w', encoding='utf-8', newline='') as out:
+            out.write(header)
+            out.writelines(line for _, line in half)
+
+
+def ask(path: str, requests: List[str], rounds: int, failures: List[str], rejected: bool = False) -> None:
+    """
+    Sends every request rounds times over one connection and reads each response.
+
+    Parameters
+    ----------
+    path : str
+        The server's socket.
+    requests : list
+        The request lines.
+    rounds : int
+        How many times to send them.
+    failures : list
+        Receives the requests answered with an error, or without one if rejected.
+    rejected : bool
+        Whether the requests are expected to be rejected.
+    """
+    with socket.socket(socket.AF_UNIX) as sock:
+        sock.connect(path)
+        stream = sock.makefile('rw', encoding='utf-8')
+        for _ in range(rounds):
+            for request in requests:
+                stream.write(request + '\n')
+                stream.flush()
+                first = stream.readline()
+                while first != '' and stream.readline() not in ('\n', ''):
+                    pass
+                if first.startswith('Error') != rejected:
+                    failures.append(request)
+
+
+def session(path: str, served: str, rounds: int) -> int:
+    """
+    Replays SESSIONS on concurrent connections, with records appended to the served file halfway.
+
+    Parameters
+    ----------
+    path : str
+        The server's socket.
+    served : str
+        The data file the server follows.
+    rounds : int
+        How many times each connection sends its requests.
+
+    Returns
+    -------
+    int
+        0 if every request was answered, 1 otherwise.
+    """
+    failures: List[str] = []
+    ask(path, REJECTED, 1, failures, True)
+    for half in range(2):
+        threads = [threading.Thread(target=ask, args=(path, requests, rounds, failures))
+                   for requests in SESSIONS]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        if half == 0:
+            # The ingester loads these while the second half runs
+            with open(served, encoding='utf-8') as infile:
+                appended = infile.readlines()[1:20001]
+            with open(served, 'a', encoding='utf-8') as out:
+                out.writelines(appended)
+    for request in failures:
+        print('request failed: ' + request, file=sys.stderr)
+    return 1 if failures else 0
+
+
+def main() -> int:
+    """
+    Runs the helper named by the first argument.
+    """
+    if len(sys.argv) == 5 and sys.argv[1] == 'split':
+        split_sorted(sys.argv[2], sys.argv[3], sys.argv[4])
+        return 0
+    if len(sys.argv) == 5 and sys.argv[1] == 'session':
+        return session(sys.argv[2], sys.argv[3], int(sys.argv[4]))
+    print('Usage: workload.py split DATA OUT_A OUT_B | session SOCKET SERVED_DATA ROUNDS', file=sys.stderr)
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
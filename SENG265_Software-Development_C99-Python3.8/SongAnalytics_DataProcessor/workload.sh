@@ -0,0 +1,83 @@
+#!/bin/sh
+# Replays the common query shapes against a data file and prints how long each took.
+# Used by `make bench` to time a build and by `make release` to train the profile.
+# Output files are written to the current directory.
+# Usage: workload.sh BINARY DATAFILE [ROUNDS]
+
+BIN=$1
+DATA=$2
+ROUNDS=${3:-1}
+PYTHON=${PYTHON:-python3}
+HELPER=$(dirname "$0")/workload.py
+
+if [ -z "$BIN" ] || [ -z "$DATA" ]; then
+    echo "Usage: workload.sh BINARY DATAFILE [ROUNDS]" >&2
+    exit 1
+fi
+
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# run NAME ARGS...: runs one query ROUNDS times and prints its total time.
+run() {
+    name=$1
+    shift
+    start=$(now_ms)
+    i=0
+    while [ $i -lt "$ROUNDS" ]; do
+        "$BIN" "$@" > /dev/null || { echo "$name failed" >&2; exit 1; }
+        i=$((i + 1))
+    done
+    printf '%-22s %6d ms\n' "$name" $(( $(now_ms) - start ))
+}
+
+# Top-K scans: two fused kernels, then a shape without one that loads and runs top_k
+run top_streams        --data="$DATA" --order_by=STREAMS --order=DES --limit=10
+run year_apple         --data="$DATA" --filter=YEAR --value=2019 --order_by=NO_APPLE_PLAYLISTS --order=DES --limit=100
+run artist_spotify     --data="$DATA" --filter=ARTIST --value="Taylor Swift" --order_by=NO_SPOTIFY_PLAYLISTS --order=ASC --limit=50
+
+# Filtered load and full sort, text order, counts and statistics
+run artist_sort        --data="$DATA" --filter=ARTIST --value="Dua Lipa" --order_by=STREAMS --order=ASC
+run track_name         --data="$DATA" --order_by=TRACK_NAME --order=ASC --limit=1000
+run count_year         --data="$DATA" --filter=YEAR --value=2021 --count
+run stats_by_year      --data="$DATA" --stats=streams --group_by=YEAR
+run fuzzy_artist       --data="$DATA" --filter=FUZZY_ARTIST --value="Tailor Swift" --order_by=STREAMS --order=DES --limit=20
+run prefix_track       --data="$DATA" --prefix=lo --limit=10
+
+# A top-K large enough to take the export path
+run export_top         --data="$DATA" --order_by=STREAMS --order=DES --limit=50000
+
+# Merging inputs that are already in the requested order
+"$PYTHON" "$HELPER" split "$DATA" workload_a.csv workload_b.csv || exit 1
+run presorted_merge    --data=workload_a.csv --data=workload_b.csv --presorted=STREAMS:DES --order_by=STREAMS --order=DES --limit=1000
+
+# Conversions and queries over the converted files
+run save_cache         --data="$DATA" --save_cache=workload.sabf --cache_index=FUZZY,PREFIX --save_rows=workload.sarw
+run cache_top          --cache=workload.sabf --order_by=STREAMS --order=DES --limit=100
+run rows_filter        --rows=workload.sarw --filter=ARTIST --value="Bad Bunny" --order_by=NO_SPOTIFY_PLAYLISTS --order=DES --limit=100
+run cache_prefix       --cache=workload.sabf --prefix=s --prefix_on=ARTIST --limit=10
+run cache_fuzzy        --cache=workload.sabf --filter=FUZZY_TRACK --value=Lvoe --order_by=STREAMS --order=DES --limit=20
+
+# History: two snapshots, then growth and one track's series
+rm -f workload.sats
+run save_history_1     --data=workload_a.csv --save_history=workload.sats --snapshot=w1
+run save_history_2     --data="$DATA" --save_history=workload.sats --snapshot=w2
+run history_growth     --history=workload.sats --growth=10
+run history_track      --history=workload.sats --track=Love
+
+# Server: concurrent connections, with records appended to the followed file halfway.
+# SIGTERM stops it normally, so an instrumented build writes its profile.
+cp "$DATA" workload_serve.csv
+rm -f workload.sock
+"$BIN" --data=workload_serve.csv --serve=workload.sock > /dev/null &
+pid=$!
+while [ ! -S workload.sock ]; do
+    kill -0 $pid 2> /dev/null || { echo "serve failed" >&2; exit 1; }
+    sleep 0.1
+done
+start=$(now_ms)
+"$PYTHON" "$HELPER" session workload.sock workload_serve.csv "$ROUNDS" || { kill -TERM $pid; echo "serve_session failed" >&2; exit 1; }
+printf '%-22s %6d ms\n' serve_session $(( $(now_ms) - start ))
+kill -TERM $pid
+wait $pid || { echo "serve failed to stop" >&2; exit 1; }